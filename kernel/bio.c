@@ -5,13 +5,24 @@
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers come from a slab cache. The cache grows on misses up
+// to a target size (bcachesize()), and swapout() shrinks it back
+// towards a minimum size when memory runs low: NBUF buffers, plus
+// those the logs reserve (breserve()) to hold their transactions. When every buffer
+// is in use, bget() waits for a brelse().
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
+// * bread_range and bwrite_range do the same for a run of up
+//     to NRUN consecutive blocks, in as few disk requests as
+//     possible.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// bdevsw[] says which driver holds each device's blocks.
 
 
 #include "types.h"
@@ -22,68 +33,332 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+#include "proc.h"
 
-struct {
+// Block device switch, indexed by device number: the
+// driver's routines to read or write runs of buffers and wait,
+// and to start doing so and have bdone() called on each.
+static struct bdevsw {
+  void (*rw)(int, struct buf**, int, int);
+  void (*rw_async)(int, struct buf**, int, int);
+} bdevsw[NDISK] = {
+  [0]      { virtio_disk_rwv, virtio_disk_rw_async },
+  [1]      { virtio_disk_rwv, virtio_disk_rw_async },
+  [RAMDEV] { ramdiskrw, ramdiskrw_async },
+};
+
+// Read or write the nrun runs of buffers runs[0..nrun-1] of
+// device dev, each linked through qnext, and wait.
+// The blocks count towards the calling process's rusage.
+void
+bdevrw(uint dev, struct buf **runs, int nrun, int write)
+{
+  struct proc *p = myproc();
+  struct buf *b;
+
+  if(dev >= NDISK)
+    panic("bdevrw");
+  for(int i = 0; p && i < nrun; i++){
+    for(b = runs[i]; b; b = b->qnext){
+      if(write)
+        p->ru.oublock++;
+      else
+        p->ru.inblock++;
+    }
+  }
+  bdevsw[dev].rw(dev, runs, nrun, write);
+}
+
+// The buffers are spread over NBUCKET hash buckets by
+// (dev, blockno), each with its own lock and its own list
+// in MRU order, so lookups of different blocks rarely contend.
+// A buffer's bucket lock protects its refcnt and its place
+// in the bucket; dev and blockno only change while it is
+// unreferenced and moving between buckets.
+//
+// A miss allocates a new buffer, or once the cache is at its
+// target size, takes an unused one from whichever bucket has
+// the least recently released one. Only one CPU at a time does
+// that (under bcache.lock), and it is the only code that holds
+// more than one bucket lock, so there is no deadlock.
+
+#define NBUCKET 13
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;   // head.next is most recently used
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;   // serializes allocating, stealing and freeing buffers
+  struct kmem_cache *cache;
+  struct bucket bucket[NBUCKET];
+  int nbuf;               // buffers allocated
+  int min;                // keep at least this many
+  int target;             // grow up to this many
+  int nwait;              // bget()s waiting for an unused buffer
+  uint clock;             // for buf.lastuse
+  uint64 hits[NDISK];     // bget()s that found the block, per device
+  uint64 misses[NDISK];   // and that didn't
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Unlink b from its bucket's list.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Put b at the MRU end of bucket k's list.
+static void
+bpush(struct bucket *k, struct buf *b)
+{
+  b->next = k->head.next;
+  b->prev = &k->head;
+  k->head.next->prev = b;
+  k->head.next = b;
+}
+
+static void
+bufctor(void *o)
+{
+  initsleeplock(&((struct buf*)o)->lock, "buffer");
+  ((struct buf*)o)->qnext = 0;
+  ((struct buf*)o)->udata = 0;
+}
+
 void
 binit(void)
 {
+  struct bucket *k;
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), bufctor);
+  bcache.min = NBUF;
+  bcache.target = NBUFTARGET;
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    initlock(&k->lock, "bcache.bucket");
+    k->head.prev = &k->head;
+    k->head.next = &k->head;
+  }
+
+  // the NBUF buffers that are always there start out in bucket 0.
+  for(bcache.nbuf = 0; bcache.nbuf < NBUF; bcache.nbuf++){
+    if((b = kmem_cache_alloc(bcache.cache)) == 0)
+      panic("binit");
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->dev = b->blockno = -1;
+    bpush(&bcache.bucket[0], b);
+  }
+}
+
+// Return the cached buffer for the block in bucket k,
+// with a new reference, or 0. Caller holds k->lock.
+static struct buf*
+bfind(struct bucket *k, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = k->head.next; b != &k->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Take the least recently released unused buffer out of
+// its bucket, or return 0 if every buffer is in use.
+// Caller holds bcache.lock.
+static struct buf*
+bsteal(void)
+{
+  struct bucket *k, *bk = 0;
+  struct buf *b, *victim = 0;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // look at the LRU end of each bucket, holding the lock
+  // of the best one's bucket so far.
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    acquire(&k->lock);
+    for(b = k->head.prev; b != &k->head; b = b->prev)
+      if(b->refcnt == 0)
+        break;
+    if(b != &k->head && (victim == 0 || (int)(b->lastuse - victim->lastuse) < 0)){
+      if(bk)
+        release(&bk->lock);
+      victim = b;
+      bk = k;
+    } else {
+      release(&k->lock);
+    }
   }
+  if(victim){
+    bunlink(victim);
+    release(&bk->lock);
+  }
+  return victim;
 }
 
+static void bput(struct buf*);
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For readahead (ahead != 0), only return a newly
+// allocated buffer, and don't wait for one; else 0.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
+  struct bucket *k = bhash(dev, blockno);
   struct buf *b;
 
-  acquire(&bcache.lock);
+  acquire(&k->lock);
+  b = bfind(k, dev, blockno);
+  release(&k->lock);
+  if(b){
+    if(ahead){
+      bput(b);
+      return 0;
+    }
+    __sync_fetch_and_add(&bcache.hits[dev], 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  if(!ahead)
+    __sync_fetch_and_add(&bcache.misses[dev], 1);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+  // Not cached; get a new buffer or steal an unused one.
+  acquire(&bcache.lock);
+  for(;;){
+    // someone else may have cached it meanwhile.
+    acquire(&k->lock);
+    b = bfind(k, dev, blockno);
+    release(&k->lock);
+    if(b){
       release(&bcache.lock);
+      if(ahead){
+        bput(b);
+        return 0;
+      }
       acquiresleep(&b->lock);
       return b;
     }
+
+    if(bcache.nbuf < bcache.target && (b = kmem_cache_alloc(bcache.cache)) != 0){
+      bcache.nbuf++;
+      break;
+    }
+    // count ourselves as waiting before looking, so that
+    // a brelse() after the scan passed its bucket wakes us.
+    if(ahead){
+      if((b = bsteal()) != 0)
+        break;
+      release(&bcache.lock);
+      return 0;
+    }
+    bcache.nwait++;
+    if((b = bsteal()) == 0)
+      sleep(&bcache, &bcache.lock);
+    bcache.nwait--;
+    if(b)
+      break;
   }
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  acquire(&k->lock);
+  bpush(k, b);
+  release(&k->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Free up to n unused buffers, keeping at least the minimum,
+// and also any above the target size.
+// Returns the number freed.
+int
+bshrink(int n)
+{
+  struct bucket *k;
+  struct buf *b, *prev;
+  int freed = 0;
+
+  acquire(&bcache.lock);
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    acquire(&k->lock);
+    for(b = k->head.prev; b != &k->head; b = prev){
+      prev = b->prev;
+      if(bcache.nbuf <= bcache.min || (freed >= n && bcache.nbuf <= bcache.target))
+        break;
+      if(b->refcnt == 0){
+        bunlink(b);
+        kmem_cache_free(bcache.cache, b);
+        bcache.nbuf--;
+        freed++;
+      }
+    }
+    release(&k->lock);
+  }
+  release(&bcache.lock);
+  return freed;
+}
+
+// Set the target size of the cache to n buffers (at least
+// the minimum), shrinking it if needed; n == 0 leaves it alone.
+// Returns the number of buffers now allocated.
+int
+bsetsize(int n)
+{
+  if(n > 0){
+    acquire(&bcache.lock);
+    bcache.target = n < bcache.min ? bcache.min : n;
+    release(&bcache.lock);
+    bshrink(0);
+  }
+  return bcache.nbuf;
+}
+
+// Raise the minimum size of the cache by n buffers, for a log
+// whose pinned transactions need them, and allocate them now.
+// Returns 0, or -1 if there isn't the memory.
+int
+breserve(int n)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  while(bcache.nbuf < bcache.min + n){
+    if((b = kmem_cache_alloc(bcache.cache)) == 0){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return -1;
     }
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->dev = b->blockno = -1;
+    acquire(&bcache.bucket[0].lock);
+    bpush(&bcache.bucket[0], b);
+    release(&bcache.bucket[0].lock);
+    bcache.nbuf++;
   }
-  panic("bget: no buffers");
+  bcache.min += n;
+  if(bcache.target < bcache.min)
+    bcache.target = bcache.min;
+  release(&bcache.lock);
+  return 0;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -92,25 +367,170 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b->dev, b, 0);
+    bdevrw(b->dev, &b, 1, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Link bs[0..n-1], buffers for consecutive blocks, into one
+// qnext run for the disk, and return its head.
+static struct buf*
+brun(struct buf **bs, int n)
+{
+  for(int i = 0; i < n-1; i++)
+    bs[i]->qnext = bs[i+1];
+  bs[n-1]->qnext = 0;
+  return bs[0];
+}
+
+// Return locked bufs in bs[0..n-1] with the contents of blocks
+// blockno..blockno+n-1. Each run of them that isn't cached is
+// read with one disk request, all of them queued at once.
+void
+bread_range(uint dev, uint blockno, int n, struct buf **bs)
+{
+  struct buf *runs[NRUN];
+  int i, j, nrun = 0;
+
+  if(n > NRUN)
+    panic("bread_range");
+  // lock them in block order, like any other holder of
+  // several buffers of a run.
+  for(i = 0; i < n; i++)
+    bs[i] = bget(dev, blockno + i, 0);
+  for(i = 0; i < n; i = j){
+    if(bs[i]->valid){
+      j = i + 1;
+      continue;
+    }
+    for(j = i + 1; j < n && !bs[j]->valid; j++)
+      ;
+    runs[nrun++] = brun(bs + i, j - i);
+  }
+  if(nrun > 0)
+    bdevrw(dev, runs, nrun, 0);
+  for(i = 0; i < n; i++)
+    bs[i]->valid = 1;
+}
+
+// Write locked bufs bs[0..n-1], which must hold consecutive
+// blocks of one device, to disk with one request.
+void
+bwrite_range(struct buf **bs, int n)
+{
+  if(n > NRUN)
+    panic("bwrite_range");
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock) || bs[i]->dev != bs[0]->dev ||
+       bs[i]->blockno != bs[0]->blockno + i)
+      panic("bwrite_range");
+  brun(bs, n);
+  bdevrw(bs[0]->dev, bs, 1, 1);  // bs[0] heads the run
+}
+
+// Is there a copy of the block in the cache, or on its way?
+// Only a hint, unless the caller holds a lock that keeps the
+// block from being read into the cache, as ilock() does for
+// a file's data.
+int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *k = bhash(dev, blockno);
+  struct buf *b;
+  int r = 0;
+
+  acquire(&k->lock);
+  for(b = k->head.next; b != &k->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      r = 1;
+  release(&k->lock);
+  return r;
+}
+
+// Read or write the n blocks from blockno straight from or to
+// memory, block i at addrs[i], in one disk request, bypassing
+// the cache; the caller makes sure no cached copy is involved.
+// Returns 0, or -1 if there isn't the memory to do it.
+int
+bdirect(uint dev, uint blockno, int n, uchar **addrs, int write)
+{
+  struct buf *bs[NRUN];
+  int i;
+
+  if(n > NRUN)
+    panic("bdirect");
+  // buffers only for the driver's bookkeeping, not cached.
+  for(i = 0; i < n; i++){
+    if((bs[i] = kmem_cache_alloc(bcache.cache)) == 0){
+      while(--i >= 0)
+        kmem_cache_free(bcache.cache, bs[i]);
+      return -1;
+    }
+    bs[i]->dev = dev;
+    bs[i]->blockno = blockno + i;
+    bs[i]->udata = addrs[i];
+  }
+  brun(bs, n);
+  bdevrw(dev, bs, 1, write);  // bs[0] heads the run
+  for(i = 0; i < n; i++){
+    bs[i]->udata = 0;
+    kmem_cache_free(bcache.cache, bs[i]);
+  }
+  return 0;
+}
+
+// Start reading the n blocks from blockno into the cache,
+// without waiting for the disk. Quietly skips blocks that
+// are already cached, or for which there's no buffer to
+// spare. Each run of blocks it does read is one disk request,
+// all of them queued at once.
+void
+breadahead(uint dev, uint blockno, int n)
+{
+  struct buf *bs[NRUN], *runs[NRUN];
+  struct buf *b;
+  int i, nb = 0, nrun = 0;
+
+  if(n > NRUN)
+    n = NRUN;
+  for(i = 0; i < n; i++){
+    // bget() returns it locked, and new, so not yet valid.
+    if((b = bget(dev, blockno + i, 1)) != 0)
+      bs[nb++] = b;
+    if(nb > 0 && (b == 0 || i == n-1)){
+      runs[nrun++] = brun(bs, nb);  // linked; bs can be reused
+      nb = 0;
+    }
+  }
+  if(nrun > 0)
+    bdevsw[dev].rw_async(dev, runs, nrun, 0);
+}
+
+// A readahead of b finished: release the lock and the
+// reference that breadahead() had. Called by the disk
+// interrupt handler, not by the process that locked b.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b->dev, b, 1);
+  bdevrw(b->dev, &b, 1, 1);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
@@ -118,34 +538,65 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b.
+static void
+bput(struct buf *b)
+{
+  struct bucket *k;
+  int unused;
+
+  k = bhash(b->dev, b->blockno);
+  acquire(&k->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
+    bunlink(b);
+    bpush(k, b);
+  }
+  unused = b->refcnt == 0;
+  release(&k->lock);
+
+  if(unused && bcache.nwait){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *k = bhash(b->dev, b->blockno);
+
+  acquire(&k->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&k->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *k = bhash(b->dev, b->blockno);
+
+  acquire(&k->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&k->lock);
 }
 
-
+// Fill in st with dev's I/O statistics, for iostat().
+int
+biostat(uint dev, struct iostat *st)
+{
+  if(dev >= NDISK)
+    return -1;
+  memset(st, 0, sizeof(*st));
+  st->hits = bcache.hits[dev];
+  st->misses = bcache.misses[dev];
+  if(dev < NVIRTIO)
+    virtio_disk_stat(dev, st);
+  else
+    ramdiskstat(st);
+  return 0;
+}
@@ -4,8 +4,17 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 // Buddy allocator
+//
+// Each size k has its own lock, which protects that size's
+// free list and alloc/split bit vectors; no code path holds
+// two of these locks at once. Allocations and frees at
+// different sizes therefore run in parallel, and a split or
+// merge takes each size's lock in turn. The nonempty bit
+// vector records which sizes have free blocks, so bd_malloc()
+// finds the right size with one find-first-set.
 
 static int nsizes;     // the number of entries in bd_sizes array
 
@@ -21,44 +30,124 @@ typedef struct list Bd_list;
 // The allocator has sz_info for each size k. Each sz_info has a free
 // list, an array alloc to keep track which blocks have been
 // allocated, and an split array to to keep track which blocks have
-// been split.  The arrays are of type char (which is 1 byte), but the
-// allocator uses 1 bit per block (thus, one char records the info of
-// 8 blocks).
+// been split.  The arrays are of type uint64, and the allocator uses
+// 1 bit per block (thus, one word records the info of 64 blocks).
 struct sz_info {
+  struct spinlock lock;
   Bd_list free;
-  char *alloc;
-  char *split;
+  int nfree;            // blocks on free
+  uint64 *alloc;
+  uint64 *split;
 };
 typedef struct sz_info Sz_info;
 
 static Sz_info *bd_sizes; 
 static void *bd_base;   // start address of memory managed by the buddy allocator
-static struct spinlock lock;
+
+// bit k is set if bd_sizes[k].free is non-empty. changed
+// with atomic instructions, under bd_sizes[k].lock.
+static uint64 nonempty;
+
+// number of blocks popped off a free list in the middle of
+// a split or merge, which will soon be on another list.
+static int inflight;
+
+// per-CPU counters for memstat(), updated with interrupts off.
+static struct {
+  uint64 alloc[MS_NSIZE];
+  uint64 free[MS_NSIZE];
+  uint64 split;
+  uint64 merge;
+} bdstats[NCPU];
+
+// bytes allocated, and the most ever allocated.
+static uint64 inuse, maxinuse;
+
+#define BPW 64   // bits per bitmap word
 
 // Return 1 if bit at position index in array is set to 1
-int bit_isset(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  return (b & m) == m;
+int bit_isset(uint64 *array, int index) {
+  return (array[index/BPW] >> (index % BPW)) & 1;
 }
 
 // Set bit at position index in array to 1
-void bit_set(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  array[index/8] = (b | m);
+void bit_set(uint64 *array, int index) {
+  array[index/BPW] |= 1L << (index % BPW);
 }
 
 // Clear bit at position index in array
-void bit_clear(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  array[index/8] = (b & ~m);
+void bit_clear(uint64 *array, int index) {
+  array[index/BPW] &= ~(1L << (index % BPW));
+}
+
+// Set bits [from, to) in array, a word at a time where possible.
+void bit_setrange(uint64 *array, int from, int to) {
+  for(; from < to && from % BPW != 0; from++)
+    bit_set(array, from);
+  for(; from + BPW <= to; from += BPW)
+    array[from/BPW] = ~0L;
+  for(; from < to; from++)
+    bit_set(array, from);
+}
+
+// Index of the lowest set bit of x, which must be non-zero.
+// (__builtin_ctzl would need libgcc, which the kernel doesn't link.)
+static int
+ctz64(uint64 x)
+{
+  static const char debruijn[64] = {
+    0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+    62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+    63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+    51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12,
+  };
+  return debruijn[((x & -x) * 0x022fdd63cc95386dL) >> 58];
+}
+
+// Free-list operations at size k, which keep nonempty up to date.
+// Caller must hold bd_sizes[k].lock.
+static void
+bd_push(int k, void *p)
+{
+  if(lst_empty(&bd_sizes[k].free))
+    __sync_fetch_and_or(&nonempty, 1L << k);
+  lst_push(&bd_sizes[k].free, p);
+  bd_sizes[k].nfree++;
+}
+
+static void *
+bd_pop(int k)
+{
+  void *p = lst_pop(&bd_sizes[k].free);
+  bd_sizes[k].nfree--;
+  if(lst_empty(&bd_sizes[k].free))
+    __sync_fetch_and_and(&nonempty, ~(1L << k));
+  return p;
+}
+
+static void
+bd_remove(int k, void *p)
+{
+  lst_remove(p);
+  bd_sizes[k].nfree--;
+  if(lst_empty(&bd_sizes[k].free))
+    __sync_fetch_and_and(&nonempty, ~(1L << k));
+}
+
+// Account for n bytes more (or less) allocated.
+static void
+bd_account(long n)
+{
+  uint64 now = __sync_add_and_fetch(&inuse, n);
+  uint64 max = __atomic_load_n(&maxinuse, __ATOMIC_RELAXED);
+
+  while(now > max && !__sync_bool_compare_and_swap(&maxinuse, max, now))
+    max = __atomic_load_n(&maxinuse, __ATOMIC_RELAXED);
 }
 
 // Print a bit vector as a list of ranges of 1 bits
 void
-bd_print_vector(char *vector, int len) {
+bd_print_vector(uint64 *vector, int len) {
   int last, lb;
   
   last = 1;
@@ -122,34 +211,52 @@ void *addr(int k, int bi) {
 void *
 bd_malloc(uint64 nbytes)
 {
-  int fk, k;
+  int fk, k, splitting;
+  uint64 m;
+  char *p;
 
-  acquire(&lock);
+  fk = firstk(nbytes);
+  if(fk >= nsizes)
+    return 0;
 
   // Find a free block >= nbytes, starting with smallest k possible
-  fk = firstk(nbytes);
-  for (k = fk; k < nsizes; k++) {
+  for(;;){
+    m = __atomic_load_n(&nonempty, __ATOMIC_SEQ_CST) & ~((1L << fk) - 1);
+    if(m == 0){
+      // No free blocks, unless a split or merge is under way.
+      if(__atomic_load_n(&inflight, __ATOMIC_SEQ_CST) == 0)
+        return 0;
+      continue;
+    }
+    k = ctz64(m);
+    acquire(&bd_sizes[k].lock);
     if(!lst_empty(&bd_sizes[k].free))
       break;
-  }
-  if(k >= nsizes) { // No free blocks?
-    release(&lock);
-    return 0;
+    release(&bd_sizes[k].lock);   // lost a race; look again
   }
 
   // Found a block; pop it and potentially split it.
-  char *p = lst_pop(&bd_sizes[k].free);
+  splitting = k > fk;
+  if(splitting)
+    __sync_fetch_and_add(&inflight, 1);
+  bdstats[cpuid()].alloc[fk]++;
+  bdstats[cpuid()].split += k - fk;
+  p = bd_pop(k);
   bit_set(bd_sizes[k].alloc, blk_index(k, p));
   for(; k > fk; k--) {
     // split a block at size k and mark one half allocated at size k-1
     // and put the buddy on the free list at size k-1
     char *q = p + BLK_SIZE(k-1);   // p's buddy
     bit_set(bd_sizes[k].split, blk_index(k, p));
+    release(&bd_sizes[k].lock);
+    acquire(&bd_sizes[k-1].lock);
     bit_set(bd_sizes[k-1].alloc, blk_index(k-1, p));
-    lst_push(&bd_sizes[k-1].free, q);
+    bd_push(k-1, q);
   }
-  release(&lock);
-
+  release(&bd_sizes[k].lock);
+  if(splitting)
+    __sync_fetch_and_sub(&inflight, 1);
+  bd_account(BLK_SIZE(fk));
   return p;
 }
 
@@ -169,10 +276,13 @@ size(char *p) {
 void
 bd_free(void *p) {
   void *q;
-  int k;
+  int k, merging = 0;
 
-  acquire(&lock);
-  for (k = size(p); k < MAXSIZE; k++) {
+  k = size(p);
+  bd_account(-BLK_SIZE(k));
+  acquire(&bd_sizes[k].lock);
+  bdstats[cpuid()].free[k]++;
+  for (; k < MAXSIZE; k++) {
     int bi = blk_index(k, p);
     int buddy = (bi % 2 == 0) ? bi+1 : bi-1;
     bit_clear(bd_sizes[k].alloc, bi);  // free p at size k
@@ -180,17 +290,26 @@ bd_free(void *p) {
       break;   // break out of loop
     }
     // budy is free; merge with buddy
+    if(!merging){
+      merging = 1;
+      __sync_fetch_and_add(&inflight, 1);
+    }
+    bdstats[cpuid()].merge++;
     q = addr(k, buddy);
-    lst_remove(q);    // remove buddy from free list
+    bd_remove(k, q);    // remove buddy from free list
     if(buddy % 2 == 0) {
       p = q;
     }
+    release(&bd_sizes[k].lock);
+    acquire(&bd_sizes[k+1].lock);
     // at size k+1, mark that the merged buddy pair isn't split
     // anymore
     bit_clear(bd_sizes[k+1].split, blk_index(k+1, p));
   }
-  lst_push(&bd_sizes[k].free, p);
-  release(&lock);
+  bd_push(k, p);
+  release(&bd_sizes[k].lock);
+  if(merging)
+    __sync_fetch_and_sub(&inflight, 1);
 }
 
 // Compute the first block at size k that doesn't contain p
@@ -224,13 +343,11 @@ bd_mark(void *start, void *stop)
   for (int k = 0; k < nsizes; k++) {
     bi = blk_index(k, start);
     bj = blk_index_next(k, stop);
-    for(; bi < bj; bi++) {
-      if(k > 0) {
-        // if a block is allocated at size k, mark it as split too.
-        bit_set(bd_sizes[k].split, bi);
-      }
-      bit_set(bd_sizes[k].alloc, bi);
+    if(k > 0) {
+      // if a block is allocated at size k, mark it as split too.
+      bit_setrange(bd_sizes[k].split, bi, bj);
     }
+    bit_setrange(bd_sizes[k].alloc, bi, bj);
   }
 }
 
@@ -244,9 +361,9 @@ bd_initfree_pair(int k, int bi) {
     // one of the pair is free
     free = BLK_SIZE(k);
     if(bit_isset(bd_sizes[k].alloc, bi))
-      lst_push(&bd_sizes[k].free, addr(k, buddy));   // put buddy on free list
+      bd_push(k, addr(k, buddy));   // put buddy on free list
     else
-      lst_push(&bd_sizes[k].free, addr(k, bi));      // put bi on free list
+      bd_push(k, addr(k, bi));      // put bi on free list
   }
   return free;
 }
@@ -297,7 +414,6 @@ bd_init(void *base, void *end) {
   char *p = (char *) ROUNDUP((uint64)base, LEAF_SIZE);
   int sz;
 
-  initlock(&lock, "buddy");
   bd_base = (void *) p;
 
   // compute the number of sizes we need to manage [base, end)
@@ -309,6 +425,10 @@ bd_init(void *base, void *end) {
   printf("bd: memory sz is %d bytes; allocate an size array of length %d\n",
          (char*) end - p, nsizes);
 
+  // nonempty and memstat have room for this many.
+  if(nsizes > MS_NSIZE)
+    panic("bd_init: too many sizes");
+
   // allocate bd_sizes array
   bd_sizes = (Sz_info *) p;
   p += sizeof(Sz_info) * nsizes;
@@ -316,9 +436,10 @@ bd_init(void *base, void *end) {
 
   // initialize free list and allocate the alloc array for each size k
   for (int k = 0; k < nsizes; k++) {
+    initlock(&bd_sizes[k].lock, "buddy");
     lst_init(&bd_sizes[k].free);
-    sz = sizeof(char)* ROUNDUP(NBLK(k), 8)/8;
-    bd_sizes[k].alloc = p;
+    sz = sizeof(uint64) * ROUNDUP(NBLK(k), BPW)/BPW;
+    bd_sizes[k].alloc = (uint64*) p;
     memset(bd_sizes[k].alloc, 0, sz);
     p += sz;
   }
@@ -326,8 +447,8 @@ bd_init(void *base, void *end) {
   // allocate the split array for each size k, except for k = 0, since
   // we will not split blocks of size k = 0, the smallest size.
   for (int k = 1; k < nsizes; k++) {
-    sz = sizeof(char)* (ROUNDUP(NBLK(k), 8))/8;
-    bd_sizes[k].split = p;
+    sz = sizeof(uint64) * ROUNDUP(NBLK(k), BPW)/BPW;
+    bd_sizes[k].split = (uint64*) p;
     memset(bd_sizes[k].split, 0, sz);
     p += sz;
   }
@@ -352,3 +473,27 @@ bd_init(void *base, void *end) {
   }
 }
 
+// Fill in buddy's part of *st.
+void
+bd_stat(struct memstat *st)
+{
+  int k, c;
+
+  st->nsizes = nsizes < MS_NSIZE ? nsizes : MS_NSIZE;
+  st->leafsize = LEAF_SIZE;
+  for(k = 0; k < st->nsizes; k++){
+    st->alloc[k] = st->free[k] = 0;
+    for(c = 0; c < NCPU; c++){
+      st->alloc[k] += bdstats[c].alloc[k];
+      st->free[k] += bdstats[c].free[k];
+    }
+    st->freeblks[k] = bd_sizes[k].nfree;
+    st->bdspin += bd_sizes[k].lock.nspin;
+  }
+  for(c = 0; c < NCPU; c++){
+    st->split += bdstats[c].split;
+    st->merge += bdstats[c].merge;
+  }
+  st->bdinuse = inuse;
+  st->bdmaxinuse = maxinuse;
+}
@@ -5,9 +5,11 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
+  uint lastuse; // when refcnt last dropped to 0, for LRU
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  uchar *udata; // if set, where the disk transfers instead of data
   uchar data[BSIZE];
 };
 
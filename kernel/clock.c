@@ -0,0 +1,283 @@
+//
+// Timer interrupts, the tick count, and timed sleeps.
+//
+// Each CPU programs its own CLINT mtimecmp. A busy CPU asks
+// for an interrupt at the next tick boundary, for preemption,
+// or sooner if a sleeper's deadline comes first; an idle one
+// only for the next deadline (see clockidle()), so that it can
+// stay in wfi. timervec in kernelvec.S disarms the timer and
+// passes each interrupt on to clockintr() here.
+//
+// An idle CPU is also woken by a software interrupt (an IPI),
+// which clockwake() sends when a process is put on a run
+// queue, so that it runs at once rather than at the idle
+// CPU's next timer interrupt. timervec passes those on too.
+//
+// Sleepers wait in a min-heap ordered by deadline, in r_time()
+// units (10 MHz), so a timer interrupt wakes only those whose
+// time has come.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "vdso.h"
+#include "defs.h"
+
+#define IDLETICKS 10  // longest an idle CPU sleeps, if clockwake() misses it
+
+struct {
+  struct spinlock lock;
+  struct proc *heap[NPROC+1];  // heap[1] has the earliest wakeat
+  int n;
+} timers;
+
+struct vdso *vdso;  // the page every process maps at VDSO
+
+// CPUs in clockidle(), a bit each, as their c->idle says.
+static uint64 idlemask;
+
+void
+clockinit(void)
+{
+  initlock(&timers.lock, "timers");
+  if((vdso = (struct vdso*)kalloc_zeroed()) == 0)
+    panic("clockinit");
+}
+
+static void
+hset(int i, struct proc *p)
+{
+  timers.heap[i] = p;
+  p->tslot = i;
+}
+
+static void
+siftup(int i)
+{
+  struct proc *p = timers.heap[i];
+
+  for(; i > 1 && timers.heap[i/2]->wakeat > p->wakeat; i /= 2)
+    hset(i, timers.heap[i/2]);
+  hset(i, p);
+}
+
+static void
+siftdown(int i)
+{
+  struct proc *p = timers.heap[i];
+  int c;
+
+  for(; (c = 2*i) <= timers.n; i = c){
+    if(c < timers.n && timers.heap[c+1]->wakeat < timers.heap[c]->wakeat)
+      c++;
+    if(timers.heap[c]->wakeat >= p->wakeat)
+      break;
+    hset(i, timers.heap[c]);
+  }
+  hset(i, p);
+}
+
+// Take p out of the heap. Caller holds timers.lock.
+static void
+hremove(struct proc *p)
+{
+  int i = p->tslot;
+  struct proc *last = timers.heap[timers.n--];
+
+  p->tslot = 0;
+  if(last == p)
+    return;
+  hset(i, last);
+  siftup(i);
+  siftdown(last->tslot);
+}
+
+// Program this CPU's next timer interrupt. Caller holds
+// timers.lock, so interrupts are off.
+static void
+clockarm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time(), next, t;
+
+  if(c->idle)
+    next = now + IDLETICKS*TICKCYCLES;
+  else
+    next = (now / TICKCYCLES + 1) * TICKCYCLES;
+  if(profiling && !c->idle){
+    // and for the next profiler sample, see profsample().
+    t = c->profnext > now ? c->profnext : now + PROFCYCLES;
+    if(t < next)
+      next = t;
+  }
+  if(timers.n > 0 && timers.heap[1]->wakeat < next)
+    next = timers.heap[1]->wakeat;
+  *(uint64*)CLINT_MTIMECMP(cpuid()) = next;
+}
+
+// Handle a timer interrupt on this CPU: advance ticks, wake
+// the sleepers whose deadlines have passed, and ask for the
+// next interrupt. Returns 1 if this CPU has seen a new tick
+// since its last call, i.e. it's time to preempt.
+int
+clockintr(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  uint t = now / TICKCYCLES;
+  struct proc *p;
+  int tick;
+
+  acquire(&tickslock);
+  if(t > ticks){
+    ticks = t;
+    vdso->ticks = t;
+    wakeup(&ticks);
+  }
+  release(&tickslock);
+  klogkick();
+
+  acquire(&timers.lock);
+  while(timers.n > 0 && (p = timers.heap[1])->wakeat <= now){
+    hremove(p);
+    wakeup(&p->wakeat);
+  }
+  clockarm();
+  release(&timers.lock);
+
+  tick = t != c->lasttick;
+  c->lasttick = t;
+  return tick;
+}
+
+// Put p in the heap. Caller holds timers.lock.
+static void
+hinsert(struct proc *p, uint64 deadline)
+{
+  p->wakeat = deadline;
+  hset(++timers.n, p);
+  siftup(timers.n);
+  if(timers.heap[1] == p)
+    clockarm();  // sooner than this CPU's next interrupt
+}
+
+// Sleep until r_time() reaches deadline.
+// Returns 0, or -1 if killed first.
+int
+clocksleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  hinsert(p, deadline);
+  while(r_time() < deadline && !p->killed)
+    sleep(&p->wakeat, &timers.lock);
+  if(p->tslot)
+    hremove(p);  // killed
+  release(&timers.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Have clockintr() wakeup(&p->wakeat) when r_time() reaches
+// deadline, without sleeping here; for poll(), which waits
+// for that along with other channels. clockclear() cancels.
+void
+clockset(uint64 deadline)
+{
+  acquire(&timers.lock);
+  hinsert(myproc(), deadline);
+  release(&timers.lock);
+}
+
+void
+clockclear(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  if(p->tslot)
+    hremove(p);
+  release(&timers.lock);
+}
+
+// Called by an idle scheduler() with interrupts on: wait for
+// an interrupt without taking ticks meanwhile, unless
+// something shows up on a run queue first. Then resume
+// ticking, in case there's something to run.
+void
+clockidle(void)
+{
+  struct cpu *c;
+  int id, i;
+
+  push_off();
+  id = cpuid();
+  c = mycpu();
+  c->idle = 1;
+  __sync_fetch_and_or(&idlemask, 1L << id);  // a barrier, see clockwake()
+  for(i = 0; i < NCPU; i++){
+    if(runnable(i)){
+      c->idle = 0;
+      __sync_fetch_and_and(&idlemask, ~(1L << id));
+      pop_off();
+      return;
+    }
+  }
+  acquire(&timers.lock);
+  clockarm();
+  release(&timers.lock);
+
+  // with interrupts still off, so that one arriving now
+  // isn't taken before the wfi, which then waits for the
+  // next; wfi returns once one is pending regardless.
+  asm volatile("wfi");
+
+  c->idle = 0;
+  __sync_fetch_and_and(&idlemask, ~(1L << id));
+  acquire(&timers.lock);
+  clockarm();
+  release(&timers.lock);
+  pop_off();
+}
+
+// Send CPU id a software interrupt.
+static void
+clockkick(int id)
+{
+  *(uint32*)CLINT_MSIP(id) = 1;
+}
+
+// Something was just put on CPU id's run queue. If id is
+// idle, interrupt it to run it; if id is busy, interrupt
+// some other idle CPU instead, to steal it. clockidle() sets
+// idlemask before looking at the queues, and the caller
+// queued before this looks at idlemask, so one of them
+// sees the other.
+void
+clockwake(int id)
+{
+  uint64 m;
+  int i;
+
+  __sync_synchronize();
+  m = idlemask;
+  if(m == 0)
+    return;
+  if(m & (1L << id)){
+    clockkick(id);
+    return;
+  }
+  push_off();
+  m &= ~(1L << cpuid());
+  pop_off();
+  for(i = 0; i < NCPU; i++){
+    if(m & (1L << i)){
+      clockkick(i);
+      return;
+    }
+  }
+}
@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -40,9 +41,9 @@ consputc(int c)
 
   if(c == BACKSPACE){
     // if the user typed backspace, overwrite with a space.
-    uartputc('\b'); uartputc(' '); uartputc('\b');
+    uartputc_sync('\b'); uartputc_sync(' '); uartputc_sync('\b');
   } else {
-    uartputc(c);
+    uartputc_sync(c);
   }
 }
 
@@ -59,20 +60,23 @@ struct {
 
 //
 // user write()s to the console go here.
+// copies from the user through buf, since copying may
+// sleep (e.g. to swap a page in), and queues it for the
+// uart's transmit interrupt, sleeping if it's backed up.
 //
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  int i, m;
+  char buf[32];
 
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    consputc(c);
+    if(uartwrite(buf, m) < m)
+      return i > 0 ? i : -1;  // killed
   }
-  release(&cons.lock);
 
   return n;
 }
@@ -114,10 +118,15 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer,
+    // without cons.lock, since copyout() may sleep.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      acquire(&cons.lock);
       break;
+    }
+    acquire(&cons.lock);
 
     dst++;
     --n;
@@ -133,6 +142,21 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+// For poll(): a read won't block once a whole line is in.
+// Writes always go ahead.
+int
+consolepoll(int events, void **chan)
+{
+  int r = POLLOUT;
+
+  *chan = &cons.r;
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -196,4 +220,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -0,0 +1,147 @@
+//
+// Directory-entry name cache.
+//
+// Maps (device, directory inode number, name) to the inode
+// number and offset of the directory entry with that name,
+// or records that there is none (inum 0), so that repeated
+// path lookups don't read the directory. dirlookup() fills it
+// in; dirlink() and unlink() update it, and iput() purges
+// a directory's entries when the directory is freed. All of
+// those hold the directory's inode lock, so the cache always
+// agrees with the directory.
+//
+// When the table is full, a clock hand picks the entry
+// to replace.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+
+#define NDENTRY  512
+#define NDBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;             // directory inum, or 0 if unused
+  uint inum;            // 0: there's no such entry
+  uint off;             // of the entry in the directory
+  char name[DIRSIZ];
+  struct dentry *next;  // hash chain
+  struct dentry **pprev;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+  struct dentry *bucket[NDBUCKET];
+  int hand;
+} dcache;
+
+void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return &dcache.bucket[h % NDBUCKET];
+}
+
+static void
+dunlink(struct dentry *d)
+{
+  if(d->next)
+    d->next->pprev = d->pprev;
+  *d->pprev = d->next;
+  d->dir = 0;
+}
+
+// Return the entry for name in dir, or 0.
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dir, name); d; d = d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Look up name in directory dp, which the caller has locked.
+// Returns 1 and sets *inum and *off if the cache knows;
+// *inum is 0 if dp has no such entry.
+int
+dclookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  uint dev = dp->dev, dir = dp->inum;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp, which the caller has
+// locked, is the entry at off for inode inum, or with inum 0,
+// that there's no such entry.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **k;
+  uint dev = dp->dev, dir = dp->inum;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    d = &dcache.ent[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(d->dir)
+      dunlink(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    k = dhash(dev, dir, name);
+    d->next = *k;
+    if(d->next)
+      d->next->pprev = &d->next;
+    d->pprev = k;
+    *k = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget the entries of directory dir on dev, which is
+// being freed.
+void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDENTRY]; d++)
+    if(d->dir == dir && d->dev == dev)
+      dunlink(d);
+  release(&dcache.lock);
+}
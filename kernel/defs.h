@@ -1,29 +1,71 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
+struct iostat;
+struct iovec;
+struct kmem_cache;
+struct lockclass;
+struct logstat;
+struct memstat;
+struct mm;
 struct pipe;
 struct proc;
+struct rusage;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdso;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breadahead(uint, uint, int);
+void            bread_range(uint, uint, int, struct buf**);
+void            bwrite_range(struct buf**, int);
+int             bcached(uint, uint);
+int             bdirect(uint, uint, int, uchar**, int);
+void            bdone(struct buf*);
+void            bdevrw(uint, struct buf**, int, int);
+int             biostat(uint, struct iostat*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+int             bsetsize(int);
+int             breserve(int);
+
+// clock.c
+void            clockinit(void);
+int             clockintr(void);
+int             clocksleep(uint64);
+void            clockset(uint64);
+void            clockclear(void);
+void            clockidle(void);
+void            clockwake(int);
+extern struct vdso *vdso;
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcinit(void);
+int             dclookup(struct inode*, char*, uint*, uint*);
+void            dcenter(struct inode*, char*, uint, uint);
+void            dcpurge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
+int             loadexec(struct proc*, char*, char**);
+uint64          exectext(struct mm*, uint64);
+int             execfault(struct mm*, uint64, char*);
+void            execput(struct mm*);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,8 +73,12 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filepoll(struct file*, int, void**);
 
 // fs.c
 void            fsinit(int);
@@ -41,40 +87,94 @@ struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
+int             ishrink(int);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+int             ismount(struct inode*);
+int             mount(int, struct inode*);
+void            mountinit(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
+void            statent(struct inode*, uint, struct stat*);
+int             umount(struct inode*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             directi(struct inode*, int, uint64, uint, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskrw(int, struct buf**, int, int);
+void            ramdiskrw_async(int, struct buf**, int, int);
+void            ramdiskstat(struct iostat*);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit();
+void*           kalloc_zeroed(void);
+int             kzeroidle(void);
+void            kaddref(void*);
+int             krefcnt(void*);
+void            kstat(struct memstat*);
+
+// klog.c
+void            kloginit(void);
+int             klogput(char*, int);
+void            klogkick(void);
+void            klogflush(void);
+extern int      klogging;
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(int);
+void            begin_opn(int, int);
+int             log_opmax(int);
 void            end_op(int);
 void            crash_op(int,int);
+int             logstat(int, struct logstat*);
+
+// mmap.c
+uint64          mmap(uint64, int, int, int, struct file*, int);
+int             mmapfault(struct proc*, uint64, int);
+int             munmap(struct proc*, uint64, uint64);
+void            munmapall(struct proc*, int);
+int             mmapdup(struct proc*, struct proc*);
+
+// futex.c
+void            futexinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipepoll(struct pipe*, int, int, void**);
+
+// poll.c
+void            pollinit(void);
+void            pollwakeup(void*);
+extern int      npollent;
+
+// shm.c
+void            shminit(void);
+struct shm*     shmget(int, uint64);
+void            shmput(struct shm*);
+uint64          shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,6 +185,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -98,12 +200,52 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             wait(uint64);
+int             wait(int, uint64);
 void            wakeup(void*);
 void            yield(void);
+void            makerunnable(struct proc*);
+int             runnable(int);
+void            proctick(void);
+int             setpriority(int, int);
+int             getrusage(int, struct rusage*);
+int             fdgrow(struct files*, int);
+struct file*    fdget(int);
+void            fdrelease(void);
+struct inode*   cwdget(void);
+int             filesunshare(struct proc*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(char*, void (*)(uint64), uint64);
+void            mmput(struct proc*);
+void            mmexec(struct proc*, pagetable_t, uint64);
+void            tlbsync(struct proc*, uint64);
+struct mm*      pagetablemm(pagetable_t);
+
+// swap.c
+void            swapinit(void);
+int             swapout(void);
+int             swapin(pte_t*);
+void            swapdup(pte_t);
+void            swapdrop(pte_t);
+void            swapstat(struct memstat*);
+
+// prof.c
+void            profinit(void);
+void            profsample(void);
+extern int      profiling;
+
+// trace.c
+void            traceinit(void);
+void            traceadd(int, int, int, uint64, uint64, uint64, uint64, uint64);
+extern int      tracing;
+
+// text.c
+void            textinit(void);
+uint64          textget(struct inode*, uint);
+void            textput(struct inode*, uint, uint64);
+void            textinval(struct inode*);
+int             textshrink(int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -116,6 +258,8 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 uint64          sys_ntas(void);
+struct lockclass* lockclass(char*, int);
+void            lockheld(struct lockclass*, uint64);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -150,7 +294,8 @@ void            usertrapret(void);
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartputc_sync(int);
+int             uartwrite(char*, int);
 int             uartgetc(void);
 
 // vm.c
@@ -164,9 +309,18 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
+void            uvmtrim(pagetable_t, uint64, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+uint64          uvmpin(pagetable_t, uint64, int);
+uint64          uvmgift(pagetable_t, uint64);
+int             uvmrecv(pagetable_t, uint64, uint64);
+uint64          uvmsatp(struct proc*);
+void            tlbinval(pagetable_t, uint64, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -182,7 +336,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(int);
 void            virtio_disk_rw(int, struct buf *, int);
+void            virtio_disk_rw_async(int, struct buf **, int, int);
+void            virtio_disk_rwv(int, struct buf **, int, int);
 void            virtio_disk_intr(int);
+int             virtio_disk_mode(int, int);
+void            virtio_disk_stat(int, struct iostat*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -194,6 +352,7 @@ void            virtio_disk_intr(int);
 void           bd_init(void*,void*);
 void           bd_free(void*);
 void           *bd_malloc(uint64);
+void           bd_stat(struct memstat*);
 
 struct list {
   struct list *next;
@@ -0,0 +1,4 @@
+// Modes of a virtio disk, for the diskmode() system call.
+
+#define DISK_POLL     0x1  // spin briefly for completions before sleeping
+#define DISK_COALESCE 0x2  // one interrupt per several completions
@@ -6,27 +6,42 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
 
 int
 exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+
+  if(filesunshare(p) < 0)
+    return -1;
+  return loadexec(p, path, argv);
+}
+
+// Replace p's user memory by the program at path, with
+// arguments argv, and set p up to start it. p is the current
+// process, or a new one that spawn() is creating. Returns
+// argc, for a0, or -1.
+int
+loadexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, dev, nseg;
   uint64 argc, sz, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
-
-  begin_op(ROOTDEV);
+  struct seg seg[NSEG];
+  pagetable_t pagetable = 0;
 
-  if((ip = namei(path)) == 0){
-    end_op(ROOTDEV);
+  if((ip = namei(path)) == 0)
     return -1;
-  }
+  dev = ip->dev;
+  begin_op(dev);
   ilock(ip);
 
   // Check ELF header
@@ -38,8 +53,13 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Lay out the program. The first NSEG segments are only
+  // recorded, for their pages to be read in by execfault() on
+  // first touch, and the BSS to be zero-filled the same way;
+  // any further ones are loaded now.
   sz = 0;
+  nseg = 0;
+  memset(seg, 0, sizeof(seg));
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,19 +69,28 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz >= PHYSTOP - KERNBASE)
+      goto bad;  // as growproc() would
+    if(ph.vaddr < sz)
+      goto bad;  // segments must come in address order
+    if(nseg < NSEG){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if((sz = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
-  end_op(ROOTDEV);
-  ip = 0;
-
-  p = myproc();
-  uint64 oldsz = p->sz;
+  // keep ip, without its lock, for execfault().
+  iunlock(ip);
+  end_op(dev);
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -106,24 +135,130 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  mmexec(p, pagetable, sz);
+  p->mm->ip = ip;
+  memmove(p->mm->seg, seg, sizeof(seg));
   p->tf->epc = elf.entry;  // initial program counter = main
   p->tf->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
-  if(ip){
+  if(holdingsleep(&ip->lock)){
     iunlockput(ip);
-    end_op(ROOTDEV);
+    end_op(dev);
+  } else {
+    begin_op(dev);
+    iput(ip);
+    end_op(dev);
   }
   return -1;
 }
 
+// Return the segment whose file contents cover part of the
+// page at va, or 0.
+static struct seg*
+segfind(struct mm *mm, uint64 va)
+{
+  struct seg *s;
+
+  if(mm->ip == 0)
+    return 0;
+  for(s = mm->seg; s < &mm->seg[NSEG]; s++)
+    if(s->filesz && va >= s->va && va < s->va + s->filesz)
+      return s;
+  return 0;
+}
+
+// Start reading the next few pages of s after the one at va,
+// since programs mostly run forward. Caller holds ip->lock.
+static void
+segreadahead(struct inode *ip, struct seg *s, uint64 va)
+{
+  uint64 n;
+
+  if(s->va + s->filesz <= va + PGSIZE)
+    return;
+  n = s->va + s->filesz - (va + PGSIZE);
+  ireadahead(ip, s->off + (va + PGSIZE - s->va), n < 4*PGSIZE ? n : 4*PGSIZE);
+}
+
+// If the page of mm at va is a whole page of a segment's
+// file contents, return it from the executable page cache
+// (text.c), reading it in first if need be, with a reference
+// for uvmfault() to map copy-on-write. Returns 0 if it's not
+// such a page, or there's no memory for it, and -1 if the
+// file can't be read.
+uint64
+exectext(struct mm *mm, uint64 va)
+{
+  struct seg *s;
+  struct inode *ip = mm->ip;
+  uint64 pa;
+  uint off;
+
+  va = PGROUNDDOWN(va);
+  if((s = segfind(mm, va)) == 0 || s->va + s->filesz < va + PGSIZE)
+    return 0;
+  if(!intr_get())
+    return -1;  // holding a spinlock: can't sleep in readi()
+  off = s->off + (va - s->va);
+  ilock(ip);
+  if((pa = textget(ip, off)) == 0 && (pa = (uint64)kalloc()) != 0){
+    if(readi(ip, 0, pa, off, PGSIZE) != PGSIZE){
+      iunlock(ip);
+      kfree((void*)pa);
+      return -1;
+    }
+    textput(ip, off, pa);
+    segreadahead(ip, s, va);
+  }
+  iunlock(ip);
+  return pa;
+}
+
+// Fill mem, the page of mm that holds va, with the part of a
+// segment's file contents it covers, if any, for uvmfault().
+// The rest of the page, as for the BSS or the heap, stays as
+// it is, zero. Returns 0, or -1 if the file can't be read.
+int
+execfault(struct mm *mm, uint64 va, char *mem)
+{
+  struct seg *s;
+  uint64 n;
+  int r;
+
+  va = PGROUNDDOWN(va);
+  if((s = segfind(mm, va)) == 0)
+    return 0;
+  if(!intr_get())
+    return -1;  // holding a spinlock: can't sleep in readi()
+  n = s->va + s->filesz - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  ilock(mm->ip);
+  r = readi(mm->ip, 0, (uint64)mem, s->off + (va - s->va), n);
+  segreadahead(mm->ip, s, va);
+  iunlock(mm->ip);
+  return r == n ? 0 : -1;
+}
+
+// Let go of mm's executable, once its pages are gone.
+void
+execput(struct mm *mm)
+{
+  struct inode *ip = mm->ip;
+
+  if(ip == 0)
+    return;
+  mm->ip = 0;
+  memset(mm->seg, 0, sizeof(mm->seg));
+  begin_op(ip->dev);
+  iput(ip);
+  end_op(ip->dev);
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -137,6 +272,9 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   if((va % PGSIZE) != 0)
     panic("loadseg: va must be page aligned");
 
+  // the whole segment will be read in order.
+  ireadahead(ip, offset, sz);
+
   for(i = 0; i < sz; i += PGSIZE){
     pa = walkaddr(pagetable, va + i);
     if(pa == 0)
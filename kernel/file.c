@@ -12,17 +12,20 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
-struct {
-  struct spinlock lock;
-  struct file file[NFILE];
-} ftable;
+
+// Open files come from a slab cache, so there is no limit on
+// how many but memory. f->ref is changed with atomic
+// instructions, and the last fileclose() frees f.
+struct kmem_cache *filecache;
 
 void
 fileinit(void)
 {
-  initlock(&ftable.lock, "ftable");
+  filecache = kmem_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -31,27 +34,19 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if(__sync_fetch_and_add(&f->ref, 1) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
@@ -60,21 +55,19 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  int n;
 
-  acquire(&ftable.lock);
-  if(f->ref < 1)
-    panic("fileclose");
-  if(--f->ref > 0){
-    release(&ftable.lock);
+  if((n = __sync_sub_and_fetch(&f->ref, 1)) > 0)
     return;
-  }
+  if(n < 0)
+    panic("fileclose");
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
-  release(&ftable.lock);
+  kmem_cache_free(filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_SHM){
+    shmput(ff.shm);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
     begin_op(ff.ip->dev);
     iput(ff.ip);
@@ -101,78 +94,278 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// While reads of an open file are sequential, keep the next
+// rawin blocks after f->off on their way into the buffer
+// cache. The window starts at RAMIN blocks and doubles with
+// each sequential read, up to RAMAX; any seek resets it.
+#define RAMIN 4
+#define RAMAX 64
+
+// A read of f that started at off just ended at f->off.
+// Caller holds f->ip->lock.
+static void
+readahead(struct file *f, uint off)
+{
+  uint bn, from;
+
+  if(off != f->ranext){
+    // not sequential: no readahead until it is again.
+    f->rawin = 0;
+    f->ranext = f->off;
+    return;
+  }
+  f->ranext = f->off;
+  f->rawin = f->rawin == 0 ? RAMIN : (f->rawin < RAMAX ? 2*f->rawin : RAMAX);
+
+  bn = f->off / BSIZE;
+  from = f->rablk > bn ? f->rablk : bn;
+  if(from < bn + f->rawin){
+    ireadahead(f->ip, from * BSIZE, (bn + f->rawin - from) * BSIZE);
+    f->rablk = bn + f->rawin;
+  }
+}
+
+// Should a read or write of n bytes at user address addr and
+// offset off bypass the buffer cache? Only if f is O_DIRECT
+// and it's all whole blocks.
+static int
+direct(struct file *f, uint64 addr, uint64 n, uint off)
+{
+  return f->direct && addr % BSIZE == 0 && n % BSIZE == 0 && off % BSIZE == 0;
+}
+
+// Read from f's inode into user address addr, or write it from
+// there. Caller holds f->ip->lock, and for a write is in a
+// transaction.
+static int
+inodeio(struct file *f, int write, uint64 addr, uint64 n, uint off)
+{
+  if(direct(f, addr, n, off))
+    return directi(f->ip, write, addr, off, n);
+  if(write)
+    return writei(f->ip, 1, addr, off, n);
+  return readi(f->ip, 1, addr, off, n);
+}
+
+// Read from file f into the niov user buffers of iov: at
+// offset off, or if off < 0, at f->off, which advances. All
+// of an inode's buffers are read under one ilock().
+// Returns the number of bytes read, or -1.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
 {
-  int r = 0;
+  int i, r = 0, tot = 0;
+  uint o;
 
   if(f->readable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < niov; i++){
+      if((r = inodeio(f, 0, (uint64)iov[i].base, iov[i].len, o)) < 0)
+        break;
+      tot += r;
+      o += r;
+      if(r < iov[i].len)
+        break;  // end of file
+    }
+    if(off < 0 && tot > 0){
+      f->off = o;
+      if(!f->direct)
+        readahead(f, f->off - tot);
+    }
     iunlock(f->ip);
+  } else if(off >= 0 || f->type == FD_SHM){
+    return -1;  // pipes and devices have no offsets; shm is only mmap()ed
   } else {
-    panic("fileread");
+    for(i = 0; i < niov; i++){
+      if(f->type == FD_PIPE)
+        r = piperead(f->pipe, (uint64)iov[i].base, iov[i].len);
+      else if(f->type == FD_DEVICE)
+        r = devsw[f->major].read(1, (uint64)iov[i].base, iov[i].len);
+      else
+        panic("fileread");
+      if(r < 0)
+        break;
+      tot += r;
+      if(r < iov[i].len)
+        break;  // don't wait for more
+    }
   }
 
-  return r;
+  return r < 0 && tot == 0 ? -1 : tot;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov = { (void*)addr, n };
+
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Write to file f from the niov user buffers of iov: at
+// offset off, or if off < 0, at f->off, which advances.
+// Returns the number of bytes written, or -1.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r = 0, tot = 0;
 
   if(f->writable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+  if(f->type == FD_INODE){
+    // write as many blocks at a time as one log
+    // transaction may hold, including i-node,
+    // indirect block, allocation blocks, and
+    // slop for non-aligned writes; the buffers
+    // are consecutive in the file, so several
+    // may share a transaction and an ilock().
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op(f->ip->dev);
+    uint64 max = (log_opmax(f->ip->dev) - WRITEBLOCKS(0)) * BSIZE;
+    uint64 n1, m, done = 0;  // done: of iov[i]
+    uint o;
+    int j;
+
+    i = 0;
+    while(r >= 0){
+      while(i < niov && iov[i].len == done){
+        i++;
+        done = 0;
+      }
+      if(i == niov)
+        break;
+      // this transaction writes n1 bytes of iov[i...].
+      n1 = 0;
+      for(j = i, m = done; j < niov && n1 < max; j++, m = 0)
+        n1 += iov[j].len - m < max - n1 ? iov[j].len - m : max - n1;
+
+      begin_opn(f->ip->dev, WRITEBLOCKS(n1));
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      o = off < 0 ? f->off : off + tot;
+      while(n1 > 0){
+        m = iov[i].len - done < n1 ? iov[i].len - done : n1;
+        if((r = inodeio(f, 1, (uint64)iov[i].base + done, m, o)) < 0)
+          break;
+        if(r != m)
+          panic("short filewrite");
+        o += m;
+        tot += m;
+        n1 -= m;
+        if((done += m) == iov[i].len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off = o;
       iunlock(f->ip);
       end_op(f->ip->dev);
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    ret = (i == n ? n : -1);
+    return r < 0 ? -1 : tot;
+  } else if(off >= 0 || f->type == FD_SHM){
+    return -1;  // pipes and devices have no offsets; shm is only mmap()ed
   } else {
-    panic("filewrite");
+    for(i = 0; i < niov; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, 1, (uint64)iov[i].base, iov[i].len);
+      else if(f->type == FD_DEVICE)
+        r = devsw[f->major].write(1, (uint64)iov[i].base, iov[i].len);
+      else
+        panic("filewrite");
+      if(r < 0)
+        return -1;
+      tot += r;
+    }
   }
 
-  return ret;
+  return tot;
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  return filewritev(f, &iov, 1, -1);
 }
 
+// Which of events (POLLIN, POLLOUT) a read or write of f
+// wouldn't block for, plus POLLHUP or POLLERR if its other
+// end is closed, for poll(). If f might block, sets *chan to
+// the channel its readers or writers sleep on, which is
+// woken when that changes. Files and most devices never block.
+int
+filepoll(struct file *f, int events, void **chan)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, chan);
+  if(f->type == FD_DEVICE && devsw[f->major].poll)
+    r = devsw[f->major].poll(events, chan);
+  else
+    r = POLLIN | POLLOUT;
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & events;
+}
+
+// Send up to n bytes of file in, starting at offset off, or if
+// off < 0 at in->off, which advances, to pipe or device out.
+// The data goes from the block cache through a kernel page,
+// never through user memory. Stops at the end of the file.
+// Returns the number of bytes sent, or -1.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  char *page;
+  int r, w, tot = 0;
+  uint o;
+
+  if(in->readable == 0 || in->type != FD_INODE || out->writable == 0)
+    return -1;
+  if(out->type != FD_PIPE && out->type != FD_DEVICE)
+    return -1;
+  if((page = kalloc()) == 0)
+    return -1;
+
+  while(tot < n){
+    ilock(in->ip);
+    o = off < 0 ? in->off : off + tot;
+    r = readi(in->ip, 0, (uint64)page, o, n - tot < PGSIZE ? n - tot : PGSIZE);
+    if(r > 0 && off < 0){
+      in->off += r;
+      readahead(in, in->off - r);
+    }
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+
+    // don't hold the inode while the pipe is full.
+    if(out->type == FD_PIPE)
+      w = pipewrite(out->pipe, 0, (uint64)page, r);
+    else
+      w = devsw[out->major].write(0, (uint64)page, r);
+    if(w < 0){
+      r = -1;
+      break;
+    }
+    tot += w;
+    if(w < r)
+      break;
+  }
+
+  kfree(page);
+  return r < 0 && tot == 0 ? -1 : tot;
+}
@@ -1,11 +1,16 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SHM } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe; // FD_PIPE
+  struct shm *shm;   // FD_SHM
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: where a sequential read would start
+  uint rawin;        // FD_INODE: readahead window, in blocks
+  uint rablk;        // FD_INODE: first block not yet read ahead
+  char direct;       // FD_INODE: opened with O_DIRECT
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +23,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next;   // hash bucket list
+  struct inode *prev;
+  struct inode *lnext;  // free list, if unreferenced and on it
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,16 +35,29 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint rbn;           // bmap()'s cached run of contiguous blocks:
+  uint raddr;         // file blocks rbn..rbn+rlen-1 are at
+  uint rlen;          // disk blocks raddr..raddr+rlen-1
+  uint ahint;         // where bmap() allocates the next block
+  int ntext;          // its pages in the executable cache; text.lock protects it
 };
 
+// the most log blocks a writei() of n bytes may write: its
+// data blocks, one more if they're not aligned, the inode,
+// the indirect block, the double-indirect block and two of
+// the indirect blocks below it, and two bitmap blocks.
+#define WRITEBLOCKS(n)  (((n) + BSIZE-1) / BSIZE + 1 + 1 + 1 + 1 + 2 + 2)
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(int, void**);  // or 0 if it never blocks; see filepoll()
 };
 
 extern struct devsw devsw[];
 
 #define DISK 0
 #define CONSOLE 1
+#define TRACE 2
@@ -22,10 +22,13 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+static uint bmap(struct inode*, uint, int);
+static void bsuminit(int);
+// one superblock per disk device; magic is 0 until the device's
+// file system has been started.
+struct superblock sb[NDISK];
 
 // Read the super block.
 static void
@@ -38,13 +41,25 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Start the file system on dev, if there is one: read its
+// super block, recover and start its log. Returns 0, or
+// -1 if dev doesn't hold a file system.
+static int
+fsstart(int dev)
+{
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC)
+    return -1;
+  initlog(dev, &sb[dev]);
+  bsuminit(dev);
+  return 0;
+}
+
 // Init fs
 void
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
+  if(fsstart(dev) < 0)
     panic("invalid file system");
-  initlog(dev, &sb);
 }
 
 // Zero a block.
@@ -60,45 +75,175 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc() keeps a summary of each bitmap block: how many
+// blocks it has free, and a bit below which none are, so that
+// it can skip full bitmap blocks and the full part of the others.
+// An entry only changes while its bitmap block's buffer is
+// locked; others may read it as a hint. balloc() starts looking
+// at a hint from the caller, usually the block after the file's
+// last one, so that files are laid out sequentially.
+
+struct bmapsum {
+  int nfree;   // free blocks, or -1 if not counted yet
+  int first;   // no block below this bit is free
+};
+static struct bmapsum *bsum[NDISK];
+static uint brotor[NDISK];  // after the last block allocated
+
+#define NBMAP(sb) (((sb).size + BPB-1) / BPB)
+
+// Set up dev's bitmap summary, for fsinit().
+static void
+bsuminit(int dev)
+{
+  int k;
+
+  if((bsum[dev] = bd_malloc(NBMAP(sb[dev]) * sizeof(struct bmapsum))) == 0)
+    panic("bsuminit");
+  for(k = 0; k < NBMAP(sb[dev]); k++){
+    bsum[dev][k].nfree = -1;
+    bsum[dev][k].first = 0;
+  }
+}
+
+// Bits of bitmap block k that describe blocks.
+static int
+bmapbits(int dev, int k)
+{
+  return min(BPB, sb[dev].size - k*BPB);
+}
+
+// Return the summary of bitmap block k, which is bp,
+// counting its free blocks if that's not done yet.
+static struct bmapsum*
+bmapsum(int dev, int k, struct buf *bp)
+{
+  struct bmapsum *s = &bsum[dev][k];
+  int bi;
+
+  if(s->nfree < 0){
+    s->nfree = 0;
+    for(bi = bmapbits(dev, k) - 1; bi >= 0; bi--){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        s->nfree++;
+        s->first = bi;
+      }
+    }
+  }
+  return s;
+}
+
+// Return the first clear bit of map in [from, n), or -1.
+static int
+bitfind(uchar *map, int from, int n)
+{
+  int bi;
+
+  for(bi = from; bi < n; bi++){
+    if(bi % 8 == 0){
+      while(bi + 8 <= n && map[bi/8] == 0xff)
+        bi += 8;  // skip full bytes
+      if(bi >= n)
+        break;
+    }
+    if((map[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+  }
+  return -1;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, the first free one at or
+// after block hint if there is any.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint hint)
 {
-  int b, bi, m;
+  int i, k, k0, bi, m;
+  struct bmapsum *s;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  if(hint == 0 || hint >= sb[dev].size)
+    hint = brotor[dev] % sb[dev].size;
+  k0 = hint / BPB;
+  // visit hint's bitmap block from hint up, then the others,
+  // then the rest of hint's.
+  for(i = 0; i <= NBMAP(sb[dev]); i++){
+    k = (k0 + i) % NBMAP(sb[dev]);
+    if(bsum[dev][k].nfree == 0)
+      continue;
+    bp = bread(dev, sb[dev].bmapstart + k);
+    s = bmapsum(dev, k, bp);
+    bi = bitfind(bp->data, i == 0 ? max(hint % BPB, s->first) : s->first, bmapbits(dev, k));
+    if(bi < 0){
+      brelse(bp);
+      continue;
+    }
+    m = 1 << (bi % 8);
+    bp->data[bi/8] |= m;  // Mark block in use.
+    s->nfree--;
+    if(bi == s->first)
+      s->first = bi + 1;
+    log_write(bp);
+    brelse(bp);
+    brotor[dev] = k*BPB + bi + 1;
+    bzero(dev, k*BPB + bi);
+    return k*BPB + bi;
+  }
+  panic("balloc: out of blocks");
+}
+
+// Return the first block at or after hint that starts n free
+// blocks in a row, in hint's bitmap block or a later one;
+// or hint if there's no such run. Allocates nothing.
+static uint
+bfindrun(uint dev, uint hint, int n)
+{
+  int k, bi, end;
+  struct buf *bp;
+  struct bmapsum *s;
+
+  if(hint == 0 || hint >= sb[dev].size)
+    hint = brotor[dev] % sb[dev].size;
+  for(k = hint / BPB; k < NBMAP(sb[dev]); k++){
+    if(bsum[dev][k].nfree >= 0 && bsum[dev][k].nfree < n)
+      continue;
+    bp = bread(dev, sb[dev].bmapstart + k);
+    s = bmapsum(dev, k, bp);
+    bi = k == hint / BPB ? max(hint % BPB, s->first) : s->first;
+    while((bi = bitfind(bp->data, bi, bmapbits(dev, k))) >= 0){
+      for(end = bi + 1; end < bi + n && end < bmapbits(dev, k); end++)
+        if(bp->data[end/8] & (1 << (end % 8)))
+          break;
+      if(end == bi + n){
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        return k*BPB + bi;
       }
+      bi = end;
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return hint;
 }
 
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
+  struct bmapsum *s;
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(dev, BBLOCK(b, sb[dev]));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
+  // count the block's bitmap, if need be, while b's still in use.
+  s = bmapsum(dev, b / BPB, bp);
   bp->data[bi/8] &= ~m;
+  s->nfree++;
+  if(bi < s->first)
+    s->first = bi;
   log_write(bp);
   brelse(bp);
 }
@@ -163,28 +308,81 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cached inodes come from a slab cache, and are hashed into
+// NIBUCKET buckets by (dev, inum). A bucket's spin-lock protects
+// its list, and the ref of each inode on it; one must hold it
+// while using those fields. ip->dev and ip->inum only change
+// while an inode is on no bucket's list.
+//
+// Unreferenced inodes stay cached, on an LRU free list kept
+// under icache.lock. iget() takes a new inode from the slab
+// cache while there are fewer than NINODE, and after that
+// recycles the least recently used unreferenced one. Nothing
+// else is held while acquiring a bucket lock (except mtab.lock,
+// which namex() and umount hold while they find inodes), and
+// icache.lock is acquired last, so there is no deadlock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define NIBUCKET 31
+
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode head;
+};
+
+struct {
+  struct spinlock lock;    // protects the free list and ninode
+  struct kmem_cache *cache;
+  struct ibucket bucket[NIBUCKET];
+  struct inode free;       // free.lnext is least recently used
+  int ninode;              // inodes allocated
 } icache;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &icache.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Put ip at the MRU end of the free list, or take
+// it off. Caller holds icache.lock.
+static void
+ifreepush(struct inode *ip)
+{
+  ip->lnext = &icache.free;
+  ip->lprev = icache.free.lprev;
+  icache.free.lprev->lnext = ip;
+  icache.free.lprev = ip;
+}
+
+static void
+ifreeunlink(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext = ip->lprev = 0;
+}
+
+static void
+inodector(void *o)
+{
+  initsleeplock(&((struct inode*)o)->lock, "inode");
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct ibucket *k;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode), inodector);
+  icache.free.lnext = icache.free.lprev = &icache.free;
+  for(k = icache.bucket; k < icache.bucket+NIBUCKET; k++){
+    initlock(&k->lock, "icache.bucket");
+    k->head.next = k->head.prev = &k->head;
   }
 }
 
@@ -200,8 +398,8 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  for(inum = 1; inum < sb[dev].ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb[dev]));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
@@ -225,7 +423,7 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
@@ -237,40 +435,150 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
-// Find the inode with number inum on device dev
-// and return the in-memory copy. Does not lock
-// the inode and does not read it from disk.
+// Return the cached inode in bucket k, with a new
+// reference, or 0. Caller holds k->lock.
 static struct inode*
-iget(uint dev, uint inum)
+ifind(struct ibucket *k, uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
-  acquire(&icache.lock);
+  for(ip = k->head.next; ip != &k->head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        acquire(&icache.lock);
+        if(ip->lnext)
+          ifreeunlink(ip);
+        release(&icache.lock);
+      }
+      return ip;
+    }
+  }
+  return 0;
+}
 
-  // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+// Take the least recently used free inode off the free
+// list and out of its bucket. Returns 0 if there is none.
+static struct inode*
+ireclaim(void)
+{
+  struct inode *ip;
+  struct ibucket *k;
+
+  for(;;){
+    acquire(&icache.lock);
+    if((ip = icache.free.lnext) == &icache.free){
       release(&icache.lock);
+      return 0;
+    }
+    ifreeunlink(ip);
+    release(&icache.lock);
+
+    if(ip->inum == 0)
+      return ip;  // in no bucket
+    // iget() may have found it since; only take it
+    // if it's still unreferenced.
+    k = ihash(ip->dev, ip->inum);
+    acquire(&k->lock);
+    if(ip->ref == 0){
+      ip->next->prev = ip->prev;
+      ip->prev->next = ip->next;
+      ip->inum = 0;
+      textinval(ip);
+      release(&k->lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    release(&k->lock);
   }
+}
+
+// Return an inode that is in no bucket and on no list:
+// a new one, or the least recently used free one.
+// Returns 0 if every inode is in use.
+static struct inode*
+inew(void)
+{
+  struct inode *ip;
+
+  acquire(&icache.lock);
+  if(icache.ninode < NINODE){
+    icache.ninode++;
+    release(&icache.lock);
+    if((ip = kmem_cache_alloc(icache.cache)) != 0){
+      ip->dev = 0;
+      ip->inum = 0;
+      ip->ref = 0;
+      ip->valid = 0;
+      ip->next = ip->prev = 0;
+      ip->lnext = ip->lprev = 0;
+      ip->ntext = 0;
+      return ip;
+    }
+    acquire(&icache.lock);
+    icache.ninode--;  // no memory; recycle one instead
+  }
+  release(&icache.lock);
+  return ireclaim();
+}
+
+// Find the inode with number inum on device dev
+// and return the in-memory copy. Does not lock
+// the inode and does not read it from disk.
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct ibucket *k = ihash(dev, inum);
+  struct inode *ip, *new;
+
+  // Is the inode already cached?
+  acquire(&k->lock);
+  ip = ifind(k, dev, inum);
+  release(&k->lock);
+  if(ip)
+    return ip;
 
   // Recycle an inode cache entry.
-  if(empty == 0)
+  if((new = inew()) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&icache.lock);
+  acquire(&k->lock);
+  if((ip = ifind(k, dev, inum)) != 0){
+    // someone else cached it meanwhile.
+    release(&k->lock);
+    acquire(&icache.lock);
+    ifreepush(new);
+    release(&icache.lock);
+    return ip;
+  }
+  new->dev = dev;
+  new->inum = inum;
+  new->ref = 1;
+  new->valid = 0;
+  new->next = k->head.next;
+  new->prev = &k->head;
+  k->head.next->prev = new;
+  k->head.next = new;
+  release(&k->lock);
+
+  return new;
+}
 
-  return ip;
+// Free up to n unreferenced inodes, for swapout().
+// Returns the number freed.
+int
+ishrink(int n)
+{
+  struct inode *ip;
+  int freed;
+
+  for(freed = 0; freed < n; freed++){
+    if((ip = ireclaim()) == 0)
+      break;
+    acquire(&icache.lock);
+    icache.ninode--;
+    release(&icache.lock);
+    kmem_cache_free(icache.cache, ip);
+  }
+  return freed;
 }
 
 // Increment reference count for ip.
@@ -278,9 +586,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *k = ihash(ip->dev, ip->inum);
+
+  acquire(&k->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&k->lock);
   return ip;
 }
 
@@ -298,7 +608,7 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
@@ -307,6 +617,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->rlen = 0;
+    ip->ahint = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -328,12 +640,16 @@ iunlock(struct inode *ip)
 // be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
-// All calls to iput() must be inside a transaction in
-// case it has to free the inode.
+// If it has to free the inode and the caller isn't in a
+// transaction on its device, as path lookups aren't, it
+// starts one of its own.
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *k = ihash(ip->dev, ip->inum);
+  int own;
+
+  acquire(&k->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -342,20 +658,31 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    release(&k->lock);
 
+    if((own = myproc()->logres[ip->dev] == 0) != 0)
+      begin_op(ip->dev);
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    if(own)
+      end_op(ip->dev);
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquire(&k->lock);
   }
 
-  ip->ref--;
-  release(&icache.lock);
+  if(--ip->ref == 0){
+    // keep it cached, but let inew() recycle it.
+    acquire(&icache.lock);
+    ifreepush(ip);
+    release(&icache.lock);
+  }
+  release(&k->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -371,40 +698,159 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT
+// after that in the NINDIRECT indirect blocks listed in the
+// double-indirect block ip->addrs[NDIRECT+1].
+//
+// Once bmap() has read an indirect block, it remembers how
+// many of the blocks listed after the one it looked up are
+// contiguous on disk, so that it can map those without
+// reading the indirect block again.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a block for ip, after the one allocated last.
 static uint
-bmap(struct inode *ip, uint bn)
+bmapalloc(struct inode *ip)
+{
+  uint addr = balloc(ip->dev, ip->ahint);
+
+  ip->ahint = addr + 1;
+  return addr;
+}
+
+// Return entry i of indirect block addr, allocating a block
+// for it if there is none and alloc is set. If the entry maps
+// file block fbn, cache the run of contiguous blocks there.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, int alloc, uint fbn)
 {
-  uint addr, *a;
   struct buf *bp;
+  uint *a, j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0 && alloc){
+    a[i] = addr = bmapalloc(ip);
+    log_write(bp);
+  }
+  if(addr && fbn != -1){
+    for(j = i + 1; j < NINDIRECT && a[j] == addr + (j - i); j++)
+      ;
+    ip->rbn = fbn;
+    ip->raddr = addr;
+    ip->rlen = j - i;
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Are ip's contents stored in ip->addrs[]?
+static int
+inlined(struct inode *ip)
+{
+  return ip->type != T_DEVICE && ip->major == IINLINE;
+}
+
+// Move an inline inode's contents out to a data block,
+// before it grows past INLINESIZE.
+static void
+uninline(struct inode *ip)
+{
+  char data[INLINESIZE];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, sizeof(data));
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->major = 0;
+  ip->rlen = 0;
+  if(ip->size > 0){
+    bp = bread(ip->dev, bmap(ip, 0, 1));  // balloc() zeroed it
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  iupdate(ip);
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one if alloc is
+// set, and otherwise returns 0.
+static uint
+bmap(struct inode *ip, uint bn, int alloc)
+{
+  uint addr, fbn = bn;
+
+  if(inlined(ip))
+    panic("bmap: inline");
+  if(bn - ip->rbn < ip->rlen)
+    return ip->raddr + (bn - ip->rbn);
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc)
+      ip->addrs[bn] = addr = bmapalloc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    if((addr = ip->addrs[NDIRECT]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT] = addr = bmapalloc(ip);
     }
-    brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn, alloc, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect
+    // block below it, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      if(!alloc)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr = bmapalloc(ip);
+    }
+    if((addr = bmapind(ip, addr, bn / NINDIRECT, alloc, -1)) == 0)
+      return 0;
+    return bmapind(ip, addr, bn % NINDIRECT, alloc, fbn);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists, or with
+// depth 2, the indirect blocks it lists and theirs.
+static void
+itruncind(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j, k;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  if(depth > 1){
+    // fetch the runs of consecutive indirect blocks
+    // below this one with a request each.
+    for(j = 0; j < NINDIRECT; j = k){
+      for(k = j + 1; k < NINDIRECT && k - j < NRUN && a[j] && a[k] == a[j] + (k - j); k++)
+        ;
+      if(a[j] && k - j > 1)
+        breadahead(dev, a[j], k - j);
+    }
+  }
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      itruncind(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -413,9 +859,16 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  textinval(ip);
+  if(inlined(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->major = 0;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -425,17 +878,16 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    itruncind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    itruncind(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
 
+  ip->rlen = 0;
+  ip->ahint = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -467,8 +919,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(inlined(ip)){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -479,6 +937,38 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return n;
 }
 
+// Start reading the blocks of ip that hold [off, off+n)
+// into the buffer cache, without waiting for them, so that
+// a later readi() finds them there.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, addr, start = 0;
+  int run = 0;
+
+  if(off >= ip->size || inlined(ip))
+    return;
+  if(n > ip->size - off)
+    n = ip->size - off;
+  end = (off + n + BSIZE - 1) / BSIZE;
+  // read each run of consecutive disk blocks at once.
+  for(bn = off / BSIZE; bn < end; bn++){
+    addr = bmap(ip, bn, 0);
+    if(run > 0 && (addr != start + run || run == NRUN)){
+      breadahead(ip->dev, start, run);
+      run = 0;
+    }
+    if(addr == 0)
+      continue;
+    if(run == 0)
+      start = addr;
+    run++;
+  }
+  if(run > 0)
+    breadahead(ip->dev, start, run);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -487,15 +977,36 @@ int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
+  int nnew;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  textinval(ip);
+
+  if(inlined(ip)){
+    if(off + n <= INLINESIZE){
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    uninline(ip);
+  }
+
+  // an append of several blocks: place them together.
+  if(n > 0 && ip->ahint == 0 && off/BSIZE > 0)
+    ip->ahint = bmap(ip, off/BSIZE - 1, 0) + 1;
+  nnew = (off + n + BSIZE-1)/BSIZE - (ip->size + BSIZE-1)/BSIZE;
+  if(nnew > 1)
+    ip->ahint = bfindrun(ip->dev, ip->ahint, nnew);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
@@ -512,6 +1023,80 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return n;
 }
 
+// Read or write n bytes of ip at off from or to user address
+// uva for O_DIRECT, where off, n and uva are multiples of BSIZE.
+// Each run of whole blocks that are consecutive on disk and not
+// in the buffer cache moves between the disk and the (pinned)
+// user pages in one request. Any other block goes through the
+// cache, so that a cached copy, perhaps newer than the disk's
+// and perhaps in the log, stays the one that counts; that
+// includes the zeroed blocks a write allocates. Data written
+// directly doesn't go through the log.
+// Caller must hold ip->lock, which keeps the file's blocks from
+// being read into the cache meanwhile, and for a write must be
+// in a transaction.
+int
+directi(struct inode *ip, int write, uint64 uva, uint off, uint n)
+{
+  pagetable_t pt = myproc()->pagetable;
+  uchar *addrs[NRUN];
+  uint tot, m, addr, start = 0;
+  uint64 pa;
+  int i, run = 0, err = 0;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(write && off + n > MAXFILE*BSIZE)
+    return -1;
+  if(!write && off + n > ip->size)
+    n = ip->size - off;
+  if(inlined(ip))
+    return write ? writei(ip, 1, uva, off, n) : readi(ip, 1, uva, off, n);
+
+  for(tot = 0; tot < n && !err; tot += m, off += m, uva += m){
+    m = min(n - tot, BSIZE);
+    addr = bmap(ip, off/BSIZE, write);
+    if(run > 0 && (addr != start + run || run == NRUN)){
+      err = bdirect(ip->dev, start, run, addrs, write);
+      for(i = 0; i < run; i++)
+        kfree((void*)PGROUNDDOWN((uint64)addrs[i]));
+      run = 0;
+      if(err)
+        break;
+    }
+    if(m == BSIZE && !bcached(ip->dev, addr) &&
+       (pa = uvmpin(pt, uva, !write)) != 0){
+      if(run == 0)
+        start = addr;
+      addrs[run++] = (uchar*)(pa + uva % PGSIZE);
+      continue;
+    }
+
+    bp = bread(ip->dev, addr);
+    if(write)
+      err = either_copyin(bp->data, 1, uva, m);
+    else
+      err = either_copyout(1, uva, bp->data, m);
+    if(write && !err)
+      log_write(bp);
+    brelse(bp);
+  }
+  if(run > 0){
+    err |= bdirect(ip->dev, start, run, addrs, write);
+    for(i = 0; i < run; i++)
+      kfree((void*)PGROUNDDOWN((uint64)addrs[i]));
+  }
+  if(err)
+    return -1;
+
+  if(write && off > ip->size){
+    ip->size = off;
+    iupdate(ip);
+  }
+  return n;
+}
+
 // Directories
 
 int
@@ -520,6 +1105,65 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// Hash of a directory entry name, for indexed directories.
+// mkfs has a copy.
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Return the index of the leaf of dx that holds hash h.
+static int
+dxfind(struct dxent *dx, uint h)
+{
+  int lo = 0, hi = NDXENT, mid;
+
+  // dx[0].hash is 0; find the last entry with hash <= h.
+  while(hi - lo > 1){
+    mid = (lo + hi) / 2;
+    if(dx[mid].blk != 0 && dx[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Look for name in the leaf of indexed directory dp where it
+// belongs. Returns its inum and sets *poff, or returns 0.
+static uint
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint blk, inum = 0;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, 0, 0));
+  blk = ((struct dxent*)bp->data)[dxfind((struct dxent*)bp->data, dirhash(name))].blk;
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, blk, 0));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = blk*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -531,6 +1175,25 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dp->major == DIRINDEXED){
+    if((inum = dxlookup(dp, name, &off)) != 0){
+      if(poff)
+        *poff = off;
+      dcenter(dp, name, inum, off);
+      return iget(dp->dev, inum);
+    }
+    dcenter(dp, name, 0, 0);
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -541,13 +1204,206 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
+// Add block blk to the end of directory dp, zeroed.
+static struct buf*
+dirgrow(struct inode *dp, uint blk)
+{
+  struct buf *bp;
+
+  bp = bread(dp->dev, bmap(dp, blk, 1));  // balloc() zeroed it
+  if(dp->size < (blk+1)*BSIZE){
+    dp->size = (blk+1)*BSIZE;
+    iupdate(dp);
+  }
+  return bp;
+}
+
+// Split leaf i of indexed directory dp, whose index is in ibp
+// and which is full, moving its upper half of hashes to a new
+// leaf. Returns 0, or -1 if the index is full or the leaf's
+// names all hash the same.
+static int
+dxsplit(struct inode *dp, struct buf *ibp, int i)
+{
+  struct dxent *dx = (struct dxent*)ibp->data;
+  struct dirent *de, *nde;
+  struct buf *bp, *nbp;
+  uint h[DPB], t, m, nblk;
+  int j, k, n;
+
+  for(n = 0; n < NDXENT && dx[n].blk; n++)
+    ;
+  if(n == NDXENT)
+    return -1;
+
+  // split at the median hash, or failing that, the next
+  // greater one.
+  bp = bread(dp->dev, bmap(dp, dx[i].blk, 0));
+  de = (struct dirent*)bp->data;
+  for(j = 0; j < DPB; j++){
+    t = dirhash(de[j].name);
+    for(k = j; k > 0 && h[k-1] > t; k--)
+      h[k] = h[k-1];
+    h[k] = t;
+  }
+  for(j = DPB/2; j < DPB && h[j] == h[0]; j++)
+    ;
+  if(j == DPB){
+    brelse(bp);
+    return -1;
+  }
+  m = h[j];
+
+  nblk = dp->size / BSIZE;
+  nbp = dirgrow(dp, nblk);
+  nde = (struct dirent*)nbp->data;
+  for(j = k = 0; j < DPB; j++){
+    if(dirhash(de[j].name) >= m){
+      nde[k++] = de[j];
+      dcenter(dp, de[j].name, de[j].inum, nblk*BSIZE + (k-1)*sizeof(*de));
+      memset(&de[j], 0, sizeof(de[j]));
+    }
+  }
+  log_write(nbp);
+  brelse(nbp);
+  log_write(bp);
+  brelse(bp);
+
+  memmove(&dx[i+2], &dx[i+1], (n - (i+1)) * sizeof(*dx));
+  dx[i+1].hash = m;
+  dx[i+1].blk = nblk;
+  log_write(ibp);
+  return 0;
+}
+
+// Add (name, inum) to indexed directory dp, in the leaf where
+// it belongs. Returns its offset, or -1 if there's no room.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *ibp, *bp;
+  struct dirent *de;
+  uint h = dirhash(name);
+  int i, j, off;
+
+  ibp = bread(dp->dev, bmap(dp, 0, 0));
+  for(;;){
+    i = dxfind((struct dxent*)ibp->data, h);
+    bp = bread(dp->dev, bmap(dp, ((struct dxent*)ibp->data)[i].blk, 0));
+    de = (struct dirent*)bp->data;
+    for(j = 0; j < DPB; j++)
+      if(de[j].inum == 0)
+        break;
+    if(j < DPB)
+      break;
+    brelse(bp);
+    if(dxsplit(dp, ibp, i) < 0){
+      brelse(ibp);
+      return -1;
+    }
+  }
+  strncpy(de[j].name, name, DIRSIZ);
+  de[j].inum = inum;
+  off = ((struct dxent*)ibp->data)[i].blk*BSIZE + j*sizeof(*de);
+  log_write(bp);
+  brelse(bp);
+  brelse(ibp);
+  return off;
+}
+
+// Turn full linear directory dp into an indexed one: sort
+// its entries by hash and spread them over leaves of DXFILL
+// entries, after a new index block 0. Returns 0, or -1 if
+// that's not possible.
+static int
+dxcreate(struct inode *dp)
+{
+  struct dirent *de;
+  struct dxent *dx;
+  struct buf *bp;
+  uint *h, t;
+  int i, j, n, nleaf, leafstart[NDXENT];
+  struct dirent e;
+
+  if((de = kalloc()) == 0)
+    return -1;
+  if((h = kalloc()) == 0){
+    kfree(de);
+    return -1;
+  }
+  n = dp->size / sizeof(*de);
+  if(n > PGSIZE / sizeof(*de))
+    panic("dxcreate");
+  if(readi(dp, 0, (uint64)de, 0, n*sizeof(*de)) != n*sizeof(*de))
+    panic("dxcreate read");
+  for(i = 0; i < n; i++){
+    e = de[i];
+    t = dirhash(e.name);
+    for(j = i; j > 0 && h[j-1] > t; j--){
+      h[j] = h[j-1];
+      de[j] = de[j-1];
+    }
+    h[j] = t;
+    de[j] = e;
+  }
+
+  // cut at multiples of DXFILL, moved on past equal hashes.
+  nleaf = 0;
+  for(i = 0; i < n; ){
+    if(nleaf == NDXENT)
+      goto fail;
+    leafstart[nleaf++] = i;
+    for(j = i + DXFILL; j < n && h[j] == h[j-1]; j++)
+      ;
+    if(j - i > DPB)
+      goto fail;
+    i = j;
+  }
+
+  for(i = 0; i < nleaf; i++){
+    bp = dirgrow(dp, i + 1);
+    memset(bp->data, 0, BSIZE);
+    j = i + 1 < nleaf ? leafstart[i+1] : n;
+    memmove(bp->data, &de[leafstart[i]], (j - leafstart[i]) * sizeof(*de));
+    log_write(bp);
+    brelse(bp);
+  }
+  bp = bread(dp->dev, bmap(dp, 0, 0));
+  memset(bp->data, 0, BSIZE);
+  dx = (struct dxent*)bp->data;
+  for(i = 0; i < nleaf; i++){
+    dx[i].hash = i == 0 ? 0 : h[leafstart[i]];
+    dx[i].blk = i + 1;
+  }
+  log_write(bp);
+  brelse(bp);
+  dp->major = DIRINDEXED;
+  iupdate(dp);
+  // offsets have changed.
+  for(i = 0; i < nleaf; i++){
+    j = i + 1 < nleaf ? leafstart[i+1] : n;
+    for(t = leafstart[i]; t < j; t++)
+      dcenter(dp, de[t].name, de[t].inum, (i+1)*BSIZE + (t-leafstart[i])*sizeof(*de));
+  }
+  kfree(de);
+  kfree(h);
+  return 0;
+
+fail:
+  kfree(de);
+  kfree(h);
+  return -1;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
@@ -562,19 +1418,29 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->major != DIRINDEXED){
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+    // index it when it's full at DIRLINEAR blocks; if that
+    // fails, it stays linear.
+    if(off != DIRLINEAR*BSIZE || dxcreate(dp) < 0){
+      strncpy(de.name, name, DIRSIZ);
+      de.inum = inum;
+      if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink");
+      dcenter(dp, name, inum, off);
+      return 0;
+    }
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
-
+  if((off = dxlink(dp, name, inum)) < 0)
+    return -1;
+  dcenter(dp, name, inum, off);
   return 0;
 }
 
@@ -617,10 +1483,153 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Mounts
+//
+// mtab[dev] records where dev's file system is mounted: the
+// directory it's on and its root, with a reference to each.
+// mtab.lock protects the table for namex(); mtab.serial
+// serializes mount() and umount().
+
+struct {
+  struct spinlock lock;
+  struct sleeplock serial;
+  int n;   // entries in use
+  struct {
+    struct inode *mp;    // mounted on; 0 if the entry is free
+    struct inode *root;
+  } m[NDISK];
+} mtab;
+
+void
+mountinit(void)
+{
+  initlock(&mtab.lock, "mtab");
+  initsleeplock(&mtab.serial, "mount");
+}
+
+// If ip is a mount point, put it and return a reference to
+// the root mounted on it instead; else return ip.
+static struct inode*
+mntroot(struct inode *ip)
+{
+  struct inode *root = 0;
+  int dev;
+
+  if(mtab.n == 0)
+    return ip;
+  acquire(&mtab.lock);
+  for(dev = 0; dev < NDISK; dev++)
+    if(mtab.m[dev].mp == ip)
+      root = idup(mtab.m[dev].root);
+  release(&mtab.lock);
+  if(root == 0)
+    return ip;
+  iput(ip);
+  return root;
+}
+
+// Fill in *st as stat() would for the entry for inode inum
+// in directory dp, crossing a mount point as namex() does.
+// Needn't be in a transaction, like namex().
+void
+statent(struct inode *dp, uint inum, struct stat *st)
+{
+  struct inode *ip;
+
+  ip = mntroot(iget(dp->dev, inum));
+  ilock(ip);
+  stati(ip, st);
+  iunlockput(ip);
+}
+
+// Is ip a mount point?
+int
+ismount(struct inode *ip)
+{
+  int dev, r = 0;
+
+  acquire(&mtab.lock);
+  for(dev = 0; dev < NDISK; dev++)
+    if(mtab.m[dev].mp == ip)
+      r = 1;
+  release(&mtab.lock);
+  return r;
+}
+
+// Mount the file system on disk dev on directory mp, and
+// start it if this is the first time. The table takes over
+// the caller's reference to mp. Returns 0, or -1 if dev or
+// mp is in use already, or dev holds no file system.
+int
+mount(int dev, struct inode *mp)
+{
+  struct inode *root;
+  int r = -1;
+
+  if(dev <= ROOTDEV || dev >= NDISK || mp->inum == ROOTINO)
+    return -1;
+  acquiresleep(&mtab.serial);
+  if(mtab.m[dev].mp == 0 && !ismount(mp) &&
+     (sb[dev].magic == FSMAGIC || fsstart(dev) == 0)){
+    root = iget(dev, ROOTINO);
+    acquire(&mtab.lock);
+    mtab.m[dev].root = root;
+    mtab.m[dev].mp = mp;
+    mtab.n++;
+    release(&mtab.lock);
+    r = 0;
+  }
+  releasesleep(&mtab.serial);
+  return r;
+}
+
+// Unmount the file system whose root is root, to which the
+// caller has a reference. Returns 0, or -1 if root isn't
+// mounted or something else on the file system is in use.
+int
+umount(struct inode *root)
+{
+  struct inode *mp = 0;
+  struct ibucket *k;
+  struct inode *ip;
+  int dev = root->dev, refs = 0;
+
+  if(root->inum != ROOTINO || dev == ROOTDEV)
+    return -1;
+  acquiresleep(&mtab.serial);
+  acquire(&mtab.lock);
+  if(mtab.m[dev].root == root){
+    // the only references allowed are the table's and the
+    // caller's. holding mtab.lock keeps namex() from
+    // coming in meanwhile.
+    for(k = icache.bucket; k < icache.bucket+NIBUCKET; k++){
+      acquire(&k->lock);
+      for(ip = k->head.next; ip != &k->head; ip = ip->next)
+        if(ip->dev == dev)
+          refs += ip->ref;
+      release(&k->lock);
+    }
+    if(refs == 2){
+      mp = mtab.m[dev].mp;
+      mtab.m[dev].mp = mtab.m[dev].root = 0;
+      mtab.n--;
+    }
+  }
+  release(&mtab.lock);
+  releasesleep(&mtab.serial);
+  if(mp == 0)
+    return -1;
+  iput(root);  // the table's references
+  iput(mp);
+  return 0;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
-// Must be called inside a transaction since it calls iput().
+// Crosses mount points, into the root of the file system
+// mounted on a directory; a mounted root's ".." is itself,
+// as on the root device. Needn't be in a transaction.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
@@ -629,7 +1638,7 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(myproc()->cwd);
+    ip = cwdget();
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -647,7 +1656,7 @@ namex(char *path, int nameiparent, char *name)
       return 0;
     }
     iunlockput(ip);
-    ip = next;
+    ip = mntroot(next);
   }
   if(nameiparent){
     iput(ip);
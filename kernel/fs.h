@@ -24,18 +24,26 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// A file or directory has no device number; its major says
+// how its contents are stored instead. With IINLINE they are
+// in addrs[] itself, up to INLINESIZE bytes; a new file or
+// directory starts out that way, and gets blocks once it grows.
+#define IINLINE    2
+#define INLINESIZE ((NDIRECT+2) * sizeof(uint))
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE), or storage
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +66,22 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory that grows past DIRLINEAR blocks gets a hash index:
+// its major is DIRINDEXED, its block 0 is an array of dxents
+// sorted by hash, and each of its other blocks is a leaf of
+// dirents whose names hash into [hash, next dxent's hash).
+// dirhash() in kernel/fs.c and mkfs/mkfs.c computes the hash.
+#define DIRLINEAR  4
+#define DIRINDEXED 1  // a major, like IINLINE
+
+struct dxent {
+  ushort inum;  // always 0, so the index reads as empty dirents
+  ushort pad;
+  uint hash;    // lowest hash in the leaf
+  uint blk;     // the leaf's block in the directory; 0 ends the index
+  uint pad2;
+};
+
+#define NDXENT (BSIZE / sizeof(struct dxent))
+#define DXFILL 48  // dirents per leaf when making an index
+
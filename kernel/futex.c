@@ -0,0 +1,130 @@
+//
+// Futexes: the slow path of user-space locks. An uncontended
+// lock never enters the kernel; a thread that has to wait
+// calls futex(FUTEX_WAIT) on the lock's word, and the thread
+// that releases it calls futex(FUTEX_WAKE) if anyone might
+// be waiting.
+//
+// Waiters are keyed by the physical address of the word, so
+// that threads sharing an mm and processes sharing pages of a
+// shm segment meet at the same key. The page is faulted in
+// for writing and pinned while it's in use, so that neither
+// copy-on-write nor swapout() can move the word away from a
+// key someone waits on.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "futex.h"
+#include "defs.h"
+
+#define NFUTEXQ 64
+
+struct fwait {
+  uint64 pa;             // the word waited on
+  int woken;
+  struct fwait *next;
+};
+
+// the waiters on each hash bucket of words.
+struct futexq {
+  struct spinlock lock;
+  struct fwait *head;
+} futexq[NFUTEXQ];
+
+void
+futexinit(void)
+{
+  struct futexq *q;
+
+  for(q = futexq; q < &futexq[NFUTEXQ]; q++)
+    initlock(&q->lock, "futex");
+}
+
+static struct futexq*
+fhash(uint64 pa)
+{
+  return &futexq[(pa >> 2) % NFUTEXQ];
+}
+
+// Sleep while the word at pa is val.
+// Returns 0 when woken, or -1 if it wasn't val or if killed.
+static int
+futexwait(uint64 pa, int val)
+{
+  struct futexq *q = fhash(pa);
+  struct fwait w, **wp;
+  int r = 0;
+
+  acquire(&q->lock);
+  if(*(volatile int*)pa != val){
+    release(&q->lock);
+    return -1;
+  }
+  w.pa = pa;
+  w.woken = 0;
+  w.next = 0;
+  for(wp = &q->head; *wp; wp = &(*wp)->next)
+    ;
+  *wp = &w;  // at the end, so that waiters wake in order
+  while(!w.woken && !myproc()->killed)
+    sleep(&w, &q->lock);
+  if(!w.woken){
+    for(wp = &q->head; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+    r = -1;
+  }
+  release(&q->lock);
+  return r;
+}
+
+// Wake up to n waiters on pa, oldest first.
+// Returns how many.
+static int
+futexwake(uint64 pa, int n)
+{
+  struct futexq *q = fhash(pa);
+  struct fwait *w, **wp;
+  int woken = 0;
+
+  acquire(&q->lock);
+  for(wp = &q->head; *wp && woken < n; ){
+    w = *wp;
+    if(w->pa != pa){
+      wp = &w->next;
+      continue;
+    }
+    *wp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&q->lock);
+  return woken;
+}
+
+uint64
+sys_futex(void)
+{
+  struct proc *p = myproc();
+  uint64 addr, pa;
+  int op, val, r;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if(addr % sizeof(int) || (op != FUTEX_WAIT && op != FUTEX_WAKE))
+    return -1;
+  if((pa = uvmpin(p->pagetable, addr, 1)) == 0)
+    return -1;
+  if(op == FUTEX_WAIT)
+    r = futexwait(pa + addr % PGSIZE, val);
+  else
+    r = futexwake(pa + addr % PGSIZE, val);
+  kfree((void*)pa);
+  return r;
+}
@@ -0,0 +1,4 @@
+// futex(addr, op, val) operations, for user-space locks
+// built on an int in memory that threads or processes share.
+#define FUTEX_WAIT 0   // sleep, if *addr still == val
+#define FUTEX_WAKE 1   // wake up to val sleepers on addr
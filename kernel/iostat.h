@@ -0,0 +1,20 @@
+// I/O statistics for one block device, returned by the iostat()
+// system call. A histogram's entry k counts the events with a
+// value in [2^(k-1), 2^k), entry 0 those of 0, and the last
+// entry all those beyond.
+
+#define NIOHIST 20
+
+struct iostat {
+  uint64 hits;     // buffer cache lookups that found the block
+  uint64 misses;   // and that didn't
+  uint64 nread;    // disk requests that read
+  uint64 nwrite;   // and that wrote
+  uint64 rbytes;   // bytes read from the disk
+  uint64 wbytes;   // bytes written
+  uint64 rlat[NIOHIST];  // reads by latency in microseconds
+  uint64 wlat[NIOHIST];  // writes by latency in microseconds
+  uint64 depthsum; // requests queued or in flight, summed over
+  uint64 nsample;  // this many submissions
+  uint64 maxdepth; // and the most there were
+};
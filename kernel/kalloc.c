@@ -1,6 +1,25 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// All of physical memory is owned by the buddy allocator
+// (buddy.c). In front of it, each CPU keeps a small cache
+// of free pages, so the common kalloc()/kfree() path only
+// takes that CPU's own lock, which is almost never contended.
+// A CPU refills its cache from buddy in batches when it runs
+// dry, and gives a batch back when the cache overflows. If
+// buddy itself is out of memory, kalloc() steals a page from
+// another CPU's cache.
+//
+// Each page also has a reference count, so that copy-on-write
+// fork can share a page between page tables. kalloc() sets it
+// to one, kaddref() adds a reference, and kfree() only frees
+// the page when the last reference goes away.
+//
+// Each CPU also keeps a pool of already-zeroed pages for
+// kalloc_zeroed(). The scheduler refills it with kzeroidle()
+// when the CPU has nothing else to run, so page-table and
+// user-memory allocations rarely have to zero a page inline.
 
 #include "types.h"
 #include "param.h"
@@ -8,16 +27,126 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
+
+#define KBATCH  16          // pages moved between a CPU cache and buddy at once
+#define KCACHE  (2*KBATCH)  // most pages a CPU cache holds
+#define KZERO   32          // zeroed pages each CPU tries to keep
+#define KZBATCH 4           // pages zeroed per idle scheduler pass
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
+
+struct run {
+  struct run *next;
+};
+
+// per-CPU cache of free pages.
+// kmem[i].lock is taken by CPU i on every kalloc/kfree,
+// and by other CPUs only when they steal.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  struct run *zeroed;   // pool for kalloc_zeroed()
+  int nzeroed;
+  // counters for memstat(), only changed by
+  // their own CPU, with interrupts off.
+  uint64 nalloc;
+  uint64 nfreed;
+  uint64 nzerohit;
+  uint64 nsteal;
+} kmem[NCPU];
+
+// reference count of each physical page, indexed by PA2REF().
+// updated with atomic instructions, without a lock.
+static int refs[(PHYSTOP-KERNBASE)/PGSIZE];
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void
 kinit()
 {
   char *p = (char *) PGROUNDUP((uint64) end);
+
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
   bd_init(p, (void*)PHYSTOP);
 }
 
+// Move up to KBATCH pages from buddy into CPU id's cache.
+// Caller must hold kmem[id].lock.
+static void
+krefill(int id)
+{
+  struct run *r;
+
+  for(int i = 0; i < KBATCH; i++){
+    if((r = bd_malloc(PGSIZE)) == 0)
+      break;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = r;
+    kmem[id].nfree++;
+  }
+}
+
+// Give the KBATCH least recently freed pages in CPU id's
+// cache back to buddy. Caller must hold kmem[id].lock.
+static void
+kdrain(int id)
+{
+  struct run *r, *next;
+  int keep = kmem[id].nfree - KBATCH;
+
+  if(keep <= 0)
+    return;
+  // the list is LIFO, so the tail holds the coldest pages.
+  r = kmem[id].freelist;
+  for(int i = 1; i < keep; i++)
+    r = r->next;
+  next = r->next;
+  r->next = 0;
+  kmem[id].nfree = keep;
+  for(r = next; r; r = next){
+    next = r->next;
+    bd_free(r);
+  }
+}
+
+// Take one page from some other CPU's cache, or
+// failing that from any CPU's zeroed pool.
+// Called with no kmem lock held.
+static struct run*
+ksteal(int id)
+{
+  struct run *r;
+
+  for(int i = 0; i < NCPU; i++){
+    if(i == id)
+      continue;
+    acquire(&kmem[i].lock);
+    r = kmem[i].freelist;
+    if(r){
+      kmem[i].freelist = r->next;
+      kmem[i].nfree--;
+    }
+    release(&kmem[i].lock);
+    if(r)
+      return r;
+  }
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    r = kmem[i].zeroed;
+    if(r){
+      kmem[i].zeroed = r->next;
+      kmem[i].nzeroed--;
+    }
+    release(&kmem[i].lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -25,7 +154,30 @@ kinit()
 void
 kfree(void *pa)
 {
-  bd_free(pa);
+  struct run *r;
+  int id, n;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree");
+
+  n = __sync_sub_and_fetch(&refs[PA2REF(pa)], 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
+  r = (struct run*)pa;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  if(++kmem[id].nfree > KCACHE)
+    kdrain(id);
+  release(&kmem[id].lock);
+  kmem[id].nfreed++;
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -34,5 +186,130 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  return bd_malloc(PGSIZE);
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  if(kmem[id].freelist == 0)
+    krefill(id);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+  if(r == 0 && (r = ksteal(id)) != 0)
+    kmem[id].nsteal++;
+  if(r)
+    kmem[id].nalloc++;
+  pop_off();
+
+  if(r)
+    refs[PA2REF(r)] = 1;
+  return (void*)r;
+}
+
+// Allocate one zeroed page, from this CPU's pool
+// if it has one. Returns 0 if out of memory.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = kmem[id].zeroed;
+  if(r){
+    kmem[id].zeroed = r->next;
+    kmem[id].nzeroed--;
+    kmem[id].nalloc++;
+    kmem[id].nzerohit++;
+  }
+  release(&kmem[id].lock);
+  pop_off();
+
+  if(r){
+    r->next = 0;   // the only non-zero word
+    refs[PA2REF(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero up to KZBATCH pages into this CPU's pool.
+// Called by the scheduler when it has nothing to run,
+// with interrupts on. Returns how many pages it zeroed,
+// 0 when the pool is full (or memory is short).
+int
+kzeroidle(void)
+{
+  struct run *r;
+  int id, n;
+
+  push_off();
+  id = cpuid();   // the scheduler never moves between CPUs
+  pop_off();
+
+  for(n = 0; n < KZBATCH && kmem[id].nzeroed < KZERO; n++){
+    // only use free pages; never steal for the pool.
+    acquire(&kmem[id].lock);
+    if(kmem[id].freelist == 0)
+      krefill(id);
+    r = kmem[id].freelist;
+    if(r){
+      kmem[id].freelist = r->next;
+      kmem[id].nfree--;
+    }
+    release(&kmem[id].lock);
+    if(r == 0)
+      break;
+
+    memset(r, 0, PGSIZE);
+
+    acquire(&kmem[id].lock);
+    r->next = kmem[id].zeroed;
+    kmem[id].zeroed = r;
+    kmem[id].nzeroed++;
+    release(&kmem[id].lock);
+  }
+  return n;
+}
+
+// Add a reference to an allocated page, which
+// the next kfree() of it will then only drop.
+void
+kaddref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kaddref");
+  if(__sync_fetch_and_add(&refs[PA2REF(pa)], 1) < 1)
+    panic("kaddref: free page");
+}
+
+// Return the number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&refs[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Fill in kalloc's part of *st.
+void
+kstat(struct memstat *st)
+{
+  for(int i = 0; i < NCPU; i++){
+    st->kalloc += kmem[i].nalloc;
+    st->kfree += kmem[i].nfreed;
+    st->kzeroed += kmem[i].nzerohit;
+    st->ksteal += kmem[i].nsteal;
+    st->kspin += kmem[i].lock.nspin;
+    st->kcached += kmem[i].nfree;
+    st->kpooled += kmem[i].nzeroed;
+  }
 }
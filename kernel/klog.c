@@ -0,0 +1,217 @@
+//
+// The kernel log. printf() formats into lines of at most
+// KLOGLINE bytes and appends them to the current CPU's ring,
+// without locks: only that CPU adds to its ring, with
+// interrupts off, and only klogd takes from it. klogd, a
+// kernel thread, writes them to the console in the order
+// they were printed, and keeps the last KLOGHIST bytes for
+// dmesg(). A full ring drops new lines, and counts them.
+//
+// printf() can't always wakeup() klogd, since its caller may
+// hold a p->lock; then the next timer interrupt does (see
+// klogkick()). Until klogd starts, and once the kernel has
+// panicked, printf() writes straight to the console.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NKLOG 64        // lines per CPU
+#define KLOGHIST 8192   // bytes dmesg() can see
+
+struct klogline {
+  uint64 seq;           // order among all CPUs' lines
+  int len;
+  char text[KLOGLINE];
+};
+
+struct klogring {
+  struct klogline line[NKLOG];
+  uint head, tail;      // line[tail..head), mod NKLOG, unwritten
+  uint ndrop;
+};
+
+struct {
+  struct spinlock lock;   // for klogd's sleep and wakeup
+  struct sleeplock hlock; // protects hist and hend
+  struct klogring ring[NCPU];
+  uint64 seq;
+  int kick;               // wakeup() klogd at the next tick
+  char hist[KLOGHIST];
+  uint64 hend;            // bytes ever added to hist
+} klog;
+
+int klogging;  // klogd is running; printf() may use klogput()
+
+// Append a line in the current CPU's ring.
+// Returns 0, or -1 if the ring is full.
+int
+klogput(char *s, int n)
+{
+  struct klogring *r;
+  struct klogline *l;
+  int ok = 0, wake;
+
+  push_off();
+  r = &klog.ring[cpuid()];
+  if(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < NKLOG){
+    l = &r->line[r->head % NKLOG];
+    l->seq = __atomic_fetch_add(&klog.seq, 1, __ATOMIC_RELAXED);
+    l->len = n;
+    memmove(l->text, s, n);
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  } else {
+    r->ndrop++;
+    ok = -1;
+  }
+  wake = mycpu()->noff == 1;  // no spinlocks besides ours
+  pop_off();
+
+  if(wake){
+    acquire(&klog.lock);
+    release(&klog.lock);
+    wakeup(&klog);
+  } else {
+    klog.kick = 1;
+  }
+  return ok;
+}
+
+// Called by clockintr(), which holds no locks: wake klogd
+// for lines that printf() couldn't.
+void
+klogkick(void)
+{
+  if(!klog.kick)
+    return;
+  klog.kick = 0;
+  acquire(&klog.lock);
+  release(&klog.lock);
+  wakeup(&klog);
+}
+
+// The ring with the oldest unwritten line, or 0 if none.
+static struct klogring*
+oldest(void)
+{
+  struct klogring *r, *best = 0;
+
+  for(r = klog.ring; r < &klog.ring[NCPU]; r++){
+    if(r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+      continue;
+    if(best == 0 || r->line[r->tail % NKLOG].seq < best->line[best->tail % NKLOG].seq)
+      best = r;
+  }
+  return best;
+}
+
+// Take the oldest line into l. Returns 0 if there's none.
+static int
+klogget(struct klogline *l)
+{
+  struct klogring *r;
+
+  if((r = oldest()) == 0)
+    return 0;
+  *l = r->line[r->tail % NKLOG];
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static void
+histadd(char *s, int n)
+{
+  int i;
+
+  acquiresleep(&klog.hlock);
+  for(i = 0; i < n; i++)
+    klog.hist[klog.hend++ % KLOGHIST] = s[i];
+  releasesleep(&klog.hlock);
+}
+
+static void
+klogd(uint64 arg)
+{
+  struct klogline l;
+  struct klogring *r;
+  uint ndrop = 0;
+  char *s;
+
+  for(;;){
+    acquire(&klog.lock);
+    while(oldest() == 0)
+      sleep(&klog, &klog.lock);
+    release(&klog.lock);
+
+    while(klogget(&l)){
+      histadd(l.text, l.len);
+      uartwrite(l.text, l.len);
+    }
+    for(r = klog.ring; r < &klog.ring[NCPU]; r++)
+      ndrop += __atomic_exchange_n(&r->ndrop, 0, __ATOMIC_RELAXED);
+    if(ndrop > 0){
+      s = "\n(kernel log lines lost)\n";
+      histadd(s, strlen(s));
+      uartwrite(s, strlen(s));
+      ndrop = 0;
+    }
+  }
+}
+
+void
+kloginit(void)
+{
+  initlock(&klog.lock, "klog");
+  initsleeplock(&klog.hlock, "kloghist");
+  kthread("klogd", klogd, 0);
+  klogging = 1;
+}
+
+// For panic(): write out what klogd hasn't yet, directly.
+void
+klogflush(void)
+{
+  struct klogline l;
+  int i;
+
+  klogging = 0;
+  while(klogget(&l))
+    for(i = 0; i < l.len; i++)
+      consputc(l.text[i]);
+}
+
+// dmesg(buf, n): copy the last n bytes or fewer of the
+// kernel log to buf. Returns how many.
+uint64
+sys_dmesg(void)
+{
+  uint64 addr, start;
+  int n, m, c;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  acquiresleep(&klog.hlock);
+  if(n > klog.hend)
+    n = klog.hend;
+  if(n > KLOGHIST)
+    n = KLOGHIST;
+  start = klog.hend - n;
+  for(m = 0; m < n; m += c){
+    // up to the end of hist, then from its beginning.
+    c = KLOGHIST - (start + m) % KLOGHIST;
+    if(c > n - m)
+      c = n - m;
+    if(copyout(myproc()->pagetable, addr + m, &klog.hist[(start + m) % KLOGHIST], c) < 0){
+      releasesleep(&klog.hlock);
+      return -1;
+    }
+  }
+  releasesleep(&klog.hlock);
+  return n;
+}
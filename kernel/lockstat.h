@@ -0,0 +1,16 @@
+// Lock statistics, returned by the lockstat() system call:
+// one entry per lock name (spin and sleep locks separately),
+// summed over all the locks initialized with that name.
+// Times are in r_time() cycles (10 MHz in qemu).
+
+#define NLOCKSTAT 64   // lock names that can be tracked
+
+struct lockstat {
+  char name[16];
+  int sleep;         // sleeplocks (1) or spinlocks (0)?
+  int nlocks;        // locks initialized with this name
+  uint64 nacquire;   // acquisitions
+  uint64 ncontend;   // acquisitions that found it held
+  uint64 wait;       // total time spent waiting in those
+  uint64 maxhold;    // longest time any was held
+};
@@ -3,9 +3,11 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -16,10 +18,14 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves log space for the
+// most blocks the call may write: MAXOPBLOCKS, or with
+// begin_opn(), a number of the caller's choosing. Usually
+// it just adds to the reservations of in-progress FS system
+// calls and returns. But if the log is close to running out,
+// it sleeps until the last outstanding end_op() commits.
+//
+// mkfs sizes the log; it may be up to LOGSIZE blocks.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -29,6 +35,24 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The log is double-buffered in memory. When the last
+// outstanding operation ends, end_op() copies the transaction's
+// blocks into log[dev].copy and hands it to the device's logger
+// thread as the committing transaction, log[dev].clh. New
+// operations may begin as soon as the copy is taken, and build
+// up the next transaction while the logger writes the copy to
+// the log, writes the header (the commit point), and then
+// installs the blocks at their home locations. The committed
+// blocks stay pinned in the buffer cache until then.
+// The on-disk log holds one transaction at a time, so if a
+// commit is still in progress when an operation ends, the
+// next transaction keeps growing, and the logger commits it
+// once it's done: small transactions get merged into one
+// header write.
+//
+// The end_op() that took the copy waits until the header is
+// on disk; other end_op()s return at once, as before.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +66,21 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they have reserved
+  int committing;  // copying lh to clh, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the transaction being built
+  struct logheader clh;  // committing; on disk until installed
+  struct buf *copy;      // clh's blocks, for the disk
+  uint nstart;           // transactions handed to the logger
+  uint ndone;            // of those, committed on disk
+  uint tstart;           // ticks when clh was handed over
+  struct logstat st;
 };
 struct log log[NDISK];
 
 static void recover_from_log(int);
-static void commit(int);
+static void logger(uint64);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -57,27 +88,44 @@ initlog(int dev, struct superblock *sb)
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
+  // the header takes one block.
+  if (sb->nlog-1 > LOGSIZE || sb->nlog-1 < 2*MAXOPBLOCKS)
+    panic("initlog: bad log size");
+
   initlock(&log[dev].lock, "log");
   log[dev].start = sb->logstart;
   log[dev].size = sb->nlog;
   log[dev].dev = dev;
+  if((log[dev].copy = bd_malloc((sb->nlog-1)*sizeof(struct buf))) == 0)
+    panic("initlog: copy");
+  memset(log[dev].copy, 0, (sb->nlog-1)*sizeof(struct buf));
+  for(int i = 0; i < sb->nlog-1; i++)
+    log[dev].copy[i].dev = dev;
+  // lh's and clh's blocks are pinned in the cache.
+  if(breserve(2*(sb->nlog-1)) < 0)
+    panic("initlog: breserve");
   recover_from_log(dev);
+  kthread("logger", logger, dev);
 }
 
-// Copy committed blocks from log to their home location
+// Copy the blocks of committed transaction lh from the log
+// to their home locations, for recovery.
 static void
-install_trans(int dev)
+install_trans(int dev, struct logheader *lh)
 {
-  int tail;
+  struct buf *lbufs[NRUN];
+  int tail, i, n;
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *lbuf = bread(dev, log[dev].start+tail+1); // read log block
-    struct buf *dbuf = bread(dev, log[dev].lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < lh->n; tail += n) {
+    n = lh->n - tail < NRUN ? lh->n - tail : NRUN;
+    bread_range(dev, log[dev].start+tail+1, n, lbufs); // read log blocks
+    for (i = 0; i < n; i++) {
+      struct buf *dbuf = bread(dev, lh->block[tail+i]); // read dst
+      memmove(dbuf->data, lbufs[i]->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbufs[i]);
+      brelse(dbuf);
+    }
   }
 }
 
@@ -95,18 +143,18 @@ read_head(int dev)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write in-memory log header lh to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(int dev)
+write_head(int dev, struct logheader *lh)
 {
   struct buf *buf = bread(dev, log[dev].start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log[dev].lh.n;
-  for (i = 0; i < log[dev].lh.n; i++) {
-    hb->block[i] = log[dev].lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -116,94 +164,250 @@ static void
 recover_from_log(int dev)
 {
   read_head(dev);
-  install_trans(dev); // if committed, copy from log to disk
+  install_trans(dev, &log[dev].lh); // if committed, copy from log to disk
   log[dev].lh.n = 0;
-  write_head(dev); // clear the log
+  write_head(dev, &log[dev].lh); // clear the log
 }
 
-// called at the start of each FS system call.
+// Copy lh's blocks from the cache to log[dev].copy.
+static void
+copy_trans(int dev)
+{
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log[dev].lh.n; i++) {
+    b = bread(dev, log[dev].lh.block[i]);
+    memmove(log[dev].copy[i].data, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Make lh the committing transaction: copy its blocks from
+// the cache, where they stay pinned until they're installed.
+// Called with log[dev].committing set, so no operation is
+// running, and with clh empty. Returns clh's number.
+static uint
+snapshot(int dev)
+{
+  struct log *l = &log[dev];
+  uint n;
+
+  copy_trans(dev);
+  acquire(&l->lock);
+  l->clh = l->lh;
+  l->lh.n = 0;
+  l->committing = 0;
+  l->tstart = ticks;
+  n = ++l->nstart;
+  wakeup(&log);  // begin_op() may be waiting
+  wakeup(&l->clh);  // for the logger
+  release(&l->lock);
+  return n;
+}
+
+#define NBATCH 8  // disk requests write_copies() queues at once
+
+// Write copy[0..n-1] to disk, each at its blockno: a request
+// per run of up to NRUN consecutive blocks, NBATCH requests
+// handed to the disk at a time.
+static void
+write_copies(int dev, int n)
+{
+  struct buf *c = log[dev].copy;
+  struct buf *runs[NBATCH];
+  int tail, m, nrun = 0;
+
+  for (tail = 0; tail < n; tail += m) {
+    for (m = 1; tail+m < n && m < NRUN; m++) {
+      if (c[tail+m].blockno != c[tail].blockno + m)
+        break;
+      c[tail+m-1].qnext = &c[tail+m];
+    }
+    c[tail+m-1].qnext = 0;
+    runs[nrun++] = &c[tail];
+    if (nrun == NBATCH || tail+m == n) {
+      bdevrw(dev, runs, nrun, 1);
+      nrun = 0;
+    }
+  }
+}
+
+// Write clh's blocks, from the copy, to the log.
+static void
+write_log(int dev)
+{
+  int tail;
+
+  for (tail = 0; tail < log[dev].clh.n; tail++)
+    log[dev].copy[tail].blockno = log[dev].start+tail+1;
+  write_copies(dev, log[dev].clh.n);  // write the log
+}
+
+// Write clh's blocks, from the copy, to their home locations,
+// and unpin their cached buffers.
+static void
+install_copy(int dev)
+{
+  struct logheader *clh = &log[dev].clh;
+  struct buf *b;
+  int tail;
+
+  for (tail = 0; tail < clh->n; tail++)
+    log[dev].copy[tail].blockno = clh->block[tail];
+  write_copies(dev, clh->n);  // write dst to disk
+  for (tail = 0; tail < clh->n; tail++) {
+    b = bread(dev, clh->block[tail]);  // cached; pinned
+    bunpin(b);
+    brelse(b);
+  }
+}
+
+// Commit and install each transaction handed over by
+// snapshot(), then erase it from the log. Runs as a
+// kernel thread, one per device.
+static void
+logger(uint64 dev)
+{
+  struct log *l = &log[dev];
+  struct logheader empty;
+  int k;
+
+  empty.n = 0;
+  acquire(&l->lock);
+  for(;;){
+    while(l->clh.n == 0)
+      sleep(&l->clh, &l->lock);
+    release(&l->lock);
+
+    write_log(dev);          // Write the copied blocks to the log
+    write_head(dev, &l->clh);  // Write header to disk -- the real commit
+
+    acquire(&l->lock);
+    l->ndone = l->nstart;
+    l->st.ncommit++;
+    l->st.nblocks += l->clh.n;
+    for(k = 0; k < NCOMMITHIST-1 && l->clh.n >= (1 << k); k++)
+      ;
+    l->st.sizes[k]++;
+    l->st.ticks += ticks - l->tstart;
+    wakeup(&l->ndone);  // end_op() may be waiting
+    release(&l->lock);
+
+    install_copy(dev);       // Now install writes to home locations
+    write_head(dev, &empty);  // Erase the transaction from the log
+
+    acquire(&l->lock);
+    l->clh.n = 0;
+    wakeup(&l->clh);  // crash_op() may be waiting
+    if(l->outstanding == 0 && l->lh.n > 0 && !l->committing){
+      // operations ended during the commit; take the
+      // next transaction from here.
+      l->committing = 1;
+      release(&l->lock);
+      snapshot(dev);
+      acquire(&l->lock);
+    }
+  }
+}
+
+// The most blocks one operation on dev may reserve: half
+// the log, so that two big ones can run at once.
+int
+log_opmax(int dev)
+{
+  return (log[dev].size - 1) / 2;
+}
+
+// called at the start of each FS system call that
+// writes at most n blocks.
 void
-begin_op(int dev)
+begin_opn(int dev, int n)
 {
+  struct proc *p = myproc();
+
+  if(n > log_opmax(dev))
+    panic("begin_op: too many blocks");
+  if(p->logres[dev])
+    panic("begin_op: nested");
   acquire(&log[dev].lock);
   while(1){
     if(log[dev].committing){
       sleep(&log, &log[dev].lock);
-    } else if(log[dev].lh.n + (log[dev].outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log[dev].lh.n + log[dev].reserved + n > log[dev].size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log[dev].lock);
     } else {
       log[dev].outstanding += 1;
+      log[dev].reserved += n;
+      p->logres[dev] = n;
       release(&log[dev].lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(int dev)
+{
+  begin_opn(dev, MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and no commit is in progress.
 void
 end_op(int dev)
 {
   int do_commit = 0;
+  uint n;
 
   acquire(&log[dev].lock);
   log[dev].outstanding -= 1;
+  log[dev].reserved -= myproc()->logres[dev];
+  myproc()->logres[dev] = 0;
+  log[dev].st.nops++;
   if(log[dev].committing)
     panic("log[dev].committing");
   if(log[dev].outstanding == 0){
-    do_commit = 1;
-    log[dev].committing = 1;
+    if(log[dev].lh.n > 0 && log[dev].clh.n == 0){
+      do_commit = 1;
+      log[dev].committing = 1;
+    }
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log[dev].outstanding has decreased
-    // the amount of reserved space.
+    // and this op's reservation is free now.
     wakeup(&log);
   }
   release(&log[dev].lock);
 
   if(do_commit){
-    // call commit w/o holding locks, since not allowed
+    // call snapshot() w/o holding locks, since not allowed
     // to sleep with locks.
-    commit(dev);
+    n = snapshot(dev);
     acquire(&log[dev].lock);
-    log[dev].committing = 0;
-    wakeup(&log);
+    while((int)(log[dev].ndone - n) < 0)
+      sleep(&log[dev].ndone, &log[dev].lock);
     release(&log[dev].lock);
   }
 }
 
-// Copy modified blocks from cache to log.
-static void
-write_log(int dev)
+// Fill in st with dev's commit statistics, for logstat().
+int
+logstat(int dev, struct logstat *st)
 {
-  int tail;
-
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *to = bread(dev, log[dev].start+tail+1); // log block
-    struct buf *from = bread(dev, log[dev].lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
-  }
-}
-
-static void
-commit(int dev)
-{
-  if (log[dev].lh.n > 0) {
-    write_log(dev);     // Write modified blocks from cache to log
-    write_head(dev);    // Write header to disk -- the real commit
-    install_trans(dev); // Now install writes to home locations
-    log[dev].lh.n = 0;
-    write_head(dev);    // Erase the transaction from the log
-  }
+  if(dev < 0 || dev >= NDISK || log[dev].size == 0)
+    return -1;
+  acquire(&log[dev].lock);
+  *st = log[dev].st;
+  release(&log[dev].lock);
+  return 0;
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// The logger will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -216,7 +420,7 @@ log_write(struct buf *b)
   int i;
 
   int dev = b->dev;
-  if (log[dev].lh.n >= LOGSIZE || log[dev].lh.n >= log[dev].size - 1)
+  if (log[dev].lh.n >= log[dev].size - 1)
     panic("too big a transaction");
   if (log[dev].outstanding < 1)
     panic("log_write outside of trans");
@@ -247,6 +451,8 @@ crash_op(int dev, int docommit)
   if(log[dev].outstanding == 0)
     panic("end_op: already closed");
   log[dev].outstanding -= 1;
+  log[dev].reserved -= myproc()->logres[dev];
+  myproc()->logres[dev] = 0;
   if(log[dev].committing)
     panic("log[dev].committing");
   if(log[dev].outstanding == 0){
@@ -258,12 +464,18 @@ crash_op(int dev, int docommit)
 
   if(docommit & do_commit){
     printf("crash_op: commit\n");
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
+    // commit here rather than in the logger, so that
+    // the crash comes before installation.
+    acquire(&log[dev].lock);
+    while(log[dev].clh.n > 0)
+      sleep(&log[dev].clh, &log[dev].lock);
+    release(&log[dev].lock);
 
     if (log[dev].lh.n > 0) {
-      write_log(dev);     // Write modified blocks from cache to log
-      write_head(dev);    // Write header to disk -- the real commit
+      copy_trans(dev);
+      log[dev].clh = log[dev].lh;
+      write_log(dev);     // Write modified blocks from the copy to log
+      write_head(dev, &log[dev].clh);    // Write header to disk -- the real commit
     }
   }
   panic("crashed file system; please restart xv6 and run crashtest\n");
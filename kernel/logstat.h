@@ -0,0 +1,12 @@
+// Log statistics for one device, returned by the logstat() system call.
+
+#define NCOMMITHIST 9
+
+struct logstat {
+  uint64 nops;     // end_op() calls
+  uint64 ncommit;  // transactions committed
+  uint64 nblocks;  // blocks written to the log by them
+  uint64 ticks;    // total ticks from end_op() to commit on disk
+  uint64 sizes[NCOMMITHIST]; // commits by blocks, [k] for [2^(k-1), 2^k),
+                             // the last entry for all the bigger ones
+};
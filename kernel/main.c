@@ -10,6 +10,36 @@
 
 volatile static int started = 0;
 
+// when each phase of boot finished, from the time CSR;
+// printed once the kernel log is up.
+static struct {
+  char *what;
+  uint64 t;
+} boottime[8];
+static int nboottime;
+
+static void
+bootmark(char *what)
+{
+  if(nboottime < sizeof(boottime)/sizeof(boottime[0])){
+    boottime[nboottime].what = what;
+    boottime[nboottime++].t = r_time();
+  }
+}
+
+static void
+bootprint(void)
+{
+  uint64 last = 0;
+
+  for(int i = 0; i < nboottime; i++){
+    printf("boot: %s at %d us (+%d)\n", boottime[i].what,
+           (int)(boottime[i].t / (TICKCYCLES / 100000)),
+           (int)((boottime[i].t - last) / (TICKCYCLES / 100000)));
+    last = boottime[i].t;
+  }
+}
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
@@ -20,21 +50,48 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    bootmark("console");
     kinit();         // physical page allocator
+    bootmark("kinit");
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    bootmark("vm");
     trapinit();      // trap vectors
+    clockinit();     // timed sleeps
+    profinit();      // sampling profiler
+    traceinit();     // event trace device
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
+    bootmark("traps");
+
+    // the other harts only need paging, traps and the
+    // clock to run the scheduler, which zeroes pages for
+    // kalloc_zeroed() while they idle; let them start.
+    __sync_synchronize();
+    started = 1;
+
     binit();         // buffer cache
     iinit();         // inode cache
-    fileinit();      // file table
+    dcinit();        // directory-entry name cache
+    mountinit();     // mount table
+    fileinit();      // open file cache
+    textinit();      // executable page cache
+    pipeinit();      // pipe object cache
+    shminit();       // shared memory segments
+    pollinit();      // poll() waiters
+    futexinit();     // futex wait queues
+    bootmark("caches");
     virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
+    swapinit();      // swap area on the second disk
+    ramdiskinit();   // RAM disk for /tmp
+    bootmark("disks");
     userinit();      // first user process
-    __sync_synchronize();
-    started = 1;
+    kloginit();      // kernel log, drained by klogd
+    bootmark("user");
+    bootprint();
   } else {
     while(started == 0)
       ;
@@ -28,6 +28,7 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))  // software interrupt
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -63,6 +64,14 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, growing down from MMAPTOP
+//   VPROC, VDSO (read-only; see vdso.h)
+//   trapframes of further threads sharing the address space
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define NTFSLOT 16  // so at most 16 threads per address space
+#define TFSLOT(i) (TRAPFRAME - (i)*PGSIZE)
+#define VDSO (TFSLOT(NTFSLOT-1) - PGSIZE)
+#define VPROC (VDSO - PGSIZE)
+#define MMAPTOP VPROC
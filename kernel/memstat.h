@@ -0,0 +1,27 @@
+// Allocator statistics, returned by the memstat() system call.
+
+#define MS_NSIZE 32   // buddy size classes reported
+
+struct memstat {
+  int nsizes;                 // buddy size classes in use
+  int leafsize;               // bytes in a size-0 block
+  uint64 alloc[MS_NSIZE];     // bd_malloc() calls per size class
+  uint64 free[MS_NSIZE];      // bd_free() calls per size class
+  uint64 freeblks[MS_NSIZE];  // blocks on each free list now
+  uint64 split;               // blocks split by bd_malloc()
+  uint64 merge;               // buddy pairs merged by bd_free()
+  uint64 bdspin;              // spins waiting for buddy locks
+  uint64 bdinuse;             // bytes allocated from buddy now
+  uint64 bdmaxinuse;          // high-water mark of bdinuse
+  uint64 kalloc;              // pages handed out by kalloc*()
+  uint64 kfree;               // pages given back by kfree()
+  uint64 kzeroed;             // kalloc_zeroed() pages from the zeroed pools
+  uint64 ksteal;              // pages stolen from another CPU
+  uint64 kspin;               // spins waiting for kmem locks
+  uint64 kcached;             // free pages in per-CPU caches
+  uint64 kpooled;             // pages in per-CPU zeroed pools
+  uint64 swapsize;            // pages of swap space
+  uint64 swapused;            // swap slots in use now
+  uint64 swapout;             // pages written to swap
+  uint64 swapin;              // pages read back from swap
+};
@@ -0,0 +1,291 @@
+//
+// Memory-mapped files, shared memory segments (see shm.c)
+// and anonymous memory: mmap(), munmap(), and the page
+// faults they cause.
+//
+// Each process has a small table of VMAs (virtual memory
+// areas), placed top-down from MMAPTOP. mmap() only records
+// the region; uvmfault() calls mmapfault() on the first touch
+// of each page, which fills it from the file (or with zeros).
+// munmap(), exec() and exit() write the dirty pages of a
+// MAP_SHARED file mapping back to the file through the log.
+// The table is in p->mm, shared by threads; mm->lock guards it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return the VMA of p that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Is [addr, addr+len) free for a new mapping of p?
+// Caller holds p->mm->lock.
+static int
+vmafree(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+
+  if(addr % PGSIZE != 0 || addr < PGROUNDUP(p->mm->sz) ||
+     addr + len > MMAPTOP || addr + len < addr)
+    return 0;
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && addr < v->addr + v->len && v->addr < addr + len)
+      return 0;
+  return 1;
+}
+
+// Create a mapping of len bytes for the current process.
+// f is the mapped file or shared memory segment, or 0 with
+// MAP_ANONYMOUS. addr is a hint: the mapping goes there if
+// that range is free, so that processes sharing memory can
+// agree on where, and otherwise below all the others.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 addr, int len, int prot, int flags, struct file *f, int off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free = 0;
+  uint64 top = MMAPTOP, n;
+
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  n = PGROUNDUP((uint64)len);
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(f){
+    if((f->type != FD_INODE && f->type != FD_SHM) || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    if(f->type == FD_SHM &&
+       ((flags & MAP_SHARED) == 0 || off + n > shmsize(f->shm)))
+      return -1;
+  }
+
+  // place it below every existing mapping.
+  acquire(&p->mm->lock);
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0){
+      if(free == 0)
+        free = v;
+    } else if(v->addr < top){
+      top = v->addr;
+    }
+  }
+  if(free && addr && vmafree(p, addr, n))
+    top = addr + n;
+  if(free == 0 || n > top || top - n < PHYSTOP - KERNBASE){
+    release(&p->mm->lock);
+    return -1;
+  }
+
+  free->addr = top - n;
+  free->len = n;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  release(&p->mm->lock);
+  return free->addr;
+}
+
+// Fill in the page of p's mapping that contains va.
+// Called by uvmfault() for addresses above p->sz.
+// Returns 0 if the access can be retried, -1 if not.
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  struct file *f;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if((v->prot & (write ? PROT_WRITE : PROT_READ)) == 0)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  if(v->f && v->f->type == FD_INODE && !intr_get())
+    return -1;  // holding a spinlock: can't sleep in readi()
+  if(v->f && v->f->type == FD_SHM)
+    mem = shmpage(v->f->shm, (v->off + (va - v->addr)) / PGSIZE);
+  else
+    mem = kalloc_zeroed();
+  if(mem == 0)
+    return swapout() > 0 ? 0 : -1;
+  if(v->f && v->f->type == FD_INODE){
+    // a short read past the end of the file leaves zeros.
+    ilock(v->f->ip);
+    readi(v->f->ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+    iunlock(v->f->ip);
+  }
+
+  perm = PTE_U;
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;   // riscv has no write-only pages
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  // another thread may have faulted it in or unmapped
+  // it meanwhile; then just retry.
+  f = v->f;
+  acquire(&p->mm->lock);
+  if(vmafind(p, va) != v || v->f != f ||
+     ((pte = walk(p->pagetable, va, 0)) && (*pte & PTE_V))){
+    release(&p->mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    release(&p->mm->lock);
+    kfree(mem);
+    return -1;
+  }
+  release(&p->mm->lock);
+  return 0;
+}
+
+// Write the pages of MAP_SHARED file mapping v in [start, end)
+// that have been written to since they were faulted in back
+// to the file. Doesn't extend the file.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  // as in filewrite(), as many blocks per transaction
+  // as the log allows.
+  int max = (log_opmax(v->f->ip->dev) - WRITEBLOCKS(0)) * BSIZE;
+  struct inode *ip = v->f->ip;
+  uint64 va, pa;
+  uint off, n;
+  pte_t *pte;
+
+  for(va = start; va < end; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (va - v->addr);
+    for(uint i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_opn(ip->dev, WRITEBLOCKS(n));
+      ilock(ip);
+      if(off + i >= ip->size){
+        iunlock(ip);
+        end_op(ip->dev);
+        break;
+      }
+      if(off + i + n > ip->size)
+        n = ip->size - (off + i);
+      writei(ip, 0, pa + i, off + i, n);
+      iunlock(ip);
+      end_op(ip->dev);
+    }
+  }
+}
+
+// Unmap [addr, addr+len) of p's mappings, first writing
+// MAP_SHARED file pages back if writeback. The range must lie
+// within one mapping, and be at its start or its end.
+// Returns 0 on success, -1 on failure.
+static int
+vmaunmap(struct proc *p, uint64 addr, uint64 len, int writeback)
+{
+  struct vma *v, old;
+  int gone;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr >= MAXVA || len > MAXVA - addr)
+    return -1;
+  len = PGROUNDUP(len);
+  acquire(&p->mm->lock);
+  if((v = vmafind(p, addr)) == 0 || addr + len > v->addr + v->len ||
+     (addr != v->addr && addr + len != v->addr + v->len)){
+    release(&p->mm->lock);
+    return -1;
+  }
+
+  // take the range out of the table first, so that other
+  // threads' faults in it fail; then drop its pages.
+  old = *v;
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if((gone = v->len == 0))
+    v->f = 0;
+  release(&p->mm->lock);
+
+  if(writeback && old.f && old.f->type == FD_INODE && (old.flags & MAP_SHARED))
+    vmawriteback(p, &old, addr, addr + len);
+  uvmunmap(p->pagetable, addr, len, 1);
+  if(gone && old.f)
+    fileclose(old.f);
+  return 0;
+}
+
+int
+munmap(struct proc *p, uint64 addr, uint64 len)
+{
+  return vmaunmap(p, addr, len, 1);
+}
+
+// Remove all of p's mappings, for exec() and exit(). Without
+// writeback, for a child fork() gave up on, it doesn't sleep:
+// the child's MAP_SHARED pages are the parent's, still mapped.
+void
+munmapall(struct proc *p, int writeback)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v->addr, v->len, writeback);
+}
+
+// Give child np a copy of p's mappings, for fork().
+// MAP_SHARED pages stay shared; MAP_PRIVATE ones become
+// copy-on-write. Returns 0 on success, -1 on failure.
+int
+mmapdup(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+
+  for(v = p->mm->vma, nv = np->mm->vma; v < &p->mm->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->addr, v->len,
+                (v->flags & MAP_PRIVATE) != 0) < 0){
+      uvmunmap(np->pagetable, v->addr, v->len, 1);
+      munmapall(np, 0);
+      return -1;
+    }
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+  }
+  return 0;
+}
@@ -1,14 +1,31 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NPTCACHE      4  // empty user page tables each CPU keeps for reuse
+//#define LOCKSTAT       // keep per-lock-name statistics, for lockstat(); slows every lock
+#define NPRIO         4  // scheduling priority levels, 0 highest
+#define KLOGLINE    116  // longest piece of a line printf() logs at once
+#define TICKCYCLES 1000000  // timer cycles per tick; about 1/10th second in qemu
+#define PROFCYCLES   10000  // timer cycles between profiler samples (1 kHz)
+#define NOFILE       16  // open files per process, in struct proc
+#define NOFILEMAX   512  // open files per process, once it grows its table
+#define NVMA         16  // mmap() regions per process
+#define NSEG          4  // ELF segments exec() pages in on demand
+#define NTEXT       256  // pages in the executable page cache
+#define NFILE       100  // open files per system, before it was unlimited
+#define NINODE     1024  // maximum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       0  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      254  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache, plus the logs
+
+#define NRUN         16  // most blocks in one disk request
+#define NBUFTARGET   1024  // default size the block cache may grow to
+#define FSSIZE       100000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define NDISK        2
+#define NDISK        3  // block devices: the virtio disks, then the RAM disk
+#define NVIRTIO      2  // virtio disks, devices 0 and 1
+#define RAMDEV       2  // device number of the RAM disk, mounted on /tmp
+#define RAMSIZE   2048  // size of the RAM disk in blocks
+#define NSWAP     8192  // pages of swap space on disk 1, after its file system
@@ -7,18 +7,50 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe holds a queue of up to PIPEPAGES pages of data. A
+// write copies into the last page while it has room, or gives
+// the pipe a whole page of the writer's memory (see below);
+// a read copies out, or takes a whole page.
+#define PIPEPAGES 4
+
+struct pipebuf {
+  char *page;
+  uint start, end;        // page[start..end) is unread
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  struct sleeplock wlock; // one writer at a time copies in
+  struct sleeplock rlock; // one reader at a time copies out
+  struct pipebuf buf[PIPEPAGES];  // buf[head..tail), mod PIPEPAGES
+  uint head;      // pages taken by readers
+  uint tail;      // pages added by writers
+  char *spare;    // a free page to reuse, or 0
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+// runs once per pipe object, when its slab is created.
+static void
+pipector(void *p)
+{
+  struct pipe *pi = p;
+
+  initlock(&pi->lock, "pipe");
+  initsleeplock(&pi->wlock, "pipewrite");
+  initsleeplock(&pi->rlock, "piperead");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +60,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->head = pi->tail = 0;
+  pi->spare = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +78,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -61,67 +92,213 @@ pipeclose(struct pipe *pi, int writable)
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
-    wakeup(&pi->nread);
+    wakeup(&pi->tail);
   } else {
     pi->readopen = 0;
-    wakeup(&pi->nwrite);
+    wakeup(&pi->head);
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    for(; pi->head != pi->tail; pi->head++)
+      kfree(pi->buf[pi->head % PIPEPAGES].page);
+    if(pi->spare)
+      kfree(pi->spare);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// pipewrite() and piperead() copy straight between pages
+// and user memory, but never while holding pi->lock: a user
+// page may have to be faulted in from swap, which sleeps.
+// Instead the writer only appends to the last page or adds
+// new ones, and the reader only takes unread data from the
+// front, each holding its sleeplock; pi->lock just guards
+// head, tail and the bounds of each page's data.
+//
+// A page-aligned page of user heap or data isn't copied at
+// all. The writer gives the pipe the page itself, and keeps
+// it copy-on-write (uvmgift()). A reader of such a page, or
+// of any page the pipe filled, into a page-aligned page of
+// its own memory maps it in place of its copy (uvmrecv()).
+
+// Is there room for a writer? Caller holds pi->lock.
+static int
+piperoom(struct pipe *pi)
+{
+  return pi->tail - pi->head < PIPEPAGES ||
+         pi->buf[(pi->tail - 1) % PIPEPAGES].end < PGSIZE;
+}
+
+// Is there nothing to read? The last page stays queued after
+// it's been read, until the writer fills it.
+// Caller holds pi->lock.
+static int
+pipeempty(struct pipe *pi)
+{
+  struct pipebuf *b = &pi->buf[pi->head % PIPEPAGES];
+
+  return pi->head == pi->tail || b->start == b->end;
+}
+
+// Write n bytes from addr to pi; addr is a user
+// address if user_src is 1, else a kernel one.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i;
-  char ch;
   struct proc *pr = myproc();
+  struct pipebuf *b;
+  char *page;
+  uint64 pa;
+  int i, m, new;
 
-  acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || myproc()->killed){
+  acquiresleep(&pi->wlock);
+  for(i = 0; i < n; i += m){
+    acquire(&pi->lock);
+    while(!piperoom(pi)){  //DOC: pipewrite-full
+      if(pi->readopen == 0 || pr->killed){
         release(&pi->lock);
+        releasesleep(&pi->wlock);
         return -1;
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      sleep(&pi->head, &pi->lock);
+    }
+    new = pi->tail == pi->head || pi->buf[(pi->tail - 1) % PIPEPAGES].end == PGSIZE;
+    release(&pi->lock);
+
+    if(new && user_src && n - i >= PGSIZE &&
+       (pa = uvmgift(pr->pagetable, addr + i)) != 0){
+      m = PGSIZE;
+      acquire(&pi->lock);
+      b = &pi->buf[pi->tail++ % PIPEPAGES];
+      b->page = (char*)pa;
+      b->start = 0;
+      b->end = PGSIZE;
+      wakeup(&pi->tail);
+      release(&pi->lock);
+      continue;
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+
+    // only this writer changes the last page's end and tail.
+    if(new){
+      acquire(&pi->lock);
+      page = pi->spare;
+      pi->spare = 0;
+      release(&pi->lock);
+      if(page == 0 && (page = kalloc()) == 0)
+        break;
+      b = &pi->buf[pi->tail % PIPEPAGES];
+      b->page = page;
+      b->start = b->end = 0;
+    } else {
+      b = &pi->buf[(pi->tail - 1) % PIPEPAGES];
+    }
+    m = PGSIZE - b->end < n - i ? PGSIZE - b->end : n - i;
+    if(either_copyin(b->page + b->end, user_src, addr + i, m) < 0){
+      if(new)
+        kfree(b->page);
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    }
+
+    acquire(&pi->lock);
+    b->end += m;
+    if(new)
+      pi->tail++;
+    wakeup(&pi->tail);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
-  return n;
+  releasesleep(&pi->wlock);
+  return i > 0 || n == 0 ? i : -1;
+}
+
+// Done with the front page, b: free or keep it.
+// Caller holds pi->lock.
+static void
+pipedone(struct pipe *pi, struct pipebuf *b)
+{
+  if(pi->spare == 0 && krefcnt(b->page) == 1)
+    pi->spare = b->page;  // no one else sees it
+  else
+    kfree(b->page);
+  b->page = 0;
+  pi->head++;
 }
 
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
   struct proc *pr = myproc();
-  char ch;
+  struct pipebuf *b;
+  uint start, end;
+  int i, m, err = 0;
 
+  acquiresleep(&pi->rlock);
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+  while(pipeempty(pi) && pi->writeopen){  //DOC: pipe-empty
+    if(pr->killed){
       release(&pi->lock);
+      releasesleep(&pi->rlock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleep(&pi->tail, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->head != pi->tail; i += m){  //DOC: piperead-copy
+    b = &pi->buf[pi->head % PIPEPAGES];
+    start = b->start;
+    end = b->end;
+    if(start == end)
+      break;  // the last page, read up to where the writer is
+    release(&pi->lock);
+
+    if(start == 0 && end == PGSIZE && n - i >= PGSIZE &&
+       uvmrecv(pr->pagetable, addr + i, (uint64)b->page) == 0){
+      m = PGSIZE;
+      acquire(&pi->lock);
+      b->page = 0;
+      pi->head++;
+      wakeup(&pi->head);  //DOC: piperead-wakeup
+      continue;
+    }
+
+    m = end - start < n - i ? end - start : n - i;
+    if(copyout(pr->pagetable, addr + i, b->page + start, m) < 0){
+      err = 1;
+      acquire(&pi->lock);
       break;
+    }
+    acquire(&pi->lock);
+    b->start += m;
+    // the reader must leave the last page to the writer
+    // until it's full.
+    if(b->start == b->end && (b->end == PGSIZE || pi->head + 1 != pi->tail))
+      pipedone(pi, b);
+    wakeup(&pi->head);
+  }
+  release(&pi->lock);
+  releasesleep(&pi->rlock);
+  return err && i == 0 ? -1 : i;
+}
+
+// For filepoll(): can the read or write end go ahead?
+int
+pipepoll(struct pipe *pi, int writable, int events, void **chan)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    *chan = &pi->head;
+    if(!pi->readopen)
+      r = POLLERR;
+    else if(piperoom(pi))
+      r = POLLOUT;
+  } else {
+    *chan = &pi->tail;
+    if(!pipeempty(pi))
+      r = POLLIN;
+    else if(!pi->writeopen)
+      r = POLLHUP;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
-  return i;
+  return r & (events | POLLERR | POLLHUP);
 }
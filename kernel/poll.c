@@ -0,0 +1,195 @@
+//
+// poll(): wait for any of several files to become ready.
+//
+// Each kind of file that can block says how ready it is, and
+// which channel its own waiters sleep on (see filepoll()). A
+// poller registers a pollent for each such channel, and for
+// its clock deadline, then sleeps on its own p->pollev.
+// wakeup() of a registered channel sets p->pollev and wakes
+// the poller, which then checks all of its files again.
+//
+// p->pollev and the hash are protected by polltab.lock, and
+// the poller checks p->pollev and goes to sleep under it, so
+// a wakeup between its checks and its sleep isn't lost.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+#include "defs.h"
+
+#define NPOLLHASH 32
+
+struct pollent {
+  void *chan;
+  struct proc *p;
+  struct pollent *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pollent *hash[NPOLLHASH];
+} polltab;
+
+int npollent;  // registered pollents; wakeup() looks without the lock
+
+void
+pollinit(void)
+{
+  initlock(&polltab.lock, "poll");
+}
+
+static struct pollent**
+phash(void *chan)
+{
+  return &polltab.hash[((uint64)chan >> 3) % NPOLLHASH];
+}
+
+// Caller holds polltab.lock.
+static void
+pollreg(struct pollent *e, void *chan)
+{
+  struct pollent **h = phash(chan);
+
+  e->chan = chan;
+  e->p = myproc();
+  e->next = *h;
+  *h = e;
+  npollent++;
+}
+
+// Caller holds polltab.lock.
+static void
+pollunreg(struct pollent *e)
+{
+  struct pollent **ep;
+
+  for(ep = phash(e->chan); *ep; ep = &(*ep)->next){
+    if(*ep == e){
+      *ep = e->next;
+      npollent--;
+      return;
+    }
+  }
+  panic("pollunreg");
+}
+
+// Called by wakeup(chan): wake the processes polling chan.
+// A poller's pollents may go as soon as polltab.lock is
+// released, but it can only be woken needlessly, since it
+// clears p->pollev before looking at its files.
+void
+pollwakeup(void *chan)
+{
+  struct proc *wake[8], *p;
+  struct pollent *e;
+  int i, n;
+
+  do {
+    n = 0;
+    acquire(&polltab.lock);
+    for(e = *phash(chan); e && n < NELEM(wake); e = e->next){
+      p = e->p;
+      if(e->chan == chan && !p->pollev){
+        p->pollev = 1;
+        wake[n++] = p;
+      }
+    }
+    release(&polltab.lock);
+    for(i = 0; i < n; i++)
+      wakeup(&wake[i]->pollev);
+  } while(n == NELEM(wake));
+}
+
+// What of events is ready on each of fds, and the channels
+// to wait on for the rest. Returns the number of fds with
+// anything to report. Holds the files lock throughout, so
+// that other threads can't close them meanwhile; filepoll()
+// doesn't sleep.
+static int
+pollscan(struct pollfd *fds, int n, void **chan)
+{
+  struct files *fs = myproc()->files;
+  struct pollfd *pf;
+  int nready = 0;
+
+  acquire(&fs->lock);
+  for(pf = fds; pf < &fds[n]; pf++){
+    chan[pf - fds] = 0;
+    if(pf->fd < 0 || pf->fd >= fs->nofile || fs->ofile[pf->fd] == 0)
+      pf->revents = POLLNVAL;
+    else
+      pf->revents = filepoll(fs->ofile[pf->fd], pf->events, &chan[pf - fds]);
+    if(pf->revents)
+      nready++;
+  }
+  release(&fs->lock);
+  return nready;
+}
+
+uint64
+sys_poll(void)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollent ent[NOFILE+1];
+  void *chan[NOFILE];
+  uint64 addr, deadline = 0;
+  int n, timeout, nready, nent, i;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n * sizeof(fds[0])) < 0)
+    return -1;
+
+  nent = 0;
+  nready = pollscan(fds, n, chan);
+  if(nready == 0 && timeout != 0){
+    if(timeout > 0){
+      deadline = r_time() + (uint64)timeout * (TICKCYCLES / 100);
+      clockset(deadline);
+    }
+    acquire(&polltab.lock);
+    for(i = 0; i < n; i++)
+      if(chan[i])
+        pollreg(&ent[nent++], chan[i]);
+    if(deadline)
+      pollreg(&ent[nent++], &p->wakeat);  // see clockintr()
+    release(&polltab.lock);
+
+    for(;;){
+      acquire(&polltab.lock);
+      p->pollev = 0;
+      release(&polltab.lock);
+      if((nready = pollscan(fds, n, chan)) > 0 || p->killed ||
+         (deadline && r_time() >= deadline))
+        break;
+      acquire(&polltab.lock);
+      if(!p->pollev)
+        sleep(&p->pollev, &polltab.lock);
+      release(&polltab.lock);
+    }
+
+    acquire(&polltab.lock);
+    for(i = 0; i < nent; i++)
+      pollunreg(&ent[i]);
+    release(&polltab.lock);
+    if(deadline)
+      clockclear();
+    if(p->killed)
+      return -1;
+  }
+
+  if(copyout(p->pagetable, addr, (char*)fds, n * sizeof(fds[0])) < 0)
+    return -1;
+  return nready;
+}
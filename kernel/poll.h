@@ -0,0 +1,14 @@
+// For the poll() system call: wait until one of n
+// descriptors is ready, or timeout milliseconds pass
+// (never, if timeout < 0).
+struct pollfd {
+  int fd;
+  short events;      // what to wait for
+  short revents;     // what's ready, filled in by poll()
+};
+
+#define POLLIN   0x1   // a read won't block
+#define POLLOUT  0x4   // a write won't block
+#define POLLERR  0x8   // no reader for a write end (revents only)
+#define POLLHUP  0x10  // no writer for a read end; ditto
+#define POLLNVAL 0x20  // fd isn't open; ditto
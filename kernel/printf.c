@@ -1,6 +1,11 @@
 //
 // formatted console output -- printf, panic.
 //
+// printf() formats into a line buffer and hands each line to
+// the kernel log (see klog.c) once klogd is running. Before
+// that, and in panic(), it writes each character straight to
+// the console under pr.lock.
+//
 
 #include <stdarg.h>
 
@@ -25,8 +30,35 @@ static struct {
 
 static char digits[] = "0123456789abcdef";
 
+// what printf() has formatted but not yet logged.
+struct pbuf {
+  int sync;             // write straight to the console instead
+  int n;
+  char buf[KLOGLINE];
+};
+
+static void
+pflush(struct pbuf *pb)
+{
+  if(pb->n > 0)
+    klogput(pb->buf, pb->n);
+  pb->n = 0;
+}
+
+static void
+putc(struct pbuf *pb, int c)
+{
+  if(pb->sync){
+    consputc(c);
+    return;
+  }
+  pb->buf[pb->n++] = c;
+  if(pb->n == KLOGLINE || c == '\n')
+    pflush(pb);
+}
+
 static void
-printint(int xx, int base, int sign)
+printint(struct pbuf *pb, int xx, int base, int sign)
 {
   char buf[16];
   int i;
@@ -46,17 +78,17 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    putc(pb, buf[i]);
 }
 
 static void
-printptr(uint64 x)
+printptr(struct pbuf *pb, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  putc(pb, '0');
+  putc(pb, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(pb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the console. only understands %d, %x, %p, %s.
@@ -66,8 +98,11 @@ printf(char *fmt, ...)
   va_list ap;
   int i, c, locking;
   char *s;
+  struct pbuf pb;
 
-  locking = pr.locking;
+  pb.sync = !klogging;
+  pb.n = 0;
+  locking = pb.sync && pr.locking;
   if(locking)
     acquire(&pr.lock);
 
@@ -77,7 +112,7 @@ printf(char *fmt, ...)
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      putc(&pb, c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -85,31 +120,32 @@ printf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      printint(&pb, va_arg(ap, int), 10, 1);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      printint(&pb, va_arg(ap, int), 16, 1);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(&pb, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        putc(&pb, *s);
       break;
     case '%':
-      consputc('%');
+      putc(&pb, '%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      putc(&pb, '%');
+      putc(&pb, c);
       break;
     }
   }
 
+  pflush(&pb);
   if(locking)
     release(&pr.lock);
 }
@@ -118,6 +154,7 @@ void
 panic(char *s)
 {
   pr.locking = 0;
+  klogflush();
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -7,44 +7,197 @@
 #include "fs.h"
 #include "file.h"
 #include "proc.h"
+#include "vdso.h"
+#include "trace.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table grows by a proc at a time, up to NPROC,
+// when allocproc() finds no UNUSED one; procs are never freed,
+// so a struct proc* stays valid. allproc lists them all, newest
+// first, and ptable.free the UNUSED ones.
+struct {
+  struct spinlock lock;
+  struct proc *free;
+} ptable;
+struct proc *allproc;
+int nproc;
+
+// counts kernel stacks mapped since boot; a CPU flushes its
+// TLB before running a proc if it hasn't since the last.
+static uint kstackgen;
 
 struct proc *initproc;
 
+// Protects every proc's parent, children and sibling, so that
+// wait() and exit() see a consistent family tree. Lock order:
+// wait_lock, then a proc's lock.
+struct spinlock wait_lock;
+
+// Each CPU has a run queue of RUNNABLE processes, one FIFO per
+// priority level; an idle CPU steals from the others' queues.
+// A process is on at most one queue, marked by p->onrq. Lock
+// order: a proc's lock, then a queue's.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;
+} runq[NCPU];
+
+// Multi-level feedback: a process that uses up its quantum
+// drops a level, where quanta are longer, and one that sleeps
+// rises a level on wakeup, towards p->baseprio. A process
+// left queued for STARVE ticks rises straight to its base.
+static int quantum[NPRIO] = { 1, 2, 4, 8 };  // in timer ticks
+#define STARVE 20
+
+// Sleeping processes are kept on a hash table of queues keyed
+// by channel, so wakeup() looks only at processes that might
+// be sleeping on its chan. Lock order: a proc's lock, then a
+// sleep queue's.
+#define NSLEEPQ 64
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct sleepq*
+chanq(void *chan)
+{
+  return &sleepq[((uint64)chan * 0x9E3779B97F4A7C15ULL) >> 58];
+}
+
+// Unlink p from q. Caller holds q->lock.
+static void
+sqremove(struct sleepq *q, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &q->head; *pp; pp = &(*pp)->sqnext){
+    if(*pp == p){
+      *pp = p->sqnext;
+      break;
+    }
+  }
+  p->onsq = 0;
+}
+
+// Address spaces. Each new proc brings one to the free
+// list, so there are always enough: a proc has at most one,
+// and clone()'s threads share theirs.
+struct {
+  struct spinlock lock;
+  struct mm *free;
+} mmtable;
+
+// Open-file tables, with a cwd each. As with address spaces,
+// each new proc brings one to the free list, and clone()'s
+// threads share theirs.
+struct {
+  struct spinlock lock;
+  struct files *free;
+} filestable;
+
+// Per-CPU caches of the page tables of exited processes,
+// trimmed to the TRAMPOLINE, VDSO and VPROC mappings and the
+// page-table pages above them, so that fork() and exec()
+// needn't build them again. Each is only used by its own CPU,
+// with interrupts off.
+struct {
+  pagetable_t pt[NPTCACHE];
+  int n;
+} ptcache[NCPU];
+
+// Live procs hashed by pid, for kill() and setpriority().
+#define NPIDHASH 64
+struct proc *pidhash[NPIDHASH];
+
 int nextpid = 1;
-struct spinlock pid_lock;
+struct spinlock pid_lock;  // protects nextpid and pidhash
 
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
+static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 void
 procinit(void)
 {
-  struct proc *p;
-  
+  if(sizeof(struct proc) + sizeof(struct mm) + sizeof(struct files) > PGSIZE)
+    panic("procinit");
+  initlock(&ptable.lock, "ptable");
+  initlock(&wait_lock, "wait_lock");
   initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-
-      // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      char *pa = kalloc();
-      if(pa == 0)
-        panic("kalloc");
-      uint64 va = KSTACK((int) (p - proc));
-      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      p->kstack = va;
-  }
+  initlock(&mmtable.lock, "mmtable");
+  initlock(&filestable.lock, "filestable");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   kvminithart();
 }
 
+// Add a proc to the table, UNUSED, and return it, or 0 if the
+// table is full or out of memory. Its page also holds an mm,
+// for mmtable, and a files, for filestable. Caller holds
+// ptable.lock.
+static struct proc*
+procgrow(void)
+{
+  struct proc *p;
+  struct mm *mm;
+  struct files *fs;
+  char *pa;
+
+  if(nproc == NPROC)
+    return 0;
+  if((p = (struct proc*)kalloc()) == 0)
+    return 0;
+  if((pa = kalloc()) == 0){
+    kfree((void*)p);
+    return 0;
+  }
+  memset(p, 0, PGSIZE);
+  initlock(&p->lock, "proc");
+
+  // Map a page for the process's kernel stack high in
+  // memory, followed by an invalid guard page.
+  p->kstack = KSTACK(nproc);
+  if(mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kfree(pa);
+    kfree((void*)p);
+    return 0;
+  }
+  __sync_fetch_and_add(&kstackgen, 1);
+
+  mm = (struct mm*)(p + 1);
+  initlock(&mm->lock, "mm");
+  acquire(&mmtable.lock);
+  mm->next = mmtable.free;
+  mmtable.free = mm;
+  release(&mmtable.lock);
+
+  fs = (struct files*)(mm + 1);
+  initlock(&fs->lock, "files");
+  fs->ofile = fs->ofile0;
+  fs->nofile = NOFILE;
+  acquire(&filestable.lock);
+  fs->next = filestable.free;
+  filestable.free = fs;
+  release(&filestable.lock);
+
+  // publish p only once it's set up, for unlocked
+  // walks of allproc.
+  p->allnext = allproc;
+  __sync_synchronize();
+  allproc = p;
+  nproc++;
+  return p;
+}
+
 // Must be called with interrupts disabled,
 // to prevent race with process being moved
 // to a different CPU.
@@ -74,48 +227,413 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
-  int pid;
-  
+// Give p a new pid, and hash it under that.
+static void
+allocpid(struct proc *p) {
+  struct proc **h;
+
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  h = &pidhash[p->pid % NPIDHASH];
+  p->pidnext = *h;
+  *h = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Take p out of the pid hash.
+static void
+freepid(struct proc *p) {
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pid = 0;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, return 0.
+// Return the live proc with the given pid, with its lock
+// held, or 0 if there's none.
 static struct proc*
-allocproc(void)
+findproc(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  if(pid <= 0)
+    return 0;
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed or reused since.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Make pagetable, of size sz, p's address space, in a
+// new mm, with p's trapframe at TRAPFRAME.
+static void
+mmalloc(struct proc *p, pagetable_t pagetable, uint64 sz)
+{
+  struct mm *mm;
+
+  acquire(&mmtable.lock);
+  if((mm = mmtable.free) == 0)
+    panic("mmalloc");  // p had one already?
+  mmtable.free = mm->next;
+  mm->ref = 1;
+  mm->tfslots = 1;
+  release(&mmtable.lock);
+
+  mm->pagetable = pagetable;
+  mm->sz = sz;
+  mm->asid = 0;
+  mm->tlbcpus = 0;
+  mm->tlbstale = 0;
+  mm->tlbgen = 0;
+  memset(mm->vma, 0, sizeof(mm->vma));
+  mm->ip = 0;
+  memset(mm->seg, 0, sizeof(mm->seg));
+  mm->vproc = (struct vproc*)walkaddr(pagetable, VPROC);
+  p->mm = mm;
+  p->pagetable = pagetable;
+  p->tfva = TRAPFRAME;
+}
+
+// Make p a thread of address space mm, with its
+// trapframe at a free TFSLOT(). Returns 0, or -1.
+static int
+mmshare(struct proc *p, struct mm *mm)
+{
+  int i, r;
+
+  acquire(&mmtable.lock);
+  for(i = 0; i < NTFSLOT; i++)
+    if((mm->tfslots & (1 << i)) == 0)
+      break;
+  if(i == NTFSLOT){
+    release(&mmtable.lock);
+    return -1;
+  }
+  mm->tfslots |= 1 << i;
+  mm->ref++;
+  release(&mmtable.lock);
+
+  acquire(&mm->lock);
+  r = mappages(mm->pagetable, TFSLOT(i), PGSIZE, (uint64)p->tf, PTE_R | PTE_W);
+  release(&mm->lock);
+  if(r != 0){
+    acquire(&mmtable.lock);
+    mm->tfslots &= ~(1 << i);
+    mm->ref--;
+    release(&mmtable.lock);
+    return -1;
+  }
+  p->mm = mm;
+  p->pagetable = mm->pagetable;
+  p->tfva = TFSLOT(i);
+  mm->vproc->pid = 0;  // no longer one pid; getpid() must ask
+  return 0;
+}
+
+// The number of threads using mm. Only p's own threads can
+// change it, through clone(), exit() and exec(), so if it's 1
+// for the current process p, it stays 1.
+static int
+mmrefs(struct mm *mm)
+{
+  int n;
+
+  acquire(&mmtable.lock);
+  n = mm->ref;
+  release(&mmtable.lock);
+  return n;
+}
+
+// Give up p's use of its address space, freeing it if no
+// other thread uses it. That may sleep, to write back
+// MAP_SHARED regions, unless fork() never finished with p.
+void
+mmput(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  int last;
+
+  if(mm == 0)
+    return;
+  uvmunmap(mm->pagetable, p->tfva, PGSIZE, 0);
+  acquire(&mmtable.lock);
+  last = mm->ref == 1;
+  if(!last){
+    mm->tfslots &= ~(1 << (TRAPFRAME - p->tfva) / PGSIZE);
+    mm->ref--;
+  }
+  release(&mmtable.lock);
+  if(last){
+    // no other thread can get at mm now.
+    munmapall(p, 1);
+    proc_freepagetable(mm->pagetable, mm->sz);
+    execput(mm);
+    acquire(&mmtable.lock);
+    mm->tfslots = 0;
+    mm->ref = 0;
+    mm->next = mmtable.free;
+    mmtable.free = mm;
+    release(&mmtable.lock);
+  }
+  p->mm = 0;
+  p->pagetable = 0;
+}
+
+// Replace p's address space by exec()'s new pagetable, of
+// size sz, with p's trapframe at TRAPFRAME. If other threads
+// share the old one, they keep it, and p gets a new mm.
+void
+mmexec(struct proc *p, pagetable_t pagetable, uint64 sz)
+{
+  struct mm *mm = p->mm;
+  pagetable_t oldpagetable;
+  uint64 oldsz;
+
+  if(mmrefs(mm) == 1){
+    munmapall(p, 1);
+    oldpagetable = mm->pagetable;
+    oldsz = mm->sz;
+    acquire(&mmtable.lock);
+    mm->tfslots = 1;
+    release(&mmtable.lock);
+    mm->pagetable = pagetable;
+    mm->vproc = (struct vproc*)walkaddr(pagetable, VPROC);
+    mm->asid = 0;  // a new address space needs a new ASID
+    mm->sz = sz;
+    p->pagetable = pagetable;
+    // a thread whose siblings have exited has its
+    // trapframe in another slot of the old table.
+    if(p->tfva != TRAPFRAME)
+      uvmunmap(oldpagetable, p->tfva, PGSIZE, 0);
+    p->tfva = TRAPFRAME;
+    proc_freepagetable(oldpagetable, oldsz);
+    execput(mm);
+    return;
+  }
+
+  mmput(p);
+  mmalloc(p, pagetable, sz);
+}
+
+// The address space whose page table is pagetable, or 0 if no
+// proc uses it (yet). Without locks: an mm is never freed, and
+// if it changes hands meanwhile, the caller made at most one
+// CPU flush its TLB needlessly.
+struct mm*
+pagetablemm(pagetable_t pagetable)
+{
+  struct proc *q;
+  struct mm *mm;
+
+  for(q = allproc; q; q = q->allnext)
+    if((mm = q->mm) != 0 && mm->pagetable == pagetable)
+      return mm;
+  return 0;
+}
+
+// The current process p changed mappings that other threads
+// of its address space may be using: a CPU may run them with
+// stale TLB entries, or the kernel may be copying to or from
+// the old pages on their behalf. Wait until each has either
+// been in sleep() (which no copy spans) or gone back to user
+// space (flushing its CPU's TLB, see uvmsatp()) since the
+// change, which tlbinval() counted as generation gen.
+void
+tlbsync(struct proc *p, uint64 gen)
+{
+  struct proc *q;
+
+  if(!intr_get())
+    return;  // holding a spinlock (a copy-on-write fault): can't sleep
+  for(;;){
+    for(q = allproc; q; q = q->allnext)
+      if(q != p && q->mm == p->mm && q->state != SLEEPING && q->tlbseen < gen)
+        break;
+    if(q == 0)
+      return;
+    // they get there at their next timer interrupt, at worst.
+    clocksleep(r_time() + TICKCYCLES);
+  }
+}
+
+// Is fs shared? If not, only the current process, its one
+// user, could make it so, with clone(), so it stays unshared
+// while that process looks at it without the lock.
+static int
+filesshared(struct files *fs)
+{
+  return fs->ref > 1;
+}
+
+// A table of no open files and no cwd. There's always one
+// free, since each proc brought one and has at most one.
+static struct files*
+filesalloc(void)
+{
+  struct files *fs;
+
+  acquire(&filestable.lock);
+  if((fs = filestable.free) == 0)
+    panic("filesalloc");
+  filestable.free = fs->next;
+  release(&filestable.lock);
+  fs->ref = 1;
+  return fs;
+}
+
+// Return fs, whose files are all closed, to the free list.
+static void
+filesfree(struct files *fs)
+{
+  if(fs->ofile != fs->ofile0)
+    kfree((void*)fs->ofile);
+  fs->ofile = fs->ofile0;
+  fs->nofile = NOFILE;
+  fs->ref = 0;
+  acquire(&filestable.lock);
+  fs->next = filestable.free;
+  filestable.free = fs;
+  release(&filestable.lock);
+}
+
+// Give up p's use of its open files and cwd, closing them if
+// no other thread uses them. That may sleep, unless fork()
+// never gave p any.
+static void
+filesput(struct proc *p)
+{
+  struct files *fs = p->files;
+  int fd, dev, last;
+
+  if(fs == 0)
+    return;
+  acquire(&fs->lock);
+  last = --fs->ref == 0;
+  release(&fs->lock);
+  if(last){
+    // no other thread can get at fs now.
+    for(fd = 0; fd < fs->nofile; fd++){
+      if(fs->ofile[fd]){
+        fileclose(fs->ofile[fd]);
+        fs->ofile[fd] = 0;
+      }
+    }
+    if(fs->cwd){
+      dev = fs->cwd->dev;
+      begin_op(dev);
+      iput(fs->cwd);
+      end_op(dev);
+      fs->cwd = 0;
     }
+    filesfree(fs);
+  }
+  p->files = 0;
+}
+
+// Give the current process p open files and a cwd of its own,
+// copies of those it shares with other threads, if it does, as
+// exec() starts a program that should own them. Since then only
+// threads share files, and only threads share an mm. Returns 0,
+// or -1 if out of memory.
+int
+filesunshare(struct proc *p)
+{
+  struct files *fs = p->files, *nfs;
+  int fd;
+
+  if(!filesshared(fs))
+    return 0;
+  nfs = filesalloc();
+  acquire(&fs->lock);
+  if(fdgrow(nfs, fs->nofile) < 0){
+    release(&fs->lock);
+    filesfree(nfs);
+    return -1;
   }
+  for(fd = 0; fd < fs->nofile; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  // the others may all have exited meanwhile.
+  filesput(p);
+  p->files = nfs;
   return 0;
+}
+
+// Take an UNUSED proc from the process table, growing it
+// if need be. If found, initialize state required to run in
+// the kernel, with a new address space and no open files,
+// or sharing mm and fs if they're not 0, and return with
+// p->lock held.
+// If there are no free procs, return 0.
+static struct proc*
+allocproc(struct mm *mm, struct files *fs)
+{
+  struct proc *p;
+  pagetable_t pagetable;
 
-found:
-  p->pid = allocpid();
+  acquire(&ptable.lock);
+  if((p = ptable.free) != 0)
+    ptable.free = p->freenext;
+  else
+    p = procgrow();
+  release(&ptable.lock);
+  if(p == 0)
+    return 0;
+
+  acquire(&p->lock);
+  allocpid(p);
+  p->cpu = -1;
+  if(fs == 0){
+    p->files = filesalloc();
+  } else {
+    acquire(&fs->lock);
+    fs->ref++;
+    release(&fs->lock);
+    p->files = fs;
+  }
+  p->prio = p->baseprio = 0;
+  p->slice = quantum[0];
 
   // Allocate a trapframe page.
   if((p->tf = (struct trapframe *)kalloc()) == 0){
+    freeproc(p);
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  // An empty user page table, or mm's.
+  if(mm == 0){
+    if((pagetable = proc_pagetable(p)) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    mmalloc(p, pagetable, 0);
+  } else if(mmshare(p, mm) < 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -132,28 +650,58 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  mmput(p);
+  filesput(p);
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
+  freepid(p);
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  memset(p->logres, 0, sizeof(p->logres));
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
+  p->oncpu = 0;
   p->state = UNUSED;
+
+  acquire(&ptable.lock);
+  p->freenext = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
 }
 
 // Create a page table for a given process,
-// with no user pages, but with trampoline pages.
+// with no user pages, but with trampoline pages
+// and the VDSO and VPROC pages. Returns 0 if out of memory.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
-  pagetable_t pagetable;
+  pagetable_t pagetable = 0;
+  struct vproc *vp;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(ptcache[id].n > 0)
+    pagetable = ptcache[id].pt[--ptcache[id].n];
+  pop_off();
+  if(pagetable){
+    vp = (struct vproc*)walkaddr(pagetable, VPROC);
+    vp->pid = p->pid;
+    mappages(pagetable, TRAPFRAME, PGSIZE,
+             (uint64)(p->tf), PTE_R | PTE_W);
+    return pagetable;
+  }
+
+  if((vp = (struct vproc*)kalloc_zeroed()) == 0)
+    return 0;
+  vp->pid = p->pid;
 
   // An empty page table.
   pagetable = uvmcreate();
@@ -169,18 +717,42 @@ proc_pagetable(struct proc *p)
   mappages(pagetable, TRAPFRAME, PGSIZE,
            (uint64)(p->tf), PTE_R | PTE_W);
 
+  // values user code may read without a system call.
+  mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U);
+  mappages(pagetable, VPROC, PGSIZE, (uint64)vp, PTE_R | PTE_U);
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. Keeps the page
+// table itself in this CPU's cache if there's room.
+// Threads' other trapframe slots must be unmapped
+// already, or the next user would share the pages.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
-  uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
+  pte_t *pte;
+  int id;
+
   uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
-  if(sz > 0)
-    uvmfree(pagetable, sz);
+  for(int i = 1; i < NTFSLOT; i++)
+    if((pte = walk(pagetable, TFSLOT(i), 0)) != 0 && (*pte & PTE_V))
+      panic("proc_freepagetable: tfslot");
+  uvmtrim(pagetable, sz, TRAMPOLINE);
+  push_off();
+  id = cpuid();
+  if(ptcache[id].n < NPTCACHE){
+    ptcache[id].pt[ptcache[id].n++] = pagetable;
+    pagetable = 0;
+  }
+  pop_off();
+  if(pagetable == 0)
+    return;
+  uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
+  uvmunmap(pagetable, VDSO, PGSIZE, 0);
+  uvmunmap(pagetable, VPROC, PGSIZE, 1);
+  uvmfree(pagetable, 0);
 }
 
 // a user program that calls exec("/init")
@@ -195,54 +767,314 @@ uchar initcode[] = {
   0x00, 0x00, 0x00
 };
 
+// Mark p RUNNABLE, and put it on a run queue at level
+// p->prio unless it's on one already: the queue of the CPU it
+// last ran on, for its caches' sake, or else this CPU's; and
+// have an idle CPU, if there is one, run it now.
+// Caller holds p->lock.
+void
+makerunnable(struct proc *p)
+{
+  struct runq *q;
+  int l, id;
+
+  if(!holding(&p->lock))
+    panic("makerunnable");
+  p->state = RUNNABLE;
+  if(p->onrq || p->pinned)
+    return;  // swapout()'s unpin() will call again
+  p->onrq = 1;
+  p->rqtime = ticks;
+  id = p->cpu >= 0 ? p->cpu : cpuid();
+  q = &runq[id];
+  l = p->prio;
+  acquire(&q->lock);
+  p->rqnext = 0;
+  if(q->tail[l])
+    q->tail[l]->rqnext = p;
+  else
+    q->head[l] = p;
+  q->tail[l] = p;
+  q->n++;
+  release(&q->lock);
+
+  // an idle CPU only looks at the queues when interrupted.
+  clockwake(id);
+}
+
+// Wake p from sleep, raising it a level for having
+// given up the CPU early. Caller holds p->lock.
+static void
+wake(struct proc *p)
+{
+  if(p->prio > p->baseprio)
+    p->prio--;
+  p->slice = quantum[p->prio];
+  makerunnable(p);
+}
+
+// Does CPU id's run queue have anything on it?
+int
+runnable(int id)
+{
+  return runq[id].n > 0;
+}
+
+// Take the next process to run from q, or return 0: the
+// head of the highest non-empty level, unless a lower
+// level's head has starved.
+static struct proc*
+runqget(struct runq *q)
+{
+  struct proc *p;
+  int l;
+
+  if(q->n == 0)
+    return 0;  // just a hint, but saves taking the lock
+  acquire(&q->lock);
+  for(l = NPRIO-1; l > 0; l--)
+    if(q->head[l] && ticks - q->head[l]->rqtime >= STARVE)
+      break;
+  if(l == 0)
+    while(l < NPRIO-1 && q->head[l] == 0)
+      l++;
+  if((p = q->head[l]) != 0){
+    if((q->head[l] = p->rqnext) == 0)
+      q->tail[l] = 0;
+    q->n--;
+  }
+  release(&q->lock);
+  return p;
+}
+
+// Is anything queued on this CPU at a better level than p's?
+// A hint, read without the queue lock.
+static int
+preempted(struct proc *p)
+{
+  struct runq *q;
+  int l;
+
+  push_off();
+  q = &runq[cpuid()];
+  for(l = 0; l < p->prio; l++)
+    if(q->head[l])
+      break;
+  pop_off();
+  return l < p->prio;
+}
+
+// Called on each timer tick by the running process. Give up
+// the CPU when its quantum runs out, dropping a level, or
+// when something better is waiting.
+void
+proctick(void)
+{
+  struct proc *p = myproc();
+
+  if(--p->slice <= 0){
+    acquire(&p->lock);
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = quantum[p->prio];
+    release(&p->lock);
+    yield();
+  } else if(preempted(p)){
+    yield();
+  }
+}
+
+// Set the base priority of process pid to prio, or just
+// report it if prio is -1. Returns the old base, or -1.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio < -1 || prio >= NPRIO)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->baseprio;
+  if(prio >= 0){
+    // takes effect the next time it is queued.
+    p->baseprio = prio;
+    p->prio = prio;
+    p->slice = quantum[prio];
+  }
+  release(&p->lock);
+  return old;
+}
+
 // Set up first user process.
 void
 userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0, 0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->tf->epc = 0;      // user program counter
   p->tf->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->files->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
+
+  release(&p->lock);
+}
+
+// A kernel thread's first scheduling
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn(p->karg);
+  panic("kthread return");
+}
 
+// Start a kernel thread running fn(arg). It has no user
+// memory and never returns to user space; fn must not
+// return either.
+void
+kthread(char *name, void (*fn)(uint64), uint64 arg)
+{
+  struct proc *p;
+
+  if((p = allocproc(0, 0)) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  p->karg = arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+  makerunnable(p);
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Growing only raises sz; uvmfault() allocates
+// each page the first time it is touched.
+// Return the old size, or -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz;
+  struct mm *mm = myproc()->mm;
 
-  sz = p->sz;
+  acquire(&mm->lock);
+  sz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
-  } else if(n < 0){
-    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) == 0) {
+    // don't hand out more than physical memory could back.
+    if(sz + n > PHYSTOP - KERNBASE){
+      release(&mm->lock);
       return -1;
     }
+  } else if(n < 0 && (uint64)-n >= sz){
+    release(&mm->lock);
+    return -1;
   }
-  p->sz = sz;
+  mm->sz = sz + n;
+  release(&mm->lock);
+  // faults above mm->sz now fail, so the pages
+  // can go without the lock.
+  if(n < 0)
+    uvmdealloc(mm->pagetable, sz, sz + n);
+  return sz;
+}
+
+// Make np a child of p.
+static void
+addchild(struct proc *p, struct proc *np)
+{
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+}
+
+// Make room for at least n open files in fs, moving its table
+// from struct files to a page of its own if it's to hold more
+// than NOFILE. Returns 0, or -1 if n is more than NOFILEMAX or
+// there's no memory. Caller holds fs->lock if fs is shared.
+int
+fdgrow(struct files *fs, int n)
+{
+  struct file **ofile;
+
+  if(n <= fs->nofile)
+    return 0;
+  if(n > NOFILEMAX || (ofile = (struct file**)kalloc_zeroed()) == 0)
+    return -1;
+  memmove(ofile, fs->ofile, fs->nofile * sizeof(struct file*));
+  fs->ofile = ofile;
+  fs->nofile = NOFILEMAX;
   return 0;
 }
 
+// The file open as the current process's descriptor fd, or 0.
+// If other threads share the table, one of them could close
+// fd meanwhile, so the caller gets a reference of its own,
+// which fdrelease() drops as the system call returns.
+struct file*
+fdget(int fd)
+{
+  struct proc *p = myproc();
+  struct files *fs = p->files;
+  struct file *f;
+
+  if(!filesshared(fs))
+    return fd < 0 || fd >= fs->nofile ? 0 : fs->ofile[fd];
+  acquire(&fs->lock);
+  if(fd < 0 || fd >= fs->nofile || (f = fs->ofile[fd]) == 0){
+    release(&fs->lock);
+    return 0;
+  }
+  if(p->nfdheld == NFDHELD)
+    panic("fdget");
+  p->fdheld[p->nfdheld++] = filedup(f);
+  release(&fs->lock);
+  return f;
+}
+
+// Drop the current system call's fdget() references.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nfdheld > 0)
+    fileclose(p->fdheld[--p->nfdheld]);
+}
+
+// A new reference to the current directory.
+struct inode*
+cwdget(void)
+{
+  struct files *fs = myproc()->files;
+  struct inode *ip;
+
+  if(!filesshared(fs))
+    return idup(fs->cwd);
+  acquire(&fs->lock);
+  ip = idup(fs->cwd);
+  release(&fs->lock);
+  return ip;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -252,20 +1084,43 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // other threads would change the page table under
+  // uvmcopy(), so only a single-threaded process can fork.
+  // Its open files aren't shared either, then.
+  if(mmrefs(p->mm) > 1)
+    return -1;
+
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0, 0)) == 0){
+    return -1;
+  }
+
+  // room for the parent's file descriptors, while failing
+  // frees nothing that might sleep.
+  if(fdgrow(np->files, p->files->nofile) < 0){
+    freeproc(np);
+    release(&np->lock);
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  np->mm->sz = p->mm->sz;
 
-  np->parent = p;
+  if(mmapdup(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  // pages neither has touched yet still come from the file.
+  if(p->mm->ip)
+    np->mm->ip = idup(p->mm->ip);
+  memmove(np->mm->seg, p->mm->seg, sizeof(np->mm->seg));
 
   // copy saved user registers.
   *(np->tf) = *(p->tf);
@@ -274,49 +1129,131 @@ fork(void)
   np->tf->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  for(i = 0; i < p->files->nofile; i++)
+    if(p->files->ofile[i])
+      np->files->ofile[i] = filedup(p->files->ofile[i]);
+  np->files->cwd = idup(p->files->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  np->prio = np->baseprio = p->baseprio;
+  np->slice = quantum[np->prio];
+  release(&np->lock);
+
+  addchild(p, np);
+
+  acquire(&np->lock);
+  makerunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread: a child process sharing the current one's
+// address space, open files and cwd, which starts in fn(arg)
+// on the user stack whose top is sp. It exits through exit()
+// like a process, but its memory and files (if another thread
+// still uses them) stay; the parent reaps it with join().
+int
+clone(uint64 fn, uint64 arg, uint64 sp)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(p->mm, p->files)) == 0)
+    return -1;
+
+  *(np->tf) = *(p->tf);
+  np->tf->epc = fn;
+  np->tf->a0 = arg;
+  np->tf->sp = sp;
+  np->tf->ra = 0;  // fn mustn't return
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  np->prio = np->baseprio = p->baseprio;
+  np->slice = quantum[np->prio];
+  release(&np->lock);
+
+  addchild(p, np);
+
+  acquire(&np->lock);
+  makerunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Start a child process running the program at path with
+// arguments argv, as fork() and then exec() would, but without
+// copying this process's memory only to throw it away. The
+// child's file descriptors 0, 1 and 2 are f[0..2] (closed if
+// 0), and it has no others. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **f)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(0, 0)) == 0)
+    return -1;
+  // np isn't RUNNABLE, so nothing else uses it meanwhile,
+  // and loadexec() may sleep.
+  release(&np->lock);
+
+  memset(np->tf, 0, sizeof(*np->tf));
+  if((argc = loadexec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->tf->a0 = argc;
+
+  for(i = 0; i < 3; i++)
+    if(f[i])
+      np->files->ofile[i] = filedup(f[i]);
+  np->files->cwd = cwdget();
+
+  pid = np->pid;
+
+  np->prio = np->baseprio = p->baseprio;
+  np->slice = quantum[np->prio];
 
+  addchild(p, np);
+
+  acquire(&np->lock);
+  makerunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
 // Pass p's abandoned children to init.
-// Caller must hold p->lock and parent->lock.
-void
-reparent(struct proc *p, struct proc *parent) {
+// Caller must hold wait_lock.
+static void
+reparent(struct proc *p)
+{
   struct proc *pp;
-  int child_of_init = (p->parent == initproc);
-
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      if(pp->state == ZOMBIE) {
-        if(!child_of_init)
-          acquire(&initproc->lock);
-        wakeup1(initproc);
-        if(!child_of_init)
-          release(&initproc->lock);
-      }
-      release(&pp->lock);
-    }
+
+  if(p->children == 0)
+    return;
+  for(pp = p->children; ; pp = pp->sibling){
+    pp->parent = initproc;
+    if(pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  // some may be zombies already.
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -330,98 +1267,126 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Leave the address space. If it was the last thread,
+  // that writes back and removes mmap() regions.
+  mmput(p);
 
-  begin_op(ROOTDEV);
-  iput(p->cwd);
-  end_op(ROOTDEV);
-  p->cwd = 0;
+  // Close all open files, and the cwd, unless other
+  // threads still use them.
+  filesput(p);
 
-  acquire(&p->parent->lock);
-
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
-  reparent(p, p->parent);
+  reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup1(p->parent);
+  wakeup(p->parent);
+
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&p->parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Add the usage in *b to *a.
+static void
+ruadd(struct rusage *a, struct rusage *b)
+{
+  a->utime += b->utime;
+  a->stime += b->stime;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+  a->nfault += b->nfault;
+  a->inblock += b->inblock;
+  a->oublock += b->oublock;
+}
+
+// Fill in *ru with the usage of the calling process, or of
+// its reaped children, by who. Returns 0, or -1 for a bad who.
 int
-wait(uint64 addr)
+getrusage(int who, struct rusage *ru)
 {
-  struct proc *np;
-  int havekids, pid;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  if(who == RUSAGE_SELF){
+    *ru = p->ru;
+    ru->stime = p->oncpu + (r_time() - p->runstart) - p->ru.utime;
+  } else if(who == RUSAGE_CHILDREN){
+    *ru = p->cru;
+  } else {
+    return -1;
+  }
+  ru->utime /= TICKCYCLES / 100000;  // cycles to microseconds
+  ru->stime /= TICKCYCLES / 100000;
+  return 0;
+}
+
+// Wait for child process pid (or any, if pid is -1) to
+// exit and return its pid.
+// Return -1 if this process has no such children.
+int
+wait(int pid, uint64 addr)
+{
+  struct proc *np, **pp;
+  int havekids, xstate;
+  struct proc *p = myproc();
+
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&p->lock);
-          return pid;
-        }
+    for(pp = &p->children; (np = *pp) != 0; pp = &np->sibling){
+      // np->pid can't change while np is our child.
+      if(pid != -1 && np->pid != pid)
+        continue;
+      acquire(&np->lock);
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        xstate = np->xstate;
+        *pp = np->sibling;
+        np->ru.stime = np->oncpu - np->ru.utime;
+        ruadd(&p->cru, &np->ru);
+        ruadd(&p->cru, &np->cru);
+        freeproc(np);
         release(&np->lock);
+        release(&wait_lock);
+        // copyout() may sleep, so not while holding locks.
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                sizeof(xstate)) < 0)
+          return -1;
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
     if(!havekids || p->killed){
-      release(&p->lock);
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the next on this CPU's run
+//    queue, or if that's empty one stolen from another's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -430,35 +1395,55 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 t0;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->scheduler, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
-      }
-      release(&p->lock);
+    p = runqget(&runq[id]);
+    for(int i = 1; p == 0 && i < NCPU; i++)
+      p = runqget(&runq[(id + i) % NCPU]);
+    if(p == 0){
+      // spend idle time zeroing pages for kalloc_zeroed(),
+      // and only sleep once there is no more to do.
+      if(kzeroidle() == 0)
+        clockidle();
+      continue;
     }
-    if(found == 0){
-      intr_on();
-      asm volatile("wfi");
+
+    acquire(&p->lock);
+    p->onrq = 0;
+    if(p->state == RUNNABLE && !p->pinned) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      if(ticks - p->rqtime >= STARVE && p->prio > p->baseprio){
+        p->prio = p->baseprio;
+        p->slice = quantum[p->prio];
+      }
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      if(c->kstackgen != kstackgen){
+        // p's kernel stack may be newly mapped.
+        c->kstackgen = kstackgen;
+        sfence_vma();
+      }
+      t0 = r_time();
+      p->runstart = t0;
+      swtch(&c->scheduler, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+      p->oncpu += r_time() - t0;
+      if(tracing)
+        traceadd(TR_SCHED, p->pid, p->state, t0, 0, 0, 0, 0);
     }
+    release(&p->lock);
   }
 }
 
@@ -483,6 +1468,10 @@ sched(void)
     panic("sched running");
   if(intr_get())
     panic("sched interruptible");
+  if(p->state == RUNNABLE)
+    p->ru.nivcsw++;   // yield()
+  else if(p->state == SLEEPING)
+    p->ru.nvcsw++;
 
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->scheduler);
@@ -495,7 +1484,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  makerunnable(p);
   sched();
   release(&p->lock);
 }
@@ -527,26 +1516,38 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = chanq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once we are on chan's queue and hold
+  // p->lock, we can be guaranteed that we
+  // won't miss any wakeup (wakeup searches
+  // the queue, then locks p->lock),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&q->lock);
+  p->chan = chan;
+  p->sqnext = q->head;
+  q->head = p;
+  p->onsq = 1;
+  release(&q->lock);
+  if(lk != &p->lock)
     release(lk);
-  }
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
+  // Tidy up. wakeup() has unlinked p, unless it was
+  // woken some other way.
+  acquire(&q->lock);
+  if(p->onsq)
+    sqremove(q, p);
   p->chan = 0;
+  release(&q->lock);
 
   // Reacquire original lock.
   if(lk != &p->lock){
@@ -555,30 +1556,35 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up all processes sleeping on chan,
+// and any poll()ing it.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
+  struct sleepq *q = chanq(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(;;){
+    // take one sleeper off chan's queue; it can't leave
+    // sleep() before we lock it, except by kill().
+    acquire(&q->lock);
+    for(p = q->head; p && p->chan != chan; p = p->sqnext)
+      ;
+    if(p)
+      sqremove(q, p);
+    release(&q->lock);
+    if(p == 0)
+      break;
+
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      wake(p);
     }
     release(&p->lock);
   }
-}
-
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
-static void
-wakeup1(struct proc *p)
-{
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
-  }
+  if(npollent)
+    pollwakeup(chan);
 }
 
 // Kill the process with the given pid.
@@ -589,20 +1595,15 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    wake(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -652,14 +1653,14 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = allproc; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %d %s", p->pid, state, p->prio, p->name);
     printf("\n");
   }
 }
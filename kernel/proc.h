@@ -1,3 +1,5 @@
+#include "rusage.h"  // struct rusage, in struct proc
+
 // Saved registers for kernel context switches.
 struct context {
   uint64 ra;
@@ -24,6 +26,11 @@ struct cpu {
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this TLB was last flushed for
+  int idle;                   // In clockidle(), not taking ticks
+  uint lasttick;              // ticks at its last timer interrupt
+  uint kstackgen;             // kstackgen when it last flushed its TLB
+  uint64 profnext;            // r_time() of its next profiler sample
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +87,59 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// a region created by mmap(), see mmap.c.
+struct vma {
+  uint64 addr;                 // start, page-aligned
+  uint64 len;                  // bytes, page-aligned; 0 if unused
+  int prot;                    // PROT_*
+  int flags;                   // MAP_*
+  struct file *f;              // mapped file, or 0 if anonymous
+  uint64 off;                  // file offset of addr
+};
+
+// An ELF segment that an mm's pages fault in from its executable.
+struct seg {
+  uint64 va;                   // start, page-aligned
+  uint64 filesz;               // bytes read from the file; 0 if unused
+  uint off;                    // file offset of va
+};
+
+// An address space, shared by the threads clone() makes.
+// Each thread's trapframe is mapped at its own TFSLOT().
+struct mm {
+  struct spinlock lock;        // protects the page table's mappings, sz, vma
+  int ref;                     // procs using it; mmtable.lock protects it
+  uint tfslots;                // TFSLOT()s in use; ditto
+  pagetable_t pagetable;       // Page table
+  uint64 sz;                   // Size of process memory (bytes)
+  uint64 asid;                 // (generation << 16) | ASID, see uvmsatp()
+  uint64 tlbcpus;              // CPUs that may cache its TLB entries
+  uint64 tlbstale;             // CPUs that must flush them before running it
+  uint64 tlbgen;               // count of tlbinval()s, see tlbsync()
+  struct vma vma[NVMA];        // mmap() regions
+  struct inode *ip;            // Executable, if pages still fault in from it
+  struct seg seg[NSEG];        // and its segments
+  struct vproc *vproc;         // Its VPROC page
+  struct mm *next;             // On mmtable's free list
+};
+
+// Open files and current directory, shared by the threads
+// clone() makes, as their mm is. While only one proc uses it,
+// that proc may read them without the lock.
+struct files {
+  struct spinlock lock;        // protects ref, ofile, nofile and cwd
+  int ref;                     // procs using it
+  struct file **ofile;         // Open files: ofile0, or a page once it grows
+  int nofile;                  // Room in ofile
+  struct file *ofile0[NOFILE];
+  struct inode *cwd;           // Current directory
+  struct files *next;          // On filestable's free list; its lock protects it
+};
+
+// fdget()'s references to files that another thread might
+// close, dropped as each system call returns.
+#define NFDHELD 3
+
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -88,19 +148,53 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
+  int pinned;                  // If non-zero, swapout() is using its page table
+  int onrq;                    // On a run queue (set by makerunnable())
+  int cpu;                     // CPU it last ran on, or -1
+  int prio;                    // Current priority level, 0 highest
+  int baseprio;                // Best level prio may rise to (setpriority())
+  uint rqtime;                 // ticks when it was last queued
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  struct proc *children;       // Its children, linked by sibling
+  struct proc *sibling;        // Next child of the same parent
+
   // these are private to the process, so p->lock need not be held.
+  struct proc *allnext;        // Next in allproc; set once
+  struct proc *freenext;       // Next UNUSED proc; ptable.lock protects it
+  struct proc *pidnext;        // Pid hash chain link; pid_lock protects it
+  struct proc *rqnext;         // Run queue link; its runq lock protects it
+  int slice;                   // Timer ticks left in its quantum
+  struct proc *sqnext;         // Sleep queue link; its sleepq lock protects it
+  int onsq;                    // On chan's sleep queue; ditto
+  int pollev;                  // poll() should look again; polltab.lock protects it
+  uint64 wakeat;               // clocksleep() deadline; timers.lock protects it
+  int tslot;                   // its index in the timer heap, or 0; ditto
   uint64 kstack;               // Bottom of kernel stack for this process
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // Page table
+  struct mm *mm;               // Address space
+  pagetable_t pagetable;       // mm->pagetable, for short
   struct trapframe *tf;        // data page for trampoline.S
+  uint64 tfva;                 // where tf is mapped in user space
+  uint64 tlbseen;              // mm->tlbgen when it last entered user space
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and current directory
+  struct file *fdheld[NFDHELD]; // see fdget()
+  int nfdheld;
+  int logres[NDISK];           // Log blocks reserved by begin_op(), per disk
+  void (*kfn)(uint64);         // If non-zero, a kernel thread running kfn(karg)
+  uint64 karg;
   char name[16];               // Process name (debugging)
+
+  // resource usage, private to the process like the above,
+  // with ru.utime in timer cycles and ru.stime unused.
+  struct rusage ru;
+  uint64 ustart;               // r_time() when it last returned to user space
+  uint64 oncpu;                // timer cycles it has run, in all
+  uint64 runstart;             // r_time() when scheduler() last ran it
+  struct rusage cru;           // reaped children's, in timer cycles
 };
@@ -0,0 +1,158 @@
+//
+// Sampling profiler. While it's on, each busy CPU's timer
+// interrupt records where it interrupted into that CPU's ring
+// of samples, and clockarm() asks for an interrupt at least
+// every PROFCYCLES. prof(PROF_READ) drains the rings. A full
+// ring drops new samples, and counts them.
+//
+// Idle CPUs don't take profiling interrupts, so samples only
+// say where busy CPUs spent their time.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMP 2048  // samples per CPU: 2 seconds' worth
+
+struct profbuf {
+  struct spinlock lock;
+  struct profsample *s;  // NPROFSAMP of them
+  uint head, tail;       // s[tail..head), mod NPROFSAMP, unread
+  uint ndrop;
+};
+
+struct {
+  struct sleeplock lock;  // serializes prof() calls
+  struct profbuf buf[NCPU];
+} prof;
+
+int profiling;
+
+void
+profinit(void)
+{
+  int i;
+
+  initsleeplock(&prof.lock, "prof");
+  for(i = 0; i < NCPU; i++)
+    initlock(&prof.buf[i].lock, "profbuf");
+}
+
+// Called by devintr() for a timer interrupt while profiling,
+// with sepc and sstatus still describing what it interrupted.
+void
+profsample(void)
+{
+  struct cpu *c = mycpu();
+  struct profbuf *b = &prof.buf[cpuid()];
+  struct proc *p = c->proc;
+  struct profsample *s;
+  uint64 now = r_time();
+
+  if(now < c->profnext)
+    return;  // an interrupt for a tick or a sleeper, not a sample
+  c->profnext = now + PROFCYCLES;
+
+  acquire(&b->lock);
+  if(b->s == 0){
+    // not started yet
+  } else if(b->head - b->tail == NPROFSAMP){
+    b->ndrop++;
+  } else {
+    s = &b->s[b->head++ % NPROFSAMP];
+    s->pc = r_sepc();
+    s->user = (r_sstatus() & SSTATUS_SPP) == 0;
+    s->pid = p ? p->pid : 0;
+    if(p)
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    else
+      safestrcpy(s->name, "scheduler", sizeof(s->name));
+  }
+  release(&b->lock);
+}
+
+static int
+profstart(void)
+{
+  struct profbuf *b;
+
+  for(b = prof.buf; b < &prof.buf[NCPU]; b++){
+    if(b->s == 0 && (b->s = bd_malloc(NPROFSAMP * sizeof(*b->s))) == 0)
+      return -1;
+    acquire(&b->lock);
+    b->head = b->tail = 0;
+    b->ndrop = 0;
+    release(&b->lock);
+  }
+  profiling = 1;
+  return 0;
+}
+
+// Copy up to n unread samples to user address addr, a
+// page's worth at a time, since copyout() can't be done
+// holding a spinlock. Returns the number copied.
+static int
+profread(uint64 addr, int n)
+{
+  struct profbuf *b;
+  struct profsample *page;
+  int m, got = 0;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  for(b = prof.buf; b < &prof.buf[NCPU] && got < n; ){
+    acquire(&b->lock);
+    for(m = 0; m < PGSIZE/sizeof(*page) && got + m < n && b->tail != b->head; m++)
+      page[m] = b->s[b->tail++ % NPROFSAMP];
+    release(&b->lock);
+    if(m == 0){
+      b++;
+      continue;
+    }
+    if(copyout(myproc()->pagetable, addr + got*sizeof(*page), (char*)page, m*sizeof(*page)) < 0){
+      got = -1;
+      break;
+    }
+    got += m;
+  }
+  kfree(page);
+  return got;
+}
+
+// prof(op, buf, n): see prof.h.
+uint64
+sys_prof(void)
+{
+  uint64 addr;
+  int op, n, i, r = 0;
+
+  if(argint(0, &op) < 0 || argaddr(1, &addr) < 0 || argint(2, &n) < 0)
+    return -1;
+  acquiresleep(&prof.lock);
+  switch(op){
+  case PROF_START:
+    r = profstart();
+    break;
+  case PROF_STOP:
+    profiling = 0;
+    break;
+  case PROF_READ:
+    r = n < 0 ? -1 : profread(addr, n);
+    break;
+  case PROF_DROP:
+    for(i = 0; i < NCPU; i++)
+      r += prof.buf[i].ndrop;
+    break;
+  default:
+    r = -1;
+  }
+  releasesleep(&prof.lock);
+  return r;
+}
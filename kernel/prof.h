@@ -0,0 +1,16 @@
+// Profiler samples, returned by the prof() system call.
+// While profiling is on, each busy CPU records one sample
+// every PROFCYCLES timer cycles (see param.h).
+
+// prof(op, buf, n) operations
+#define PROF_START 0   // forget old samples and start sampling
+#define PROF_STOP  1   // stop; unread samples stay readable
+#define PROF_READ  2   // copy up to n unread samples to buf
+#define PROF_DROP  3   // how many samples full buffers lost
+
+struct profsample {
+  uint64 pc;         // sepc when the timer interrupted
+  int pid;           // process running, or 0 in the scheduler
+  int user;          // pc is a user address of pid
+  char name[16];     // pid's name then
+};
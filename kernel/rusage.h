@@ -0,0 +1,13 @@
+// Resource usage, from getrusage().
+#define RUSAGE_SELF      0   // the calling process
+#define RUSAGE_CHILDREN (-1) // its children that wait() has reaped
+
+struct rusage {
+  uint64 utime;    // time in user space, in microseconds
+  uint64 stime;    // time in the kernel, in microseconds
+  uint64 nvcsw;    // voluntary context switches (sleeps)
+  uint64 nivcsw;   // involuntary ones (preemptions)
+  uint64 nfault;   // page faults from user space
+  uint64 inblock;  // disk blocks read
+  uint64 oublock;  // disk blocks written
+};
@@ -0,0 +1,130 @@
+//
+// Shared memory segments. shmget(key, size) returns a file
+// descriptor for a segment, and mmap(MAP_SHARED) of it maps the
+// segment's own pages, so every process that maps it sees the
+// same memory, with no system calls to exchange data. Key 0
+// makes a new, unnamed segment, to pass on through fork();
+// other keys name segments that unrelated processes can share.
+//
+// Pages are allocated, zeroed, on first touch. A segment holds
+// a reference to each of its pages and every mapping another,
+// so exit(), munmap() and uvmfree() just drop theirs. The
+// segment itself goes when the last file referring to it is
+// closed; mappings hold their files open.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+#define NSHM 32                      // segments in the system
+#define SHMMAXPG (PGSIZE/sizeof(char*))  // pages in a segment
+
+struct shm {
+  int ref;          // files referring to it; shmtable.lock
+  int key;
+  uint npages;
+  char **page;      // a page of npages pointers, 0 until touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Find the segment named key, or make a new one of size
+// bytes, and return it with a reference. Returns 0 if there
+// is no room, or key's segment is smaller than size.
+struct shm*
+shmget(int key, uint64 size)
+{
+  struct shm *s, *free = 0;
+  char **page;
+
+  if(size == 0 || size > SHMMAXPG * PGSIZE)
+    return 0;
+  if((page = kalloc_zeroed()) == 0)
+    return 0;
+  acquire(&shmtable.lock);
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->ref == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key){
+      if(size > s->npages * PGSIZE)
+        s = 0;
+      else
+        s->ref++;
+      release(&shmtable.lock);
+      kfree(page);
+      return s;
+    }
+  }
+  if((s = free) != 0){
+    s->ref = 1;
+    s->key = key;
+    s->npages = PGROUNDUP(size) / PGSIZE;
+    s->page = page;
+    page = 0;
+  }
+  release(&shmtable.lock);
+  if(page)
+    kfree(page);
+  return s;
+}
+
+// Drop a reference to s, freeing it and the pages that no
+// mapping still has if it was the last.
+void
+shmput(struct shm *s)
+{
+  uint i, n;
+  char **page;
+
+  acquire(&shmtable.lock);
+  if(--s->ref > 0){
+    release(&shmtable.lock);
+    return;
+  }
+  // the slot is free for shmget() once the lock goes.
+  page = s->page;
+  n = s->npages;
+  s->page = 0;
+  release(&shmtable.lock);
+  for(i = 0; i < n; i++)
+    if(page[i])
+      kfree(page[i]);
+  kfree(page);
+}
+
+// Size of s in bytes.
+uint64
+shmsize(struct shm *s)
+{
+  return (uint64)s->npages * PGSIZE;
+}
+
+// Return page i of s, with a reference for the caller to
+// map, or 0 if out of memory.
+char*
+shmpage(struct shm *s, uint i)
+{
+  char *pa;
+
+  acquire(&shmtable.lock);
+  if(s->page[i] == 0)
+    s->page[i] = kalloc_zeroed();
+  if((pa = s->page[i]) != 0)
+    kaddref(pa);
+  release(&shmtable.lock);
+  return pa;
+}
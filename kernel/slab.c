@@ -0,0 +1,207 @@
+// Slab allocator for small, fixed-size kernel objects.
+//
+// Each object type gets its own cache (kmem_cache_create()).
+// A cache carves whole pages from kalloc() into equal-sized
+// objects; each page ("slab") starts with a small header and
+// keeps its own list of free objects. Slabs with at least one
+// free object sit on the cache's partial list; a slab whose
+// objects are all free again goes back to kalloc().
+//
+// In front of the slabs, each CPU has a small stack of free
+// objects per cache, used with interrupts off and no lock, so
+// the common alloc/free path touches no shared state. The
+// per-CPU stacks are refilled from, and drained to, the slabs
+// in batches under the cache's lock.
+//
+// An optional constructor runs once, when an object is first
+// carved out of a new slab; objects must be freed back in
+// their constructed state (e.g. with their locks initialized).
+// A free object is linked into its slab's list through its
+// first word, or, if the cache has a constructor, through a
+// word just past the object, so the constructed state stays
+// intact.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE  16   // max number of object caches
+#define NMAG    16   // objects in each per-CPU stack
+#define NMOVE   (NMAG/2)
+
+struct object {
+  void *next;                  // the next free object
+};
+
+// header at the start of each slab page.
+struct slab {
+  struct list link;            // on cache's partial list; must be first
+  struct kmem_cache *cache;
+  void *free;                  // free objects in this slab
+  int inuse;                   // allocated objects (incl. per-CPU stacks)
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;                   // object size, rounded up
+  uint link;                   // offset of a free object's struct object
+  int perslab;                 // objects per slab
+  void (*ctor)(void*);
+  struct list partial;         // slabs with free objects
+  struct {
+    void *obj[NMAG];
+    int n;
+  } cpu[NCPU];
+};
+
+static struct kmem_cache caches[NCACHE];
+static int ncaches;
+static struct spinlock cachelock;
+
+#define ROUNDUP(n,sz) (((((n)-1)/(sz))+1)*(sz))
+#define SLABHDR       ROUNDUP(sizeof(struct slab), 16)
+#define OBJ0(s)       ((char*)(s) + SLABHDR)  // first object in slab s
+#define LINK(c, o)    ((struct object*)((char*)(o) + (c)->link))
+
+void
+slabinit(void)
+{
+  initlock(&cachelock, "slab");
+}
+
+// Create a cache of objects of the given size.
+// ctor, if non-zero, initializes each newly carved object.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+  uint link = 0;
+
+  if(ctor){
+    link = ROUNDUP(size, sizeof(struct object));
+    size = link + sizeof(struct object);
+  }
+  size = ROUNDUP(size < sizeof(struct object) ? sizeof(struct object) : size, 16);
+  if(SLABHDR + size > PGSIZE)
+    panic("kmem_cache_create: object too big");
+
+  acquire(&cachelock);
+  if(ncaches >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &caches[ncaches++];
+  release(&cachelock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->link = link;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->ctor = ctor;
+  lst_init(&c->partial);
+  for(int i = 0; i < NCPU; i++)
+    c->cpu[i].n = 0;
+  return c;
+}
+
+// Allocate a page and carve it into free objects.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  o = OBJ0(s) + (c->perslab - 1) * c->size;
+  for(int i = 0; i < c->perslab; i++, o -= c->size){
+    if(c->ctor)
+      c->ctor(o);
+    LINK(c, o)->next = s->free;
+    s->free = o;
+  }
+  lst_push(&c->partial, s);
+  return s;
+}
+
+// Return object o to its slab. Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *o)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)o);
+
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    lst_push(&c->partial, s);   // was full
+  LINK(c, o)->next = s->free;
+  s->free = o;
+  if(--s->inuse == 0){
+    lst_remove(&s->link);
+    kfree(s);
+  }
+}
+
+// Move up to NMOVE objects from the slabs to this CPU's stack.
+// Caller must hold c->lock, with interrupts off.
+static void
+slab_refill(struct kmem_cache *c, int id)
+{
+  struct slab *s;
+  void *o;
+
+  while(c->cpu[id].n < NMOVE){
+    if(lst_empty(&c->partial) && slab_grow(c) == 0)
+      break;
+    s = (struct slab*)c->partial.next;
+    o = s->free;
+    s->free = LINK(c, o)->next;
+    s->inuse++;
+    if(s->free == 0)
+      lst_remove(&s->link);     // now full
+    c->cpu[id].obj[c->cpu[id].n++] = o;
+  }
+}
+
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *o = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == 0){
+    acquire(&c->lock);
+    slab_refill(c, id);
+    release(&c->lock);
+  }
+  if(c->cpu[id].n > 0)
+    o = c->cpu[id].obj[--c->cpu[id].n];
+  pop_off();
+  return o;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == NMAG){
+    acquire(&c->lock);
+    while(c->cpu[id].n > NMAG - NMOVE)
+      slab_put(c, c->cpu[id].obj[--c->cpu[id].n]);
+    release(&c->lock);
+  }
+  c->cpu[id].obj[c->cpu[id].n++] = o;
+  pop_off();
+}
@@ -9,6 +9,12 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// How long acquiresleep() spins, in r_time() cycles, while the
+// holder is running on another CPU, before it goes to sleep.
+// Most holders of buffer and inode locks are only computing,
+// and let go sooner than a sleep and wakeup would take.
+#define SPINTIME 200  // 20us
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -16,17 +22,64 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass(name, 1);
+#else
+  lk->class = 0;
+#endif
+}
+
+// Is the holder of lk, o, running, so that it will likely
+// let go soon? Procs are never freed, so o is safe to look at
+// without its lock; the answer only decides whether to spin.
+static int
+ownerrunning(struct sleeplock *lk, struct proc *o)
+{
+  return __atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+         __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == o &&
+         __atomic_load_n(&o->state, __ATOMIC_RELAXED) == RUNNING;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0 = 0, spinend = 0;
+  struct proc *o;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    if(t0 == 0){
+      t0 = r_time();
+      spinend = t0 + SPINTIME;
+    }
+    o = lk->owner;
+    if(o && o->state == RUNNING && r_time() < spinend){
+      // spin without lk->lk, so the holder can release.
+      release(&lk->lk);
+      while(ownerrunning(lk, o) && r_time() < spinend)
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nwait++;
     sleep(lk, &lk->lk);
+    lk->nwait--;
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  if(lk->class){
+    lk->t0 = r_time();
+    __sync_fetch_and_add(&lk->class->nacquire, 1);
+    if(t0){
+      __sync_fetch_and_add(&lk->class->ncontend, 1);
+      __sync_fetch_and_add(&lk->class->wait, lk->t0 - t0);
+    }
+  }
+#endif
   release(&lk->lk);
 }
 
@@ -34,9 +87,15 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  if(lk->class)
+    lockheld(lk->class, lk->t0);
+#endif
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if(lk->nwait > 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -3,8 +3,13 @@ struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
   
+  struct proc *owner; // Process holding lock, for acquiresleep()'s spin
+  int nwait;         // Processes asleep waiting for it
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct lockclass *class;  // Statistics for its name, or 0
+  uint64 t0;         // r_time() when acquired, for class
 };
 
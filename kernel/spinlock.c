@@ -7,15 +7,77 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
 
+// times any acquire() found its lock still held.
 uint64 ntest_and_set;
 
+// delay-loop iterations a waiter lets pass, per holder
+// ahead of it, before it looks at the lock again.
+#define BACKOFF 32
+
+#ifdef LOCKSTAT
+// One class per lock name and kind, found by lockclass() when
+// a lock is initialized. Entries are only ever added; busy
+// serializes that, without being a spinlock itself.
+static struct {
+  uint busy;
+  struct lockclass class[NLOCKSTAT];
+} lockclasses;
+
+// Return the class for locks called name, of sleep locks
+// if sleep is set, making it if need be; 0 if there's no room.
+struct lockclass*
+lockclass(char *name, int sleep)
+{
+  struct lockclass *c;
+
+  push_off();
+  while(__sync_lock_test_and_set(&lockclasses.busy, 1) != 0)
+    ;
+  for(c = lockclasses.class; c < &lockclasses.class[NLOCKSTAT]; c++){
+    if(c->name == 0){
+      c->name = name;
+      c->sleep = sleep;
+      break;
+    }
+    if(c->sleep == sleep && strncmp(c->name, name, 16) == 0)
+      break;
+  }
+  if(c == &lockclasses.class[NLOCKSTAT])
+    c = 0;
+  else
+    c->nlocks++;
+  __sync_lock_release(&lockclasses.busy);
+  pop_off();
+  return c;
+}
+
+// Record that a lock of class c was held since t0.
+void
+lockheld(struct lockclass *c, uint64 t0)
+{
+  uint64 t = r_time() - t0, max;
+
+  while(t > (max = c->maxhold))
+    if(__sync_bool_compare_and_swap(&c->maxhold, max, t))
+      break;
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->nspin = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass(name, 0);
+#else
+  lk->class = 0;
+#endif
 }
 
 // Acquire the lock.
@@ -23,16 +85,34 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint t, ahead;
+#ifdef LOCKSTAT
+  uint64 t0 = 0;
+#endif
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-     __sync_fetch_and_add(&ntest_and_set, 1);
+  // Take a ticket. On RISC-V, sync_fetch_and_add turns into
+  //   amoadd.w t, 1, (&lk->next)
+  // so waiters write the lock's cache line once each, not
+  // once per spin, and are served first come, first served.
+  t = __sync_fetch_and_add(&lk->next, 1);
+
+  // Wait for our turn, only reading owner, and for longer
+  // the more holders there are ahead of us: each keeps the
+  // lock for about as long, and polling sooner would just
+  // take the line away from the holder.
+  while((ahead = t - __atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE)) != 0){
+#ifdef LOCKSTAT
+    if(t0 == 0)
+      t0 = r_time();
+#endif
+    __sync_fetch_and_add(&ntest_and_set, 1);
+    __sync_fetch_and_add(&lk->nspin, 1);
+    for(uint i = ahead * BACKOFF; i > 0; i--)
+      asm volatile("nop");
   }
   
   // Tell the C compiler and the processor to not move loads or stores
@@ -42,6 +122,17 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+#ifdef LOCKSTAT
+  if(lk->class){
+    lk->t0 = r_time();
+    __sync_fetch_and_add(&lk->class->nacquire, 1);
+    if(t0){
+      __sync_fetch_and_add(&lk->class->ncontend, 1);
+      __sync_fetch_and_add(&lk->class->wait, lk->t0 - t0);
+    }
+  }
+#endif
 }
 
 // Release the lock.
@@ -52,6 +143,10 @@ release(struct spinlock *lk)
     panic("release");
 
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  if(lk->class)
+    lockheld(lk->class, lk->t0);
+#endif
 
   // Tell the C compiler and the CPU to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,14 +154,10 @@ release(struct spinlock *lk)
   // On RISC-V, this turns into a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock by serving the next ticket. Only the
+  // holder writes owner, so a plain increment will do, stored
+  // in one go as an atomic store is.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
 
   pop_off();
 }
@@ -77,7 +168,7 @@ holding(struct spinlock *lk)
 {
   int r;
   push_off();
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
   pop_off();
   return r;
 }
@@ -115,3 +206,41 @@ sys_ntas(void)
 {
   return ntest_and_set;
 }
+
+// lockstat(buf, n): copy up to n entries of lock statistics,
+// as struct lockstat, to buf. Returns the number copied, or -1
+// if the kernel was built without LOCKSTAT.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+#ifdef LOCKSTAT
+  int i = 0;
+  struct lockclass *c;
+  struct lockstat st;
+#endif
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+#ifdef LOCKSTAT
+  for(c = lockclasses.class; c < &lockclasses.class[NLOCKSTAT] && i < n; c++){
+    if(c->name == 0)
+      break;
+    memset(&st, 0, sizeof(st));
+    safestrcpy(st.name, c->name, sizeof(st.name));
+    st.sleep = c->sleep;
+    st.nlocks = c->nlocks;
+    st.nacquire = c->nacquire;
+    st.ncontend = c->ncontend;
+    st.wait = c->wait;
+    st.maxhold = c->maxhold;
+    if(copyout(myproc()->pagetable, addr + i*sizeof(st), (char*)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+#else
+  return -1;
+#endif
+}
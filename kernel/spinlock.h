@@ -1,9 +1,26 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock, so waiters get it
+// in the order they asked. It's held when owner != next.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket of the holder, or next if none
+  uint64 nspin;      // times acquire() found it still held
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  struct lockclass *class;  // Statistics for its name, or 0
+  uint64 t0;         // r_time() when acquired, for class
+};
+
+// Statistics for all locks of one name and kind (see
+// lockstat() in spinlock.c), updated atomically.
+struct lockclass {
+  char *name;        // 0 if this entry is free
+  int sleep;         // for sleeplocks?
+  int nlocks;
+  uint64 nacquire;
+  uint64 ncontend;
+  uint64 wait;
+  uint64 maxhold;
 };
 
@@ -9,3 +9,11 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// getdents() fills in one of these per directory entry.
+#define GD_STAT   1   // flag: fill in st too, as stat() of the name would
+
+struct dent {
+  struct stat st;  // with GD_STAT; otherwise only st.ino is set
+  char name[16];   // NUL-terminated; at most DIRSIZ (14) long
+};
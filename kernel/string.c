@@ -1,13 +1,42 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() zero and copy pages and
+// blocks, so they work a 64-bit word at a time, four words
+// per iteration, with bytes only for an unaligned head and
+// tail. memcmp() and memmove() only use words when both
+// pointers are equally aligned, as they nearly always are;
+// otherwise they stay a byte at a time.
+
+#define WSIZE       sizeof(uint64)
+#define ALIGNED(p)  (((uint64)(p) & (WSIZE-1)) == 0)
+#define COALIGNED(p, q)  ((((uint64)(p) ^ (uint64)(q)) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = (char *) dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && !ALIGNED(d); n--)
+    *d++ = c;
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64*)d;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (char*)wd;
   }
+  for(; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +47,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(COALIGNED(s1, s2)){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes below find which differs.
+    for(; n >= WSIZE && *(uint64*)s1 == *(uint64*)s2; n -= WSIZE){
+      s1 += WSIZE;
+      s2 += WSIZE;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,17 +71,52 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd, w0, w1, w2, w3;
 
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // dst overlaps the end of src: copy backwards. Each
+    // group of words is loaded before any is stored.
     s += n;
     d += n;
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        ws -= 4;
+        wd -= 4;
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, ws += 4, wd += 4){
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -0,0 +1,305 @@
+//
+// Page reclaim and swap, on the second virtio disk.
+//
+// The swap area is the NSWAP pages after disk 1's file system.
+// When a user-memory allocation fails, the caller runs
+// swapout(). That first shrinks the block cache; once the
+// cache is at its minimum size, it sweeps a clock hand over
+// every process's pages below p->sz. A page the hardware has
+// marked accessed (PTE_A) since the last sweep gets its bit
+// cleared and a second chance; a cold one is written to a free
+// swap slot and freed.
+// Its PTE keeps the page's permissions but becomes invalid, with
+// PTE_SWAP set and the slot number in place of the PPN.
+// uvmfault() calls swapin() when a process touches such a page.
+//
+// Only pages with one reference are taken, so copy-on-write and
+// MAP_SHARED memory stays resident. A process whose pages are
+// being taken is pinned: the scheduler won't run it until
+// swapout() is done with it, so nobody else can use or change
+// its page table meanwhile.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define SWAPDISK   1                 // virtio disk holding the swap area
+#define SWAPSTART  FSSIZE            // first block of the swap area
+#define SWAPBATCH  8                 // pages swapout() tries to free
+#define BPP        (PGSIZE / BSIZE)  // blocks per page
+
+#define PTE2SLOT(pte) ((pte) >> 10)
+#define SLOT2PTE(s)   (((uint64)(s)) << 10)
+
+extern struct proc *allproc;
+extern int nproc;
+
+struct {
+  struct spinlock lock;   // protects ref[] and the counters
+  uchar ref[NSWAP];       // PTEs referring to each slot
+  int nused;              // slots in use
+  uint64 nout;            // pages written out
+  uint64 nin;             // pages read back in
+
+  // swapout() and swapin() hold iolock while they use bufs,
+  // and swapout() also while it moves the clock hand.
+  struct sleeplock iolock;
+  struct buf bufs[BPP];
+  struct proc *hand;      // the proc the clock hand is at, or 0
+  uint64 handva;          // and the address within it
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  virtio_disk_init(SWAPDISK);
+}
+
+// Allocate a swap slot, or return -1 if there are none.
+static int
+slotalloc(void)
+{
+  int s;
+
+  acquire(&swap.lock);
+  for(s = 0; s < NSWAP; s++){
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Drop the reference of swap PTE pte to its slot,
+// for uvmunmap() and swapin().
+void
+swapdrop(pte_t pte)
+{
+  int s = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(s >= NSWAP || swap.ref[s] == 0)
+    panic("swapdrop");
+  if(--swap.ref[s] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Add a reference to the slot of swap PTE pte,
+// for fork() copying it to the child's page table.
+void
+swapdup(pte_t pte)
+{
+  int s = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(s >= NSWAP || swap.ref[s] == 0 || swap.ref[s] == 0xff)
+    panic("swapdup");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Read or write the page at pa from or to slot s, with one
+// disk request straight to or from the page.
+// Caller holds swap.iolock.
+static void
+slotrw(int s, uint64 pa, int write)
+{
+  for(int i = 0; i < BPP; i++){
+    swap.bufs[i].blockno = SWAPSTART + s*BPP + i;
+    swap.bufs[i].udata = (uchar*)pa + i*BSIZE;
+    swap.bufs[i].qnext = i+1 < BPP ? &swap.bufs[i+1] : 0;
+  }
+  virtio_disk_rw(SWAPDISK, &swap.bufs[0], write);
+  for(int i = 0; i < BPP; i++)
+    swap.bufs[i].udata = 0;
+}
+
+// Keep the scheduler off p while swapout() works on its page
+// table. Returns 0 if p has no page table to take pages from,
+// or is running elsewhere. The current process needs no pin.
+static int
+pin(struct proc *p)
+{
+  int ok;
+
+  if(p == myproc())
+    return 1;
+  acquire(&p->lock);
+  ok = p->state == SLEEPING || p->state == RUNNABLE;
+  if(ok)
+    p->pinned = 1;
+  release(&p->lock);
+  return ok;
+}
+
+static void
+unpin(struct proc *p)
+{
+  if(p == myproc())
+    return;
+  acquire(&p->lock);
+  p->pinned = 0;
+  if(p->state == RUNNABLE)
+    makerunnable(p);  // the scheduler dropped it meanwhile
+  release(&p->lock);
+}
+
+// p's PTE for va changed; make sure no TLB keeps the old one.
+// p is either the current process or pinned, not running.
+static void
+inval(struct proc *p, uint64 va)
+{
+  tlbinval(p->pagetable, va, 1);
+}
+
+// Move the clock hand over p's pages, from swap.handva up,
+// until want pages are freed. Returns the number freed, or
+// -1 if the swap area is full. Skips the pages of threads,
+// since pinning p wouldn't keep the others off them.
+static int
+swapscan(struct proc *p, int want)
+{
+  uint64 va, pa;
+  pte_t *pte;
+  int s, n = 0;
+
+  if(p->mm == 0 || p->mm->ref > 1)
+    return 0;
+  for(va = swap.handva; va < p->mm->sz && n < want; va += PGSIZE){
+    if((pte = walk(p->pagetable, va, 0)) == 0){
+      // no level-0 page-table page; skip all of its range.
+      va |= (uint64)PXMASK << PGSHIFT;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    pa = PTE2PA(*pte);
+    if(krefcnt((void*)pa) != 1)
+      continue;
+    if(*pte & PTE_A){
+      // used since the last sweep; give it another chance.
+      *pte &= ~PTE_A;
+      inval(p, va);
+      continue;
+    }
+    if((s = slotalloc()) < 0){
+      swap.handva = va;
+      return n > 0 ? n : -1;
+    }
+    slotrw(s, pa, 1);
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+    inval(p, va);
+    kfree((void*)pa);
+    n++;
+  }
+  swap.handva = va;
+  return n;
+}
+
+// Free some memory: block cache buffers if there are spare
+// ones, or else cold user pages, written to swap.
+// Returns the number of buffers or pages freed; if 0,
+// allocations should fail as they would without swap.
+// Must be called by a process holding no spinlocks.
+int
+swapout(void)
+{
+  struct proc *p;
+  int i, n, freed = 0;
+
+  if(!intr_get())
+    return 0;  // holding a spinlock: can't sleep
+  // shrink the block and inode caches first; they're only caches.
+  if((n = bshrink(3*SWAPBATCH) + ishrink(8*SWAPBATCH) + textshrink(SWAPBATCH)) > 0)
+    return n;
+  acquiresleep(&swap.iolock);
+  // two trips around the clock: the first may only
+  // clear accessed bits.
+  for(i = 0; i < 2*nproc && freed < SWAPBATCH; i++){
+    if(swap.hand == 0)
+      swap.hand = allproc;
+    p = swap.hand;
+    if(pin(p)){
+      n = swapscan(p, SWAPBATCH - freed);
+      unpin(p);
+      if(n < 0)
+        break;  // swap is full
+      freed += n;
+      if(freed >= SWAPBATCH)
+        break;  // the hand stays put for next time
+    }
+    swap.hand = p->allnext;
+    swap.handva = 0;
+  }
+  releasesleep(&swap.iolock);
+
+  acquire(&swap.lock);
+  swap.nout += freed;
+  release(&swap.lock);
+  return freed;
+}
+
+// Read the swapped-out page of *pte back into memory.
+// pte belongs to the current process's page table.
+// Returns 0 if the access can be retried, -1 if not.
+int
+swapin(pte_t *pte)
+{
+  struct mm *mm = myproc()->mm;
+  pte_t old = *pte;
+  char *mem;
+
+  if(!intr_get())
+    return -1;  // holding a spinlock: can't sleep
+  if((mem = kalloc()) == 0)
+    return swapout() > 0 ? 0 : -1;
+
+  acquiresleep(&swap.iolock);
+  slotrw(PTE2SLOT(old), (uint64)mem, 0);
+  releasesleep(&swap.iolock);
+
+  // swapout() doesn't touch invalid PTEs, but another
+  // thread may have read it in, or unmapped it, meanwhile.
+  acquire(&mm->lock);
+  if(*pte != old){
+    release(&mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V;
+  release(&mm->lock);
+  swapdrop(old);
+
+  acquire(&swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  return 0;
+}
+
+// Fill in swap's part of st, for memstat().
+void
+swapstat(struct memstat *st)
+{
+  acquire(&swap.lock);
+  st->swapsize = NSWAP;
+  st->swapused = swap.nused;
+  st->swapout = swap.nout;
+  st->swapin = swap.nin;
+  release(&swap.lock);
+}
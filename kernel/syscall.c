@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "trace.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -12,7 +13,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -107,6 +108,33 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_ntas(void);
 extern uint64 sys_crash(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_umount(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_bcachesize(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_diskmode(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_usleep(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_prof(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_dmesg(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_getdents(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +160,33 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_ntas]    sys_ntas,
 [SYS_crash]   sys_crash,
+[SYS_mount]   sys_mount,
+[SYS_umount]  sys_umount,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_memstat] sys_memstat,
+[SYS_bcachesize] sys_bcachesize,
+[SYS_logstat] sys_logstat,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_sendfile] sys_sendfile,
+[SYS_diskmode] sys_diskmode,
+[SYS_iostat]  sys_iostat,
+[SYS_setpriority] sys_setpriority,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_usleep]  sys_usleep,
+[SYS_spawn]   sys_spawn,
+[SYS_lockstat] sys_lockstat,
+[SYS_prof]    sys_prof,
+[SYS_shmget]  sys_shmget,
+[SYS_poll]    sys_poll,
+[SYS_futex]   sys_futex,
+[SYS_dmesg]   sys_dmesg,
+[SYS_getrusage] sys_getrusage,
+[SYS_getdents] sys_getdents,
 };
 
 void
@@ -139,10 +194,21 @@ syscall(void)
 {
   int num;
   struct proc *p = myproc();
+  uint64 t0 = 0, a0 = 0, a1 = 0, a2 = 0;
 
   num = p->tf->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    if(tracing){
+      t0 = r_time();
+      a0 = p->tf->a0;
+      a1 = p->tf->a1;
+      a2 = p->tf->a2;
+    }
     p->tf->a0 = syscalls[num]();
+    if(p->nfdheld)
+      fdrelease();
+    if(t0)
+      traceadd(TR_SYSCALL, p->pid, num, t0, a0, a1, a2, p->tf->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
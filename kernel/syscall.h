@@ -26,3 +26,28 @@
 #define SYS_crash  23
 #define SYS_mount  24
 #define SYS_umount 25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_memstat 28
+#define SYS_bcachesize 29
+#define SYS_logstat 30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_sendfile 35
+#define SYS_diskmode 36
+#define SYS_iostat 37
+#define SYS_setpriority 38
+#define SYS_clone 39
+#define SYS_join 40
+#define SYS_usleep 41
+#define SYS_spawn 42
+#define SYS_lockstat 43
+#define SYS_prof 44
+#define SYS_shmget 45
+#define SYS_poll   46
+#define SYS_futex  47
+#define SYS_dmesg  48
+#define SYS_getrusage 49
+#define SYS_getdents 50
@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "uio.h"
+#include "iostat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +29,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -35,21 +38,43 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
+// Allocate a file descriptor for the given file, growing
+// the process's table if it's full.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct files *fs = myproc()->files;
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
+  acquire(&fs->lock);
+  for(fd = 0; fd < fs->nofile; fd++)
+    if(fs->ofile[fd] == 0)
+      break;
+  if(fd == fs->nofile && fdgrow(fs, fd + 1) < 0){
+    release(&fs->lock);
+    return -1;
   }
-  return -1;
+  fs->ofile[fd] = f;
+  release(&fs->lock);
+  return fd;
+}
+
+// Close descriptor fd, which held f, unless another thread
+// has closed it already.
+static void
+fdfree(int fd, struct file *f)
+{
+  struct files *fs = myproc()->files;
+
+  acquire(&fs->lock);
+  if(fs->ofile[fd] == f)
+    fs->ofile[fd] = 0;
+  else
+    f = 0;
+  release(&fs->lock);
+  if(f)
+    fileclose(f);
 }
 
 uint64
@@ -91,6 +116,90 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// read or write arg 2 bytes of fd arg 0 at user address
+// arg 1, at file offset arg 3, leaving the fd's offset be.
+static uint64
+prw(int write)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+  struct iovec iov;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 ||
+     argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  return write ? filewritev(f, &iov, 1, off) : filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pread(void)
+{
+  return prw(0);
+}
+
+uint64
+sys_pwrite(void)
+{
+  return prw(1);
+}
+
+// read or write fd arg 0 through the arg 2 struct iovecs
+// at user address arg 1.
+static uint64
+rwv(int write)
+{
+  struct file *f;
+  int i, niov;
+  uint64 addr, tot = 0;
+  struct iovec iov[NIOV];
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &addr) < 0 || argint(2, &niov) < 0)
+    return -1;
+  if(niov < 0 || niov > NIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, niov*sizeof(iov[0])) < 0)
+    return -1;
+  // the total must fit in the int we return.
+  for(i = 0; i < niov; i++)
+    if((tot += iov[i].len) >= 0x80000000 || iov[i].len >= 0x80000000)
+      return -1;
+  return write ? filewritev(f, iov, niov, -1) : filereadv(f, iov, niov, -1);
+}
+
+uint64
+sys_readv(void)
+{
+  return rwv(0);
+}
+
+uint64
+sys_writev(void)
+{
+  return rwv(1);
+}
+
+// send arg 3 bytes of file fd arg 1 to pipe or device fd
+// arg 0, from offset arg 2, or from fd arg 1's offset if
+// arg 2 is -1, without copying them through user memory.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0)
+    return -1;
+  if(n < 0 || off < -1)
+    return -1;
+  return filesend(out, in, off, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -99,8 +208,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
-  fileclose(f);
+  fdfree(fd, f);
   return 0;
 }
 
@@ -121,20 +229,28 @@ sys_link(void)
 {
   char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
+  int dev;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op(ROOTDEV);
-  if((ip = namei(old)) == 0){
-    end_op(ROOTDEV);
+  // look both up first, to know which disk's log to use.
+  if((ip = namei(old)) == 0)
+    return -1;
+  if((dp = nameiparent(new, name)) == 0 || dp->dev != ip->dev){
+    if(dp)
+      iput(dp);
+    iput(ip);
     return -1;
   }
+  dev = ip->dev;
 
+  begin_op(dev);
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
-    end_op(ROOTDEV);
+    iput(dp);
+    end_op(dev);
     return -1;
   }
 
@@ -142,17 +258,15 @@ sys_link(void)
   iupdate(ip);
   iunlock(ip);
 
-  if((dp = nameiparent(new, name)) == 0)
-    goto bad;
   ilock(dp);
-  if(dp->dev != ip->dev || dirlink(dp, name, ip->inum) < 0){
+  if(dirlink(dp, name, ip->inum) < 0){
     iunlockput(dp);
     goto bad;
   }
   iunlockput(dp);
   iput(ip);
 
-  end_op(ROOTDEV);
+  end_op(dev);
 
   return 0;
 
@@ -161,7 +275,7 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
-  end_op(ROOTDEV);
+  end_op(dev);
   return -1;
 }
 
@@ -172,10 +286,11 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // an indexed directory may have them anywhere.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -188,15 +303,15 @@ sys_unlink(void)
   struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
+  int dev;
 
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op(ROOTDEV);
-  if((dp = nameiparent(path, name)) == 0){
-    end_op(ROOTDEV);
+  if((dp = nameiparent(path, name)) == 0)
     return -1;
-  }
+  dev = dp->dev;
+  begin_op(dev);
 
   ilock(dp);
 
@@ -206,6 +321,11 @@ sys_unlink(void)
 
   if((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  // nor a directory something is mounted on.
+  if(ismount(ip)){
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
@@ -218,6 +338,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -228,24 +349,30 @@ sys_unlink(void)
   iupdate(ip);
   iunlockput(ip);
 
-  end_op(ROOTDEV);
+  end_op(dev);
 
   return 0;
 
 bad:
   iunlockput(dp);
-  end_op(ROOTDEV);
+  end_op(dev);
   return -1;
 }
 
+// Create path, or with type T_FILE, maybe find it. Returns it
+// locked, inside a transaction on its disk that the caller
+// must end with end_op(ip->dev); or 0, with no transaction.
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
+  int dev;
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
+  dev = dp->dev;
+  begin_op(dev);
 
   ilock(dp);
 
@@ -255,6 +382,7 @@ create(char *path, short type, short major, short minor)
     if(type == T_FILE && (ip->type == T_FILE || ip->type == T_DEVICE))
       return ip;
     iunlockput(ip);
+    end_op(dev);
     return 0;
   }
 
@@ -262,7 +390,7 @@ create(char *path, short type, short major, short minor)
     panic("create: ialloc");
 
   ilock(ip);
-  ip->major = major;
+  ip->major = type == T_DEVICE ? major : IINLINE;
   ip->minor = minor;
   ip->nlink = 1;
   iupdate(ip);
@@ -290,35 +418,32 @@ sys_open(void)
   int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
+  int n, dev;
 
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op(ROOTDEV);
-
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
-    if(ip == 0){
-      end_op(ROOTDEV);
+    if(ip == 0)
       return -1;
-    }
+    dev = ip->dev;
   } else {
-    if((ip = namei(path)) == 0){
-      end_op(ROOTDEV);
+    if((ip = namei(path)) == 0)
       return -1;
-    }
+    dev = ip->dev;
+    begin_op(dev);
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op(ROOTDEV);
+      end_op(dev);
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op(ROOTDEV);
+    end_op(dev);
     return -1;
   }
 
@@ -326,7 +451,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op(ROOTDEV);
+    end_op(dev);
     return -1;
   }
 
@@ -336,13 +461,15 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = f->rawin = f->rablk = 0;
+    f->direct = (omode & O_DIRECT) != 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   iunlock(ip);
-  end_op(ROOTDEV);
+  end_op(dev);
 
   return fd;
 }
@@ -352,14 +479,13 @@ sys_mkdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
+  int dev;
 
-  begin_op(ROOTDEV);
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op(ROOTDEV);
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0)
     return -1;
-  }
+  dev = ip->dev;
   iunlockput(ip);
-  end_op(ROOTDEV);
+  end_op(dev);
   return 0;
 }
 
@@ -368,18 +494,16 @@ sys_mknod(void)
 {
   struct inode *ip;
   char path[MAXPATH];
-  int major, minor;
+  int major, minor, dev;
 
-  begin_op(ROOTDEV);
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
-    end_op(ROOTDEV);
+     (ip = create(path, T_DEVICE, major, minor)) == 0)
     return -1;
-  }
+  dev = ip->dev;
   iunlockput(ip);
-  end_op(ROOTDEV);
+  end_op(dev);
   return 0;
 }
 
@@ -387,65 +511,170 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
   
-  begin_op(ROOTDEV);
-  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
-    end_op(ROOTDEV);
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0)
     return -1;
-  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
-    end_op(ROOTDEV);
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
-  end_op(ROOTDEV);
-  p->cwd = ip;
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  begin_op(old->dev);
+  iput(old);
+  end_op(old->dev);
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user's argument array at uargv, and its strings,
+// into argv, for exec() and spawn(). Returns 0, or -1.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      return -1;
-    }
-    if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      return -1;
-    }
+    if(i >= MAXARG)
+      goto bad;
+    if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0)
+      goto bad;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      panic("sys_exec kalloc");
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0){
-      return -1;
-    }
+      goto bad;
+    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
+      goto bad;
+  }
+  return 0;
+
+ bad:
+  freeargv(argv);
+  return -1;
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
   }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
   int ret = exec(path, argv);
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  freeargv(argv);
+
+  return ret;
+}
+
+// spawn(path, argv, fds): start a child running path, whose
+// file descriptors 0-2 are the caller's fds[0..2] (or closed
+// where fds[i] is -1), or the caller's own 0-2 if fds is 0.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufds;
+  int i, fds[3];
+  struct file *f[3];
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 || argaddr(2, &ufds) < 0)
+    return -1;
+  if(ufds && copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  for(i = 0; i < 3; i++){
+    if(ufds == 0)
+      f[i] = fdget(i);
+    else if(fds[i] == -1)
+      f[i] = 0;
+    else if((f[i] = fdget(fds[i])) == 0)
+      return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = spawn(path, argv, f);
+
+  freeargv(argv);
 
   return ret;
 }
 
+// getdents(fd, buf, n, flags): read up to n entries from
+// the directory open on fd, from its offset on, into the
+// struct dents at buf, skipping free slots, with their stat
+// if flags has GD_STAT. Returns how many, 0 at the end.
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  struct inode *ip;
+  struct dirent de[16];
+  struct dent d;
+  uint64 addr;
+  int n, flags, got, i, m, nv;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &addr) < 0 || argint(2, &n) < 0 ||
+     argint(3, &flags) < 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  ip = f->ip;
+  for(got = 0; got < n; ){
+    // a chunk of entries, read with ip locked ...
+    ilock(ip);
+    if(ip->type != T_DIR){
+      iunlock(ip);
+      return -1;
+    }
+    if((m = readi(ip, 0, (uint64)de, f->off, sizeof(de))) < 0)
+      m = 0;
+    m /= sizeof(de[0]);
+    for(i = nv = 0; i < m && got + nv < n; i++)
+      if(de[i].inum != 0)
+        de[nv++] = de[i];
+    f->off += i * sizeof(de[0]);
+    iunlock(ip);
+    if(i == 0)
+      break;
+
+    // ... then stat'd and copied out without, since one
+    // of them may be ip itself.
+    for(i = 0; i < nv; i++, got++){
+      memset(&d, 0, sizeof(d));
+      memmove(d.name, de[i].name, DIRSIZ);
+      if(flags & GD_STAT)
+        statent(ip, de[i].inum, &d.st);
+      else
+        d.st.ino = de[i].inum;
+      if(copyout(myproc()->pagetable, addr + got * sizeof(d), (char*)&d, sizeof(d)) < 0)
+        return -1;
+    }
+  }
+  return got;
+}
+
 uint64
 sys_pipe(void)
 {
@@ -461,17 +690,16 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+      fdfree(fd0, rf);
+    else
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    fdfree(fd0, rf);
+    fdfree(fd1, wf);
     return -1;
   }
   return 0;
@@ -483,7 +711,7 @@ sys_crash(void)
 {
   char path[MAXPATH];
   struct inode *ip;
-  int crash;
+  int crash, dev;
   
   if(argstr(0, path, MAXPATH) < 0 || argint(1, &crash) < 0)
     return -1;
@@ -491,7 +719,174 @@ sys_crash(void)
   if(ip == 0){
     return -1;
   }
+  dev = ip->dev;
   iunlockput(ip);
-  crash_op(ip->dev, crash);
+  crash_op(dev, crash);
+  return 0;
+}
+
+// mount the file system on the disk device file arg 0
+// on the directory arg 1.
+uint64
+sys_mount(void)
+{
+  char dpath[MAXPATH], path[MAXPATH];
+  struct inode *ip;
+  int dev;
+
+  if(argstr(0, dpath, MAXPATH) < 0 || argstr(1, path, MAXPATH) < 0)
+    return -1;
+  if((ip = namei(dpath)) == 0)
+    return -1;
+  ilock(ip);
+  dev = ip->minor;
+  if(ip->type != T_DEVICE || ip->major != DISK){
+    iunlockput(ip);
+    return -1;
+  }
+  iunlockput(ip);
+
+  if((ip = namei(path)) == 0)
+    return -1;
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    return -1;
+  }
+  iunlock(ip);
+  if(mount(dev, ip) < 0){
+    iput(ip);
+    return -1;
+  }
+  return 0;
+}
+
+// unmount the file system mounted on arg 0.
+uint64
+sys_umount(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  int r;
+
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0)
+    return -1;
+  r = umount(ip);
+  iput(ip);
+  return r;
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f = 0;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+// shmget(key, size): a file descriptor for the shared
+// memory segment named key (a new one if key is 0), of at
+// least size bytes. mmap() it with MAP_SHARED to use it.
+uint64
+sys_shmget(void)
+{
+  int key, size, fd;
+  struct shm *s;
+  struct file *f;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  if((s = shmget(key, size)) == 0)
+    return -1;
+  if((f = filealloc()) == 0){
+    shmput(s);
+    return -1;
+  }
+  f->type = FD_SHM;
+  f->shm = s;
+  f->readable = 1;
+  f->writable = 1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(myproc(), addr, len);
+}
+
+// set the mode of disk arg 0 to arg 1, DISK_POLL and
+// DISK_COALESCE bits, or just report it if arg 1 is -1.
+uint64
+sys_diskmode(void)
+{
+  int dev, mode;
+
+  if(argint(0, &dev) < 0 || argint(1, &mode) < 0)
+    return -1;
+  return virtio_disk_mode(dev, mode);
+}
+
+// set the target size of the block cache to arg 0
+// buffers, or just report its size if arg 0 is 0.
+uint64
+sys_bcachesize(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  return bsetsize(n);
+}
+
+// copy the log statistics of device arg 0 to
+// the struct logstat at user address arg 1.
+uint64
+sys_logstat(void)
+{
+  int dev;
+  uint64 addr;
+  struct logstat st;
+
+  if(argint(0, &dev) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(logstat(dev, &st) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// copy the I/O statistics of device arg 0 to
+// the struct iostat at user address arg 1.
+uint64
+sys_iostat(void)
+{
+  int dev;
+  uint64 addr;
+  struct iostat st;
+
+  if(argint(0, &dev) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(dev < 0 || biostat(dev, &st) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
   return 0;
 }
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -35,42 +36,59 @@ sys_wait(void)
   uint64 p;
   if(argaddr(0, &p) < 0)
     return -1;
-  return wait(p);
+  return wait(-1, p);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, sp;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &sp) < 0)
+    return -1;
+  return clone(fn, arg, sp);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return wait(tid, p);
 }
 
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
-  if(argint(0, &n) < 0)
+  if(argint(0, &n) < 0 || n < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return clocksleep(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// sleep for at least n microseconds.
+uint64
+sys_usleep(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  return clocksleep(r_time() + (uint64)n * (TICKCYCLES / 100000));
 }
 
 uint64
@@ -83,6 +101,36 @@ sys_kill(void)
   return kill(pid);
 }
 
+// set (or with -1 query) a process's base priority;
+// returns the old one.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+// getrusage(who, ru): the resource usage of the caller
+// or of its reaped children.
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 addr;
+  struct rusage ru;
+
+  if(argint(0, &who) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(getrusage(who, &ru) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&ru, sizeof(ru)) < 0)
+    return -1;
+  return 0;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -95,3 +143,22 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy the page allocator's statistics to
+// the struct memstat at user address arg 0.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&st, 0, sizeof(st));
+  bd_stat(&st);
+  kstat(&st);
+  swapstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
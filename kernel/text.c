@@ -0,0 +1,157 @@
+//
+// Executable page cache: whole pages of running (or recently
+// run) programs' files, kept so that every process running
+// the same binary maps the same physical page, copy-on-write,
+// instead of reading its own copy (see exectext()).
+//
+// Pages are keyed by in-memory inode and file offset. The
+// cache holds a reference to each page; a mapping holds
+// another. An inode's pages go when it's written or truncated,
+// or when the inode cache recycles it, so a key can't outlive
+// the contents it names. A page only the cache refers to can
+// be evicted to make room, or by textshrink() for swapout().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NTEXTHASH 64
+
+struct tpage {
+  struct inode *ip;      // 0 if this slot is free
+  uint off;              // file offset of the page
+  uint64 pa;
+  struct tpage *next;    // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTEXT];
+  struct tpage *hash[NTEXTHASH];
+  int hand;              // next eviction candidate
+} text;
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+}
+
+static struct tpage**
+thash(struct inode *ip, uint off)
+{
+  return &text.hash[(((uint64)ip >> 6) + off / PGSIZE) % NTEXTHASH];
+}
+
+// Remove t from the cache, dropping its reference.
+// Caller holds text.lock.
+static void
+tdrop(struct tpage *t)
+{
+  struct tpage **tp;
+
+  for(tp = thash(t->ip, t->off); *tp; tp = &(*tp)->next){
+    if(*tp == t){
+      *tp = t->next;
+      break;
+    }
+  }
+  t->ip->ntext--;
+  t->ip = 0;
+  kfree((void*)t->pa);
+}
+
+// Return the cached page of ip at off, with a reference
+// for the caller, or 0 if there is none.
+uint64
+textget(struct inode *ip, uint off)
+{
+  struct tpage *t;
+  uint64 pa = 0;
+
+  acquire(&text.lock);
+  for(t = *thash(ip, off); t; t = t->next){
+    if(t->ip == ip && t->off == off){
+      pa = t->pa;
+      kaddref((void*)pa);
+      break;
+    }
+  }
+  release(&text.lock);
+  return pa;
+}
+
+// Cache pa, which holds ip's contents at off, evicting an
+// unused page if need be. The caller keeps its reference.
+// Caller holds ip->lock, so that textinval() can't miss it.
+void
+textput(struct inode *ip, uint off, uint64 pa)
+{
+  struct tpage *t = 0;
+  int i;
+
+  acquire(&text.lock);
+  for(i = 0; i < NTEXT; i++){
+    t = &text.page[text.hand];
+    text.hand = (text.hand + 1) % NTEXT;
+    if(t->ip == 0)
+      break;
+    if(krefcnt((void*)t->pa) == 1){
+      tdrop(t);
+      break;
+    }
+  }
+  if(i < NTEXT){
+    kaddref((void*)pa);
+    t->ip = ip;
+    t->off = off;
+    t->pa = pa;
+    t->next = *thash(ip, off);
+    *thash(ip, off) = t;
+    ip->ntext++;
+  }
+  release(&text.lock);
+}
+
+// Forget ip's cached pages, because its contents are changing
+// or its inode cache entry is being reused. Processes that
+// have them mapped keep them.
+void
+textinval(struct inode *ip)
+{
+  struct tpage *t;
+
+  if(ip->ntext == 0)
+    return;
+  acquire(&text.lock);
+  for(t = text.page; t < &text.page[NTEXT] && ip->ntext > 0; t++)
+    if(t->ip == ip)
+      tdrop(t);
+  release(&text.lock);
+}
+
+// Free up to n pages that only the cache refers to, for
+// swapout(). Returns the number freed.
+int
+textshrink(int n)
+{
+  struct tpage *t;
+  int freed = 0;
+
+  acquire(&text.lock);
+  for(t = text.page; t < &text.page[NTEXT] && freed < n; t++){
+    if(t->ip && krefcnt((void*)t->pa) == 1){
+      tdrop(t);
+      freed++;
+    }
+  }
+  release(&text.lock);
+  return freed;
+}
@@ -0,0 +1,132 @@
+//
+// Event tracing: each CPU writes fixed-size records of system
+// calls, scheduling and disk completions into its own ring,
+// with interrupts off but no locks, so tracing doesn't
+// serialize what it watches. A full ring overwrites its
+// oldest records. Reads of the trace device drain the rings.
+//
+// Each record is a tiny seqlock: the writer clears its seq,
+// fills it in, and then sets seq, so a reader that finds seq
+// unchanged across its copy knows it got a whole record.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "proc.h"
+#include "trace.h"
+#include "defs.h"
+
+#define NTRACE 256  // records per CPU
+
+struct tracering {
+  struct trace rec[NTRACE];
+  uint head;    // records written; rec[head % NTRACE] is next
+  uint tail;    // records read or lost, for traceread()
+};
+
+struct {
+  struct sleeplock lock;  // one reader at a time
+  struct tracering ring[NCPU];
+} trace;
+
+int tracing;
+
+// Append a record to this CPU's ring.
+void
+traceadd(int type, int pid, int num, uint64 time, uint64 a0, uint64 a1, uint64 a2, uint64 ret)
+{
+  struct tracering *r;
+  struct trace *t;
+  uint64 now = r_time();
+  uint seq;
+
+  push_off();
+  r = &trace.ring[cpuid()];
+  seq = r->head + 1;
+  t = &r->rec[r->head % NTRACE];
+  __atomic_store_n(&t->seq, 0, __ATOMIC_RELAXED);
+  __sync_synchronize();
+  t->time = time;
+  t->dur = now - time;
+  t->pid = pid;
+  t->type = type;
+  t->cpu = cpuid();
+  t->num = num;
+  t->arg[0] = a0;
+  t->arg[1] = a1;
+  t->arg[2] = a2;
+  t->ret = ret;
+  __atomic_store_n(&t->seq, seq, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->head, seq, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Copy up to n bytes of whole records to dst.
+static int
+traceread(int user_dst, uint64 dst, int n)
+{
+  struct tracering *r;
+  struct trace t, *slot;
+  uint head, seq;
+  int got = 0;
+
+  acquiresleep(&trace.lock);
+  for(r = trace.ring; r < &trace.ring[NCPU]; r++){
+    while(got + sizeof(t) <= n){
+      head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if(r->tail == head)
+        break;
+      if(head - r->tail > NTRACE)
+        r->tail = head - NTRACE;  // overwritten
+      slot = &r->rec[r->tail % NTRACE];
+      seq = ++r->tail;
+      if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+        continue;  // already being overwritten
+      t = *slot;
+      __sync_synchronize();
+      if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        continue;  // overwritten as we copied
+      if(either_copyout(user_dst, dst + got, &t, sizeof(t)) < 0){
+        releasesleep(&trace.lock);
+        return -1;
+      }
+      got += sizeof(t);
+    }
+  }
+  releasesleep(&trace.lock);
+  return got;
+}
+
+static int
+tracewrite(int user_src, uint64 src, int n)
+{
+  struct tracering *r;
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  acquiresleep(&trace.lock);
+  if(c == '1'){
+    for(r = trace.ring; r < &trace.ring[NCPU]; r++)
+      r->tail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    tracing = 1;
+  } else {
+    tracing = 0;
+  }
+  releasesleep(&trace.lock);
+  return n;
+}
+
+void
+traceinit(void)
+{
+  initsleeplock(&trace.lock, "trace");
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
@@ -0,0 +1,21 @@
+// Trace records, read from the trace device (major TRACE).
+// Writing "1" to the device starts tracing, forgetting
+// records not yet read; writing "0" stops it. A read returns
+// as many whole records as fit, from every CPU, or 0 if there
+// are none yet. Times are in r_time() cycles (10 MHz in qemu).
+
+#define TR_SYSCALL 1   // num: syscall; arg: a0-a2; ret: its result
+#define TR_SCHED   2   // a run of pid; num: its state after
+#define TR_DISK    3   // num: disk; arg: blockno, blocks, write
+
+struct trace {
+  uint64 time;       // when it started
+  uint64 dur;        // how long it took
+  int pid;           // 0 for the scheduler or an interrupt
+  short type;        // TR_*
+  short cpu;
+  int num;
+  uint seq;          // per-CPU record number, from 1; gaps were lost
+  uint64 arg[3];
+  uint64 ret;
+};
@@ -46,6 +46,7 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  p->ru.utime += r_time() - p->ustart;
   
   // save user program counter.
   p->tf->epc = r_sepc();
@@ -65,6 +66,19 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // instruction, load or store page fault; maybe a page
+    // exec() left to fault in, or a copy-on-write page.
+    // handling it may sleep (e.g. to swap), so allow
+    // interrupts once the trap registers are read.
+    uint64 scause = r_scause(), stval = r_stval();
+    intr_on();
+    p->ru.nfault++;
+    if(uvmfault(p->pagetable, stval, scause == 15 ? 1 : scause == 12 ? 2 : 0) < 0){
+      printf("usertrap(): page fault %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->tf->epc, stval);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -78,7 +92,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    proctick();
 
   usertrapret();
 }
@@ -117,14 +131,16 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->tf->epc);
 
+  p->ustart = r_time();
+
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvmsatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -151,7 +167,7 @@ kerneltrap()
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    proctick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -159,15 +175,6 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -195,17 +202,19 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another CPU's clockwake(), forwarded by timervec
+    // in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before clockintr() re-arms
+    // the timer and perhaps causes another.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    if(profiling)
+      profsample();
+
+    // a timer interrupt between ticks was only for a sleeper.
+    return clockintr() ? 2 : 1;
   } else {
     return 0;
   }
@@ -1,6 +1,12 @@
 //
 // low-level driver routines for 16550a UART.
 //
+// Output goes through a ring buffer that the transmit-empty
+// interrupt drains, a FIFO's worth at a time, so writers
+// don't spin on the line while it sends. write()s to the
+// console sleep while the ring is full. Kernel printf()s and
+// echoes can't sleep, so uartputc_sync() drains it by polling.
+//
 
 #include "types.h"
 #include "param.h"
@@ -27,12 +33,30 @@
 #define LCR 3 // line control register
 #define LSR 5 // line status register
 
+#define IER_RX 0x01   // interrupt when input arrives
+#define IER_TX 0x02   // interrupt when THR and the FIFO empty
+#define LSR_RX 0x01   // input is waiting in RHR
+#define LSR_TX 0x20   // THR and the FIFO are empty
+
+#define FIFOSIZE 16   // bytes the transmit FIFO holds
+
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+#define UART_TX_BUF 128
+
+struct {
+  struct spinlock lock;
+  char buf[UART_TX_BUF];
+  uint r;  // next to send; buf[r..w) mod UART_TX_BUF is queued
+  uint w;
+} tx;
+
 void
 uartinit(void)
 {
+  initlock(&tx.lock, "uart");
+
   // disable interrupts.
   WriteReg(IER, 0x00);
 
@@ -52,18 +76,65 @@ uartinit(void)
   // reset and enable FIFOs.
   WriteReg(FCR, 0x07);
 
-  // enable receive interrupts.
-  WriteReg(IER, 0x01);
+  // enable transmit and receive interrupts.
+  WriteReg(IER, IER_TX | IER_RX);
+}
+
+// If the transmitter is idle, hand it the next FIFO's worth
+// of queued output; its interrupt asks for more.
+// Caller holds tx.lock.
+static void
+uartstart(void)
+{
+  int n;
+
+  if(tx.r == tx.w || (ReadReg(LSR) & LSR_TX) == 0)
+    return;
+  for(n = 0; n < FIFOSIZE && tx.r != tx.w; n++)
+    WriteReg(THR, tx.buf[tx.r++ % UART_TX_BUF]);
 }
 
-// write one output character to the UART.
+// Queue n bytes of output at s, sleeping while the ring is
+// full. Returns how many were queued: fewer than n if killed.
+int
+uartwrite(char *s, int n)
+{
+  int i;
+
+  acquire(&tx.lock);
+  for(i = 0; i < n; i++){
+    while(tx.w - tx.r == UART_TX_BUF){
+      if(myproc()->killed)
+        goto out;
+      uartstart();
+      sleep(&tx.r, &tx.lock);
+    }
+    tx.buf[tx.w++ % UART_TX_BUF] = s[i];
+  }
+ out:
+  uartstart();
+  release(&tx.lock);
+  return i;
+}
+
+// Write one output character to the UART without sleeping,
+// for printf() and echoing input: send what's queued ahead
+// of it, then it, spinning until the line can take each.
+// Doesn't wakeup(), since printf() may be called with a
+// p->lock held; the transmit interrupt will.
 void
-uartputc(int c)
+uartputc_sync(int c)
 {
-  // wait for Transmit Holding Empty to be set in LSR.
-  while((ReadReg(LSR) & (1 << 5)) == 0)
-    ;
+  acquire(&tx.lock);
+  for(;;){
+    while((ReadReg(LSR) & LSR_TX) == 0)
+      ;
+    if(tx.r == tx.w)
+      break;
+    uartstart();
+  }
   WriteReg(THR, c);
+  release(&tx.lock);
 }
 
 // read one input character from the UART.
@@ -71,7 +142,7 @@ uartputc(int c)
 int
 uartgetc(void)
 {
-  if(ReadReg(LSR) & 0x01){
+  if(ReadReg(LSR) & LSR_RX){
     // input data is ready.
     return ReadReg(RHR);
   } else {
@@ -79,7 +150,9 @@ uartgetc(void)
   }
 }
 
-// trap.c calls here when the uart interrupts.
+// trap.c calls here when the uart interrupts,
+// because input has arrived, or the transmitter is ready
+// for more output, or both.
 void
 uartintr(void)
 {
@@ -89,4 +162,9 @@ uartintr(void)
       break;
     consoleintr(c);
   }
+
+  acquire(&tx.lock);
+  uartstart();
+  wakeup(&tx.r);  // room for uartwrite()
+  release(&tx.lock);
 }
@@ -0,0 +1,7 @@
+// A buffer of a vectored read or write, for readv() and writev().
+struct iovec {
+  void *base;
+  uint64 len;
+};
+
+#define NIOV 16  // most iovecs in one readv() or writev()
@@ -0,0 +1,13 @@
+// Pages the kernel maps read-only into every user address
+// space, so that ulib.c can answer uptime() and getpid()
+// without a system call. See memlayout.h for where.
+
+// VDSO: one page, shared by all processes.
+struct vdso {
+  uint ticks;        // what uptime() would return
+};
+
+// VPROC: one page per address space.
+struct vproc {
+  int pid;           // getpid(), or 0 if several threads share it
+};
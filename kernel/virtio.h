@@ -45,7 +45,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 struct VRingDesc {
   uint64 addr;
@@ -55,6 +55,7 @@ struct VRingDesc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // buffer holds a table of descriptors
 
 struct VRingUsedElem {
   uint32 id;   // index of start of completed descriptor chain
@@ -69,4 +70,5 @@ struct UsedArea {
   uint16 flags;
   uint16 id;
   struct VRingUsedElem elems[NUM];
+  uint16 avail_event;  // with VIRTIO_RING_F_EVENT_IDX
 };
@@ -16,10 +16,38 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "disk.h"
+#include "iostat.h"
+#include "trace.h"
 
 // the address of virtio mmio register r.
 #define R(n, r) ((volatile uint32 *)(VIRTION(n) + (r)))
 
+#define NREQ 64          // queued or in-flight requests per disk
+#define READEXPIRE  2    // ticks a read may wait before it goes first
+#define WRITEEXPIRE 10   // the same for a write
+#define POLLSPIN 100000  // iterations a DISK_POLL wait spins
+
+// A request for a run of buffers, linked through qnext. Requests
+// wait in a per-disk queue sorted by block number, where a
+// request for the blocks just before or after another one, in
+// the same direction, is merged with it. They go to the device
+// in C-LOOK order, reads ahead of writes, unless the oldest has
+// waited too long.
+struct req {
+  struct buf *b;      // first buffer of the run
+  struct buf *tail;   // and last
+  uint blockno;       // b->blockno
+  int nb;             // buffers in the run
+  char write;
+  char async;         // call bdone() on each buffer when done
+  uint when;          // ticks when queued
+  uint64 start;       // and r_time() then, for iostat()
+  struct req *next;   // queue, sorted by blockno; or free list
+  struct req *merged; // later requests merged into this one
+  int nmerged;        // blocks of this one plus merged ones
+};
+
 struct disk {
   // memory for virtio descriptors &c for queue 0.
   // this is a global instead of allocated because it has
@@ -34,20 +62,54 @@ struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int unkicked;    // requests in avail[] not yet notified
+  uint16 kicked;   // avail[1] at the last notification
+
+  // with VIRTIO_RING_F_EVENT_IDX the device only wants a
+  // notification once avail[1] passes used->avail_event,
+  // and only interrupts once its used->id passes used_event.
+  int eventidx;
+  uint16 *used_event;
+  int mode;        // DISK_POLL | DISK_COALESCE
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct req *r;
     char status;
   } info[NUM];
 
+  // the elevator.
+  struct req reqs[NREQ];
+  struct req *freereq;
+  struct req *queue;  // waiting for the ring, by blockno
+  uint pos;           // the block after the last one dispatched
+  int nreq;           // requests queued or in flight
+
+  struct iostat st;   // all but the cache counts
+
+  // the type/reserved/sector header of each operation,
+  // also indexed by first descriptor. here rather than
+  // on a kernel stack, since an operation may outlive
+  // the call that started it.
+  struct virtio_blk_outhdr {
+    uint32 type;
+    uint32 reserved;
+    uint64 sector;
+  } ops[NUM];
+
+  // with VIRTIO_RING_F_INDIRECT_DESC, each operation takes
+  // one ring descriptor, which points to its row of this
+  // table, indexed by that descriptor.
+  int indirect;
+  struct VRingDesc itab[NUM][NRUN+2];
+
   // initialized?
   int init;
 
   struct spinlock vdisk_lock;
-} __attribute__ ((aligned (PGSIZE))) disk[NDISK];
+} __attribute__ ((aligned (PGSIZE))) disk[NVIRTIO];
   
 
 
@@ -84,9 +146,9 @@ virtio_disk_init(int n)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(n, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk[n].eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  disk[n].indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -110,15 +172,21 @@ virtio_disk_init(int n)
   *R(n, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk[n].pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
+  // avail = pages + 0x40 -- 2 * uint16, then num * uint16,
+  //   then the used_event uint16
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
   disk[n].desc = (struct VRingDesc *) disk[n].pages;
   disk[n].avail = (uint16*)(((char*)disk[n].desc) + NUM*sizeof(struct VRingDesc));
   disk[n].used = (struct UsedArea *) (disk[n].pages + PGSIZE);
+  disk[n].used_event = &disk[n].avail[2 + NUM];
 
   for(int i = 0; i < NUM; i++)
     disk[n].free[i] = 1;
+  for(int i = 0; i < NREQ; i++){
+    disk[n].reqs[i].next = disk[n].freereq;
+    disk[n].freereq = &disk[n].reqs[i];
+  }
 
   disk[n].init = 1;
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
@@ -147,7 +215,6 @@ free_desc(int n, int i)
     panic("virtio_disk_intr 2");
   disk[n].desc[i].addr = 0;
   disk[n].free[i] = 1;
-  wakeup(&disk[n].free[0]);
 }
 
 // free a chain of descriptors.
@@ -163,10 +230,11 @@ free_chain(int n, int i)
   }
 }
 
+// allocate cnt descriptors, or none if there aren't enough.
 static int
-alloc3_desc(int n, int *idx)
+alloc_descs(int n, int *idx, int cnt)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < cnt; i++){
     idx[i] = alloc_desc(n);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -177,106 +245,435 @@ alloc3_desc(int n, int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(int n, struct buf *b, int write)
+// Tell the device about the requests added to avail[]
+// since the last time, unless it has said it will look
+// anyway. Caller holds vdisk_lock.
+static void
+kick(int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint16 old = disk[n].kicked, new = disk[n].avail[1];
 
-  acquire(&disk[n].vdisk_lock);
+  if(disk[n].unkicked == 0)
+    return;
+  __sync_synchronize();
+  disk[n].unkicked = 0;
+  disk[n].kicked = new;
+  // as in the spec's vring_need_event(): has avail[1] gone
+  // past avail_event since the last notification?
+  if(disk[n].eventidx &&
+     (uint16)(new - disk[n].used->avail_event - 1) >= (uint16)(new - old))
+    return;
+  *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+// Hand request r, and those merged into it, to the device,
+// as one operation. The device only hears of it at the next
+// kick(). Returns -1 if there aren't enough free descriptors.
+// Caller holds vdisk_lock.
+static int
+virtio_disk_start(int n, struct req *r)
+{
+  uint64 sector = r->blockno * (BSIZE / 512);
+  int nb = r->nmerged;
+  struct buf *x;
+
+  // the spec says that legacy block operations use a
+  // descriptor for type/reserved/sector, then the data,
+  // here one descriptor per buffer, then one for a 1-byte
+  // status result. with indirect descriptors they're a row
+  // of itab[], and the ring holds one descriptor pointing to it.
+
+  int idx[NRUN+2];
+  int nd = disk[n].indirect ? 1 : nb+2;
+  if(alloc_descs(n, idx, nd) < 0)
+    return -1;
+
+  // format the descriptors.
+  // qemu's virtio-blk.c reads them.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(n, idx) == 0) {
-      break;
-    }
-    sleep(&disk[n].free[0], &disk[n].vdisk_lock);
+  int head = idx[0];
+  struct VRingDesc *d = disk[n].desc;
+  if(disk[n].indirect){
+    d = disk[n].itab[head];
+    for(int i = 0; i < nb+2; i++)
+      idx[i] = i;
+    disk[n].desc[head].addr = (uint64) d;
+    disk[n].desc[head].len = (nb+2) * sizeof(*d);
+    disk[n].desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk[n].desc[head].next = 0;
   }
-  
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk[n].ops[head];
 
-  if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+  if(r->write)
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk[n].desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk[n].desc[idx[0]].len = sizeof(buf0);
-  disk[n].desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk[n].desc[idx[0]].next = idx[1];
-
-  disk[n].desc[idx[1]].addr = (uint64) b->data;
-  disk[n].desc[idx[1]].len = BSIZE;
-  if(write)
-    disk[n].desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk[n].desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk[n].desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk[n].desc[idx[1]].next = idx[2];
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(*buf0);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
+
+  // the merged runs' buffers are linked into one run.
+  int i = 1;
+  for(x = r->b; i <= nb; x = x->qnext, i++){
+    d[idx[i]].addr = (uint64) (x->udata ? x->udata : x->data);
+    d[idx[i]].len = BSIZE;
+    if(r->write)
+      d[idx[i]].flags = 0; // device reads x->data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes x->data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  disk[n].info[idx[0]].status = 0;
-  disk[n].desc[idx[2]].addr = (uint64) &disk[n].info[idx[0]].status;
-  disk[n].desc[idx[2]].len = 1;
-  disk[n].desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk[n].desc[idx[2]].next = 0;
+  disk[n].info[head].status = 0;
+  d[idx[i]].addr = (uint64) &disk[n].info[head].status;
+  d[idx[i]].len = 1;
+  d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[idx[i]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[n].info[idx[0]].b = b;
+  // record the request for virtio_disk_intr().
+  disk[n].info[head].r = r;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
   // we only tell device the first index in our chain of descriptors.
-  disk[n].avail[2 + (disk[n].avail[1] % NUM)] = idx[0];
+  disk[n].avail[2 + (disk[n].avail[1] % NUM)] = head;
   __sync_synchronize();
   disk[n].avail[1] = disk[n].avail[1] + 1;
+  disk[n].unkicked++;
+  return 0;
+}
 
-  *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+static void dispatch(int);
+static void complete(int);
+
+// Can request b be merged onto the end of request a?
+static int
+mergeable(struct req *a, struct req *b)
+{
+  return a->write == b->write && a->blockno + a->nmerged == b->blockno &&
+         a->nmerged + b->nmerged <= NRUN;
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk[n].vdisk_lock);
+// Merge request b, which follows a in the queue, into a.
+static void
+merge(struct req *a, struct req *b)
+{
+  struct req *m;
+
+  for(m = a; m->merged; m = m->merged)
+    ;
+  m->merged = b;
+  m->tail->qnext = b->b;
+  a->nmerged += b->nmerged;
+  a->next = b->next;
+  if(b->when < a->when)
+    a->when = b->when;
+}
+
+// Add a request for b and the rest of its qnext run to the
+// queue. Caller holds vdisk_lock; may sleep waiting for a
+// free request.
+static void
+enqueue(int n, struct buf *b, int write, int async)
+{
+  struct req *r, **pp, *prev;
+  struct buf *x;
+  int nb = 0;
+
+  for(x = b; x; x = x->qnext){
+    if(x->blockno != b->blockno + nb)
+      panic("virtio_disk: not a run");
+    nb++;
+    x->disk = 1;
+  }
+  if(nb > NRUN)
+    panic("virtio_disk: run too long");
+
+  while((r = disk[n].freereq) == 0){
+    // make sure the device is working on what it can.
+    dispatch(n);
+    kick(n);
+    sleep(&disk[n].freereq, &disk[n].vdisk_lock);
   }
+  disk[n].freereq = r->next;
+
+  r->b = b;
+  for(r->tail = b; r->tail->qnext; r->tail = r->tail->qnext)
+    ;
+  r->blockno = b->blockno;
+  r->nb = r->nmerged = nb;
+  r->write = write;
+  r->async = async;
+  r->when = ticks;
+  r->start = r_time();
+  r->merged = 0;
+
+  disk[n].nreq++;
+  disk[n].st.depthsum += disk[n].nreq;
+  disk[n].st.nsample++;
+  if(disk[n].nreq > disk[n].st.maxdepth)
+    disk[n].st.maxdepth = disk[n].nreq;
+
+  // insert it in block order, after any for the same block,
+  // merging with its neighbours.
+  prev = 0;
+  for(pp = &disk[n].queue; *pp && (*pp)->blockno <= r->blockno; pp = &(*pp)->next)
+    prev = *pp;
+  r->next = *pp;
+  *pp = r;
+  if(r->next && mergeable(r, r->next))
+    merge(r, r->next);
+  if(prev && mergeable(prev, r))
+    merge(prev, r);
+}
 
-  disk[n].info[idx[0]].b = 0;
-  free_chain(n, idx[0]);
+// Is r, queued since r->when, overdue?
+static int
+expired(struct req *r)
+{
+  return ticks - r->when >= (r->write ? WRITEEXPIRE : READEXPIRE);
+}
+
+// Choose the next queued request to dispatch: the oldest if
+// it's overdue, or else the first read, or failing that the
+// first write, at or after the last position, wrapping
+// around (C-LOOK). Returns the link pointing to it.
+static struct req**
+pick(int n)
+{
+  struct req **pp, **old = 0, **first = 0, **next = 0;
+  int write;
+
+  for(pp = &disk[n].queue; *pp; pp = &(*pp)->next)
+    if(old == 0 || (*pp)->when < (*old)->when)
+      old = pp;
+  if(old == 0 || expired(*old))
+    return old;
+
+  for(write = 0; write < 2; write++){
+    for(pp = &disk[n].queue; *pp; pp = &(*pp)->next){
+      if((*pp)->write != write)
+        continue;
+      if(first == 0)
+        first = pp;
+      if((*pp)->blockno >= disk[n].pos){
+        next = pp;
+        break;
+      }
+    }
+    if(next || first)
+      return next ? next : first;
+  }
+  return 0;
+}
+
+// Move queued requests to the ring while there's room.
+// Caller holds vdisk_lock.
+static void
+dispatch(int n)
+{
+  struct req **pp, *r;
+
+  while((pp = pick(n)) != 0){
+    r = *pp;
+    if(virtio_disk_start(n, r) < 0)
+      break;  // ring is full; virtio_disk_intr() will call again
+    *pp = r->next;
+    disk[n].pos = r->blockno + r->nmerged;
+  }
+}
+
+// Read or write the nrun runs of buffers runs[0..nrun-1],
+// each of them a buffer and any after it in its qnext run,
+// with one notification of the device, and wait for the disk
+// to finish all of them.
+void
+virtio_disk_rwv(int n, struct buf **runs, int nrun, int write)
+{
+  int i;
+
+  acquire(&disk[n].vdisk_lock);
+  for(i = 0; i < nrun; i++)
+    enqueue(n, runs[i], write, 0);
+  dispatch(n);
+  kick(n);
+
+  // Wait for virtio_disk_intr() to say the requests have finished,
+  // or in DISK_POLL mode, look for the completions first.
+  for(int spin = 0; (disk[n].mode & DISK_POLL) && spin < POLLSPIN; spin++){
+    for(i = 0; i < nrun && runs[i]->disk == 0; i++)
+      ;
+    if(i == nrun)
+      break;
+    __sync_synchronize();
+    if(disk[n].used_idx != disk[n].used->id)
+      complete(n);
+  }
+  for(i = 0; i < nrun; i++)
+    while(runs[i]->disk == 1)
+      sleep(runs[i], &disk[n].vdisk_lock);
 
   release(&disk[n].vdisk_lock);
 }
 
+// Read or write b, and any buffers after it in its qnext
+// run, and wait for the disk to finish.
 void
-virtio_disk_intr(int n)
+virtio_disk_rw(int n, struct buf *b, int write)
+{
+  virtio_disk_rwv(n, &b, 1, write);
+}
+
+// Start reading or writing runs[0..nrun-1], as for
+// virtio_disk_rwv(), without waiting. virtio_disk_intr()
+// calls bdone() on each buffer when its request completes.
+void
+virtio_disk_rw_async(int n, struct buf **runs, int nrun, int write)
 {
   acquire(&disk[n].vdisk_lock);
+  for(int i = 0; i < nrun; i++)
+    enqueue(n, runs[i], write, 1);
+  dispatch(n);
+  kick(n);
+  release(&disk[n].vdisk_lock);
+}
+
+// Count finished request r in disk n's statistics.
+static void
+account(int n, struct req *r)
+{
+  struct iostat *st = &disk[n].st;
+  uint64 us = (r_time() - r->start) / 10;  // time runs at 10 MHz
+  int k;
+
+  for(k = 0; k < NIOHIST-1 && us >= (1L << k); k++)
+    ;
+  if(r->write){
+    st->nwrite++;
+    st->wbytes += r->nb * BSIZE;
+    st->wlat[k]++;
+  } else {
+    st->nread++;
+    st->rbytes += r->nb * BSIZE;
+    st->rlat[k]++;
+  }
+  disk[n].nreq--;
+  if(tracing)
+    traceadd(TR_DISK, 0, n, r->start, r->blockno, r->nb, r->write, 0);
+}
 
-  while((disk[n].used_idx % NUM) != (disk[n].used->id % NUM)){
-    int id = disk[n].used->elems[disk[n].used_idx].id;
+// Finish the requests the device has completed, and start
+// more. Caller holds vdisk_lock.
+static void
+complete(int n)
+{
+  struct buf *x, *next;
+  struct req *r, *m;
+  int i;
+  uint16 inflight;
+
+ again:
+  while(disk[n].used_idx != disk[n].used->id){
+    __sync_synchronize();
+    int id = disk[n].used->elems[disk[n].used_idx % NUM].id;
 
     if(disk[n].info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk[n].info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk[n].info[id].b);
+    r = disk[n].info[id].r;
+    disk[n].info[id].r = 0;
+    free_chain(n, id);
+
+    // the disk is done with the merged runs; take them apart.
+    for(; r; r = m){
+      m = r->merged;
+      for(x = r->b, i = 0; i < r->nb; x = next, i++){
+        next = x->qnext;
+        x->qnext = 0;
+        x->disk = 0;
+        if(r->async)
+          bdone(x);
+      }
+      if(!r->async)
+        wakeup(r->b);
+      account(n, r);
+      r->next = disk[n].freereq;
+      disk[n].freereq = r;
+    }
+    wakeup(&disk[n].freereq);
+
+    disk[n].used_idx++;
+  }
 
-    disk[n].used_idx = (disk[n].used_idx + 1) % NUM;
+  if(disk[n].eventidx){
+    // ask for an interrupt at the next completion, or in
+    // DISK_COALESCE mode, once half of those in flight are done.
+    inflight = disk[n].avail[1] - disk[n].used_idx;
+    if((disk[n].mode & DISK_COALESCE) && inflight > 1)
+      *disk[n].used_event = disk[n].used_idx + inflight/2 - 1;
+    else
+      *disk[n].used_event = disk[n].used_idx;
+    __sync_synchronize();
+    // one may have completed before the device saw used_event.
+    if(disk[n].used_idx != disk[n].used->id)
+      goto again;
   }
 
+  // the freed descriptors can take more requests.
+  dispatch(n);
+  kick(n);
+}
+
+void
+virtio_disk_intr(int n)
+{
+  acquire(&disk[n].vdisk_lock);
+  complete(n);
+  release(&disk[n].vdisk_lock);
+}
+
+// Set disk n's mode to mode, a mask of DISK_POLL and
+// DISK_COALESCE, or if mode is -1 leave it be.
+// Returns the old mode, or -1 if there's no disk n.
+int
+virtio_disk_mode(int n, int mode)
+{
+  int old;
+
+  if(n < 0 || n >= NVIRTIO || !disk[n].init)
+    return -1;
+  if(mode != -1 && (mode & ~(DISK_POLL|DISK_COALESCE)) != 0)
+    return -1;
+  acquire(&disk[n].vdisk_lock);
+  old = disk[n].mode;
+  if(mode != -1)
+    disk[n].mode = mode;
   release(&disk[n].vdisk_lock);
+  return old;
 }
 
+// Fill in disk n's part of st, for iostat().
+void
+virtio_disk_stat(int n, struct iostat *st)
+{
+  struct iostat *d = &disk[n].st;
+
+  acquire(&disk[n].vdisk_lock);
+  st->nread = d->nread;
+  st->nwrite = d->nwrite;
+  st->rbytes = d->rbytes;
+  st->wbytes = d->wbytes;
+  memmove(st->rlat, d->rlat, sizeof(st->rlat));
+  memmove(st->wlat, d->wlat, sizeof(st->wlat));
+  st->depthsum = d->depthsum;
+  st->nsample = d->nsample;
+  st->maxdepth = d->maxdepth;
+  release(&disk[n].vdisk_lock);
+}
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +17,16 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// ASIDs tag each process's TLB entries, so that going between
+// the kernel and user page tables needs no TLB flush. Each ASID
+// is handed out at most once per generation; when they run out a
+// new generation starts, and every CPU flushes its whole TLB
+// before it next runs a process. The kernel page table uses ASID 0.
+static struct spinlock asidlock;
+static uint64 asidgen = 1;   // current generation
+static uint64 nextasid = 1;  // next free ASID in this generation
+static uint64 asidmax;       // largest ASID the hardware supports
+
 void print(pagetable_t);
 
 /*
@@ -25,8 +37,8 @@ void print(pagetable_t);
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  initlock(&asidlock, "asid");
+  kernel_pagetable = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -47,6 +59,7 @@ kvminit()
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // all but the first partial 2MB use megapages, see kvmmap().
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -59,10 +72,101 @@ kvminit()
 void
 kvminithart()
 {
+  // the ASID field is WARL: only the implemented bits stick.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASIDMASK);
+  asidmax = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Return the satp value for running p in user space, giving it
+// an ASID of the current generation if it doesn't have one, and
+// flushing this CPU's TLB if it might hold stale entries for p.
+// Called by usertrapret() with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct mm *mm = p->mm;
+  uint64 gen, bit = 1L << cpuid();
+
+  // read before the stale bits, see tlbsync().
+  p->tlbseen = __sync_fetch_and_add(&mm->tlbgen, 0);
+
+  if(asidmax == 0){
+    // no ASIDs: trampoline.S flushes the whole TLB on
+    // every switch, since the ASID field is 0.
+    return MAKE_SATP(mm->pagetable);
+  }
+
+  acquire(&asidlock);
+  if((mm->asid >> 16) != asidgen){
+    if(nextasid > asidmax){
+      asidgen++;
+      nextasid = 1;
+    }
+    mm->asid = (asidgen << 16) | nextasid++;
+    mm->tlbcpus = 0;
+    mm->tlbstale = 0;
+  }
+  gen = asidgen;
+  release(&asidlock);
+
+  if(c->asidgen != gen){
+    // TLB may hold entries of the previous generation.
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(mm->tlbstale & bit){
+    sfence_vma_asid(mm->asid & 0xFFFF);
+  }
+  // other threads of mm may be updating these on other CPUs.
+  __sync_fetch_and_and(&mm->tlbstale, ~bit);
+  __sync_fetch_and_or(&mm->tlbcpus, bit);
+  return MAKE_SATP_ASID(mm->pagetable, mm->asid & 0xFFFF);
+}
+
+// The mappings of npages pages at va in pagetable changed.
+// With ASIDs, any CPU's TLB may still hold them, tagged with
+// the ASID of pagetable's mm: every CPU that ran that mm must
+// flush before running it again. If it's the current process's,
+// flush them from this CPU's TLB now, and if other threads
+// share it, wait until none of them can still be using the old
+// mappings; see tlbsync(). Another process's mm must not be
+// running meanwhile (swap.c pins it). A page table no process
+// uses yet gets a fresh ASID before it is first used.
+void
+tlbinval(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+  struct mm *mm;
+  uint64 asid, bit;
+  int mine;
+
+  mine = p != 0 && p->mm != 0 && p->mm->pagetable == pagetable;
+  if(mine)
+    mm = p->mm;
+  else if(asidmax == 0 || (mm = pagetablemm(pagetable)) == 0)
+    return;
+  if(mm->asid != 0){
+    asid = mm->asid & 0xFFFF;
+    push_off();
+    bit = 0;  // CPUs that needn't flush later
+    if(mine){
+      bit = 1L << cpuid();
+      if(npages > 32 || asidmax == 0){
+        sfence_vma_asid(asid);
+      } else {
+        for(; npages > 0; npages--, va += PGSIZE)
+          sfence_vma_page(va, asid);
+      }
+    }
+    __sync_fetch_and_or(&mm->tlbstale, mm->tlbcpus & ~bit);
+    pop_off();
+  }
+  if(mine && mm->ref > 1)
+    tlbsync(p, __sync_add_and_fetch(&mm->tlbgen, 1));
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -75,24 +179,35 @@ kvminithart()
 //   21..39 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..12 -- 12 bits of byte offset within the page.
+//
+// walklevel() stops at the PTE for level leaf (0 for a
+// page, 1 for a 2MB megapage), or at a megapage leaf found
+// on the way down. Only the kernel page table has megapages.
 static pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > leaf; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(leaf, va)];
+}
+
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
 }
 
 // Look up a virtual address, return the physical address,
@@ -118,11 +233,34 @@ walkaddr(pagetable_t pagetable, uint64 va)
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses a megapage for each 2MB-aligned 2MB of the range,
+// which saves a page-table page and 511 TLB entries each.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  pte_t *pte;
+  uint64 n;
+
+  while(sz > 0){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && sz >= MEGAPGSIZE){
+      n = MEGAPGSIZE;
+      if((pte = walklevel(kernel_pagetable, va, 1, 1)) == 0)
+        panic("kvmmap");
+      if(*pte & PTE_V)
+        panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+    } else {
+      // small pages up to the next megapage boundary.
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kernel_pagetable, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
 // translate a kernel virtual address to
@@ -136,6 +274,9 @@ kvmpa(uint64 va)
   pte_t *pte;
   uint64 pa;
   
+  pte = walklevel(kernel_pagetable, va, 0, 1);
+  if(pte && (*pte & PTE_V) && (*pte & (PTE_R|PTE_W|PTE_X)))
+    return PTE2PA(*pte) + va % MEGAPGSIZE;  // megapage
   pte = walk(kernel_pagetable, va, 0);
   if(pte == 0)
     panic("kvmpa");
@@ -171,36 +312,46 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
-// Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
-// physical memory.
+// Remove mappings from a page table. Pages in the
+// range that were never mapped (e.g. heap pages that
+// a lazy sbrk() handed out but nobody touched) are
+// skipped, and swapped-out pages give up their slots.
+// Optionally free the physical memory, a batch at a
+// time once no TLB can still refer to it.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 {
-  uint64 a, last;
+  uint64 a, start, last;
   pte_t *pte;
-  uint64 pa;
+  uint64 pa[32];
+  int i, n, done;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
-  for(;;){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0){
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
-    }
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free){
-      pa = PTE2PA(*pte);
-      kfree((void*)pa);
+  for(done = 0; !done; ){
+    start = a;
+    for(n = 0; n < NELEM(pa) && !done; ){
+      if((pte = walk(pagetable, a, 0)) == 0){
+        // no level-0 page-table page; skip all of its range.
+        a |= (uint64)PXMASK << PGSHIFT;
+      } else if(*pte & PTE_V){
+        if(PTE_FLAGS(*pte) == PTE_V)
+          panic("uvmunmap: not a leaf");
+        if(do_free)
+          pa[n++] = PTE2PA(*pte);
+        *pte = 0;
+      } else if(*pte & PTE_SWAP){
+        swapdrop(*pte);
+        *pte = 0;
+      }
+      if(a >= last)
+        done = 1;
+      else
+        a += PGSIZE;
     }
-    *pte = 0;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    tlbinval(pagetable, start, (a - start) / PGSIZE + 1);
+    for(i = 0; i < n; i++)
+      kfree((void*)pa[i]);
   }
 }
 
@@ -209,10 +360,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     panic("uvmcreate: out of memory");
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -226,8 +376,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -246,12 +395,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   oldsz = PGROUNDUP(oldsz);
   a = oldsz;
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    while((mem = kalloc_zeroed()) == 0 && swapout() > 0)
+      ;
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -299,44 +448,227 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  uvmunmap(pagetable, 0, sz, 1);
+  if(sz > 0)
+    uvmunmap(pagetable, 0, sz, 1);
   freewalk(pagetable);
 }
 
+// Free user memory pages, then the page-table pages, except
+// those on the path to va. Whatever va's level-0 page-table
+// page maps stays mapped; every other mapping must already
+// have been removed.
+void
+uvmtrim(pagetable_t pagetable, uint64 sz, uint64 va)
+{
+  pte_t pte;
+
+  if(sz > 0)
+    uvmunmap(pagetable, 0, sz, 1);
+  for(int level = 2; level > 0; level--){
+    for(int i = 0; i < 512; i++){
+      pte = pagetable[i];
+      if(i == PX(level, va) || (pte & PTE_V) == 0)
+        continue;
+      if(pte & (PTE_R|PTE_W|PTE_X))
+        panic("uvmtrim: leaf");
+      freewalk((pagetable_t)PTE2PA(pte));
+      pagetable[i] = 0;
+    }
+    pte = pagetable[PX(level, va)];
+    if((pte & PTE_V) == 0 || (pte & (PTE_R|PTE_W|PTE_X)))
+      panic("uvmtrim: path");
+    pagetable = (pagetable_t)PTE2PA(pte);
+  }
+}
+
+// Map the pages of old in [va, va+len) into new, sharing
+// the physical memory. If cow, writable pages become
+// read-only with PTE_COW set in both page tables, and
+// uvmfault() copies a page when either side writes to it;
+// otherwise both keep write access (MAP_SHARED memory).
+// Pages that were never faulted in are skipped, and
+// swapped-out ones share the swap slot instead.
+// returns 0 on success, -1 on failure, leaving
+// some of the range mapped in new.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int cow)
+{
+  pte_t *pte, *npte;
+  uint64 pa, i;
+  uint flags;
+  int err = 0;
+
+  for(i = va; i < va + len; i += PGSIZE){
+    if((pte = walk(old, i, 0)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // each side reads its own copy back in.
+      if((npte = walk(new, i, 1)) == 0){
+        err = -1;
+        break;
+      }
+      swapdup(*pte);
+      *npte = *pte;
+      continue;
+    }
+    if((*pte & PTE_V) == 0)
+      continue;  // lazily allocated, not yet touched
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE2PA(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0){
+      err = -1;
+      break;
+    }
+    kaddref((void*)pa);
+  }
+  // the parent's writable TLB entries are now stale.
+  if(cow)
+    tlbinval(old, va, len / PGSIZE);
+  return err;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but shares the
+// physical memory copy-on-write (see uvmshare()).
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  if(uvmshare(old, new, 0, sz, 1) < 0){
+    uvmunmap(new, 0, sz, 1);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a fault on user virtual address va; write
+// is 1 for a store, 2 for an instruction fetch, and 0
+// for a load. Reads in a page of the
+// program (see execfault()), allocates a zeroed page for
+// a heap address that sbrk() handed out lazily, fills
+// in pages of mmap() regions (see mmapfault()), reads
+// swapped-out pages back in (see swapin()), and
+// gives a copy-on-write page a private, writable copy
+// (or takes it over if no one else refers to it any more).
+// When memory runs out, pushes some pages out to swap and
+// lets the access be retried.
+// Returns 0 if the access can be retried, -1 if it is
+// a real fault or memory ran out.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct mm *mm = 0;
+  pte_t *pte, old;
+  uint64 pa;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+  if(va >= MAXVA)
+    return -1;
+  if(p && p->mm && pagetable == p->mm->pagetable)
+    mm = p->mm;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(mm == 0)
+      return -1;
+    if(pte && (*pte & PTE_SWAP))
+      return swapin(pte);
+    if(va >= mm->sz)
+      return mmapfault(p, va, write == 1);
+    // below sz but not mapped: a page of the program that
+    // exec() left to fault in, or a lazy heap page. Whole
+    // pages of the program are shared with other processes
+    // running it, copy-on-write.
+    if((pa = exectext(mm, va)) == -1)
+      return -1;
+    if(pa){
+      acquire(&mm->lock);
+      if(va >= mm->sz || ((pte = walk(pagetable, va, 0)) && (*pte & (PTE_V|PTE_SWAP)))){
+        release(&mm->lock);
+        kfree((void*)pa);
+        return 0;
+      }
+      if(mappages(pagetable, PGROUNDDOWN(va), PGSIZE, pa, PTE_COW|PTE_X|PTE_R|PTE_U) != 0){
+        release(&mm->lock);
+        kfree((void*)pa);
+        return swapout() > 0 ? 0 : -1;
+      }
+      release(&mm->lock);
+      return 0;
+    }
+    if((mem = kalloc_zeroed()) == 0)
+      return swapout() > 0 ? 0 : -1;
+    if(execfault(mm, va, mem) < 0){
       kfree(mem);
-      goto err;
+      return -1;
     }
+    // another thread may have faulted it in meanwhile,
+    // or shrunk the heap; then just retry.
+    acquire(&mm->lock);
+    if(va >= mm->sz || ((pte = walk(pagetable, va, 0)) && (*pte & (PTE_V|PTE_SWAP)))){
+      release(&mm->lock);
+      kfree(mem);
+      return 0;
+    }
+    if(mappages(pagetable, PGROUNDDOWN(va), PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      release(&mm->lock);
+      kfree(mem);
+      return swapout() > 0 ? 0 : -1;
+    }
+    release(&mm->lock);
+    return 0;
   }
-  return 0;
+  if((*pte & PTE_U) == 0)
+    return -1;
+  if(write == 2)
+    return (*pte & PTE_X) ? 0 : -1;
+  if(!write)
+    return (*pte & PTE_R) ? 0 : -1;
+  if(*pte & PTE_W)
+    return 0;
+  if((*pte & PTE_COW) == 0)
+    return -1;
 
- err:
-  uvmunmap(new, 0, i, 1);
-  return -1;
+  // install the writable page only if no other thread
+  // changed the PTE meanwhile; otherwise just retry.
+  old = *pte;
+  pa = PTE2PA(old);
+  flags = (PTE_FLAGS(old) & ~PTE_COW) | PTE_W;
+  if(krefcnt((void*)pa) == 1){
+    // the other sharers have gone; no need to copy.
+    if(mm)
+      acquire(&mm->lock);
+    if(*pte == old)
+      *pte = PA2PTE(pa) | flags;
+    if(mm)
+      release(&mm->lock);
+    tlbinval(pagetable, PGROUNDDOWN(va), 1);
+    return 0;
+  }
+  if((mem = kalloc()) == 0){
+    // swapout() may sleep, and even take pa; start over.
+    return swapout() > 0 ? 0 : -1;
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  if(mm)
+    acquire(&mm->lock);
+  if(*pte != old){
+    if(mm)
+      release(&mm->lock);
+    kfree(mem);
+    return 0;
+  }
+  *pte = PA2PTE(mem) | flags;
+  if(mm)
+    release(&mm->lock);
+  tlbinval(pagetable, PGROUNDDOWN(va), 1);
+  kfree((void*)pa);
+  return 0;
 }
 
 // mark a PTE invalid for user access.
@@ -352,17 +684,140 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// The level-0 page-table page used by the last lookup, so that
+// a copy spanning many pages walks the page table only once per
+// 2MB instead of once per page.
+struct walkcache {
+  uint64 va;       // 2MB-aligned base of the range l0 maps
+  pte_t *l0;       // 0 if nothing cached yet
+};
+
+// Return the physical address of the user page at va, page-aligned,
+// faulting it in first if needed (for a write, breaking COW).
+// Returns 0 if the page isn't accessible that way.
+static uint64
+uvmpa(pagetable_t pagetable, uint64 va, int write, struct walkcache *wc)
+{
+  uint64 need = PTE_V | PTE_U | (write ? PTE_W : PTE_R);
+  pte_t *pte;
+
+  for(int tries = 0; ; tries++){
+    if(va >= MAXVA)
+      return 0;
+    if(wc->l0 && (va & ~(MEGAPGSIZE-1)) == wc->va){
+      pte = &wc->l0[PX(0, va)];
+    } else if((pte = walk(pagetable, va, 0)) != 0){
+      wc->va = va & ~(MEGAPGSIZE-1);
+      wc->l0 = pte - PX(0, va);
+    }
+    if(pte && (*pte & need) == need)
+      return PTE2PA(*pte);
+    // a fault that had to swap pages out may need a few tries.
+    if(tries > 8 || uvmfault(pagetable, va, write) < 0)
+      return 0;
+  }
+}
+
+// Return the physical address of the user page at va, faulted
+// in as for a copy, with an extra reference so that swapout()
+// leaves it alone: the disk may use it for O_DIRECT while the
+// process sleeps. kfree() of the address unpins it.
+// Returns 0 if the page isn't accessible that way.
+uint64
+uvmpin(pagetable_t pagetable, uint64 va, int write)
+{
+  struct walkcache wc = { 0, 0 };
+  uint64 pa;
+
+  if((pa = uvmpa(pagetable, PGROUNDDOWN(va), write, &wc)) != 0)
+    kaddref((void*)pa);
+  return pa;
+}
+
+// For a pipe write that gives the pipe the page at va rather
+// than a copy of it: take a reference to the page, and make
+// the current process's mapping copy-on-write, so that the
+// pipe keeps the contents as of now. Returns the physical
+// address, or 0 if va isn't a whole page below sz.
+uint64
+uvmgift(pagetable_t pagetable, uint64 va)
+{
+  struct mm *mm = myproc()->mm;
+  pte_t *pte;
+  uint64 pa;
+
+  if(va % PGSIZE || va + PGSIZE > mm->sz)
+    return 0;
+  if((pa = uvmpin(pagetable, va, 0)) == 0)
+    return 0;
+  acquire(&mm->lock);
+  if(va + PGSIZE > mm->sz || (pte = walk(pagetable, va, 0)) == 0 ||
+     (*pte & PTE_V) == 0 || PTE2PA(*pte) != pa){
+    // changed meanwhile.
+    release(&mm->lock);
+    kfree((void*)pa);
+    return 0;
+  }
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    release(&mm->lock);
+    tlbinval(pagetable, va, 1);
+  } else {
+    release(&mm->lock);
+  }
+  return pa;
+}
+
+// For a pipe read of a whole page: map pa at va in the
+// current process in place of what was there, taking over
+// the caller's reference to it, writable if no one else has
+// it and copy-on-write otherwise. Returns 0, or -1 if va
+// isn't a whole, writable page below sz; then the caller
+// keeps its reference.
+int
+uvmrecv(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  struct mm *mm = myproc()->mm;
+  pte_t *pte, old;
+  uint flags;
+
+  if(va % PGSIZE)
+    return -1;
+  acquire(&mm->lock);
+  if(va + PGSIZE > mm->sz || (pte = walk(pagetable, va, 1)) == 0){
+    release(&mm->lock);
+    return -1;
+  }
+  old = *pte;
+  if((old & PTE_V) && ((old & PTE_U) == 0 || (old & (PTE_W|PTE_COW)) == 0)){
+    release(&mm->lock);
+    return -1;  // e.g. the stack guard page
+  }
+  flags = PTE_V | PTE_R | PTE_X | PTE_U;
+  flags |= krefcnt((void*)pa) == 1 ? PTE_W : PTE_COW;
+  *pte = PA2PTE(pa) | flags;
+  release(&mm->lock);
+  if(old & PTE_V){
+    tlbinval(pagetable, va, 1);
+    kfree((void*)PTE2PA(old));
+  } else if(old & PTE_SWAP){
+    swapdrop(old);
+  }
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct walkcache wc = { 0, 0 };
   uint64 n, va0, pa0;
 
   while(len > 0){
-    va0 = (uint)PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    va0 = PGROUNDDOWN(dstva);
+    pa0 = uvmpa(pagetable, va0, 1, &wc);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -383,11 +838,12 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  struct walkcache wc = { 0, 0 };
   uint64 n, va0, pa0;
 
   while(len > 0){
-    va0 = (uint)PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    va0 = PGROUNDDOWN(srcva);
+    pa0 = uvmpa(pagetable, va0, 0, &wc);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -402,6 +858,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// non-zero if some byte of w is zero.
+#define HASZERO(w) (((w) - 0x0101010101010101L) & ~(w) & 0x8080808080808080L)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -409,12 +868,13 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  struct walkcache wc = { 0, 0 };
+  uint64 n, va0, pa0, w;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
-    va0 = (uint)PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    va0 = PGROUNDDOWN(srcva);
+    pa0 = uvmpa(pagetable, va0, 0, &wc);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -423,6 +883,21 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
     char *p = (char *) (pa0 + (srcva - va0));
     while(n > 0){
+      // a word at a time while no byte of it is zero.
+      if(n >= 8 && ((uint64)p & 7) == 0){
+        w = *(uint64*)p;
+        if(!HASZERO(w)){
+          if(((uint64)dst & 7) == 0)
+            *(uint64*)dst = w;
+          else
+            memmove(dst, p, 8);
+          n -= 8;
+          max -= 8;
+          p += 8;
+          dst += 8;
+          continue;
+        }
+      }
       if(*p == '\0'){
         *dst = '\0';
         got_null = 1;
@@ -16,30 +16,37 @@
 #endif
 
 #define NINODES 200
+#define DPB (BSIZE / sizeof(struct dirent))
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+// the log header plus about a sixteenth of the disk.
+int nlog = 1 + (FSSIZE/16 < LOGSIZE ? FSSIZE/16 : LOGSIZE);
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the image, built in memory and written out at the end
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootent[NINODES];
+int nrootent;
 
 
 void balloc(int);
+void ilayout(uint, uint);
+void wimage(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *de, int n);
 
 // convert to intel byte order
 ushort
@@ -68,10 +75,8 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -108,8 +113,10 @@ main(int argc, char *argv[])
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  if((img = calloc(FSSIZE, BSIZE)) == 0){
+    perror("calloc");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -118,25 +125,20 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  bzero(rootent, sizeof(rootent));
+  rootent[0].inum = xshort(rootino);
+  strcpy(rootent[0].name, ".");
+  rootent[1].inum = xshort(rootino);
+  strcpy(rootent[1].name, "..");
+  nrootent = 2;
 
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
+    // get rid of "user/", "kernel/", etc.
     char *shortname;
-    if(strncmp(argv[i], "user/", 5) == 0)
-      shortname = argv[i] + 5;
+    if((shortname = rindex(argv[i], '/')) != 0)
+      shortname++;
     else
       shortname = argv[i];
-    
-    assert(index(shortname, '/') == 0);
 
     if((fd = open(argv[i], 0)) < 0){
       perror(argv[i]);
@@ -152,40 +154,121 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nrootent < NINODES);
+    rootent[nrootent].inum = xshort(inum);
+    strncpy(rootent[nrootent].name, shortname, DIRSIZ);
+    nrootent++;
 
+    ilayout(inum, lseek(fd, 0, SEEK_END));
+    lseek(fd, 0, SEEK_SET);
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
 
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootent, nrootent);
 
   balloc(freeblock);
 
+  wimage();
   exit(0);
 }
 
+// Hash of a directory entry name; a copy of
+// dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+int
+dircmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the n entries of directory inum. Up to DIRLINEAR
+// blocks of them make a linear directory; more get an index,
+// laid out as the kernel's dxcreate() does it.
 void
-wsect(uint sec, void *buf)
+wdir(uint inum, struct dirent *de, int n)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
+  struct dxent dx[NDXENT];
+  struct dinode din;
+  char buf[BSIZE];
+  int i, j, nleaf, start[NDXENT];
+  uint off;
+
+  if(n < DIRLINEAR*DPB){
+    iappend(inum, de, n * sizeof(*de));
+    // leave room in the last block.
+    rinode(inum, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(inum, &din);
+    return;
   }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
-    exit(1);
+
+  qsort(de, n, sizeof(*de), dircmp);
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    assert(nleaf < NDXENT);
+    start[nleaf++] = i;
+    for(j = i + DXFILL; j < n && dirhash(de[j].name) == dirhash(de[j-1].name); j++)
+      ;
+    if(j > n)
+      j = n;
+    assert(j - i <= DPB);
+  }
+
+  bzero(dx, sizeof(dx));
+  for(i = 0; i < nleaf; i++){
+    dx[i].hash = xint(i == 0 ? 0 : dirhash(de[start[i]].name));
+    dx[i].blk = xint(i + 1);
   }
+  iappend(inum, dx, sizeof(dx));
+  for(i = 0; i < nleaf; i++){
+    j = i + 1 < nleaf ? start[i+1] : n;
+    bzero(buf, sizeof(buf));
+    memmove(buf, &de[start[i]], (j - start[i]) * sizeof(*de));
+    iappend(inum, buf, sizeof(buf));
+  }
+  rinode(inum, &din);
+  din.major = xshort(DIRINDEXED);
+  winode(inum, &din);
+}
+
+// Write the image out, in large sequential chunks.
+void
+wimage(void)
+{
+  size_t off, n, chunk = 1024*1024;
+
+  for(off = 0; off < (size_t)FSSIZE*BSIZE; off += n){
+    n = (size_t)FSSIZE*BSIZE - off < chunk ? (size_t)FSSIZE*BSIZE - off : chunk;
+    if(write(fsfd, img + off, n) != n){
+      perror("write");
+      exit(1);
+    }
+  }
+}
+
+void
+wsect(uint sec, void *buf)
+{
+  assert(sec < FSSIZE);
+  memmove(img + (size_t)sec*BSIZE, buf, BSIZE);
 }
 
 void
@@ -218,14 +301,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  assert(sec < FSSIZE);
+  memmove(buf, img + (size_t)sec*BSIZE, BSIZE);
 }
 
 uint
@@ -258,13 +335,58 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+// The block number at index i of indirect block bn.
+uint*
+bmapent(uint bn, uint i)
+{
+  assert(bn < FSSIZE && i < NINDIRECT);
+  return (uint*)(img + (size_t)bn*BSIZE) + i;
+}
+
+// Give inum, which is empty, all the blocks for size bytes of
+// data at once, in one run from freeblock: its indirect blocks
+// first, then the data in order, so that the kernel can read
+// the whole file in a few large requests. iappend() then only
+// fills them in.
+void
+ilayout(uint inum, uint size)
+{
+  struct dinode din;
+  uint nb, i, x, dbn;
+
+  nb = (size + BSIZE - 1) / BSIZE;
+  assert(nb <= MAXFILE);
+  assert(freeblock + nb + 2 + nb / NINDIRECT <= FSSIZE);
+  rinode(inum, &din);
+  if(nb > NDIRECT)
+    din.addrs[NDIRECT] = xint(freeblock++);
+  if(nb > NDIRECT + NINDIRECT){
+    din.addrs[NDIRECT+1] = xint(freeblock++);
+    for(i = 0; i * NINDIRECT < nb - NDIRECT - NINDIRECT; i++)
+      *bmapent(xint(din.addrs[NDIRECT+1]), i) = xint(freeblock++);
+  }
+  for(i = 0; i < nb; i++){
+    x = xint(freeblock++);
+    if(i < NDIRECT){
+      din.addrs[i] = x;
+    } else if(i < NDIRECT + NINDIRECT){
+      *bmapent(xint(din.addrs[NDIRECT]), i - NDIRECT) = x;
+    } else {
+      dbn = i - NDIRECT - NINDIRECT;
+      *bmapent(xint(*bmapent(xint(din.addrs[NDIRECT+1]), dbn / NINDIRECT)),
+                dbn % NINDIRECT) = x;
+    }
+  }
+  winode(inum, &din);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, bn, off, n1;
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
@@ -281,7 +403,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -291,6 +413,24 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      // through the double-indirect block.
+      bn = fbn - NDIRECT - NINDIRECT;
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      if(indirect[bn / NINDIRECT] == 0){
+        indirect[bn / NINDIRECT] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      x = xint(indirect[bn / NINDIRECT]);
+      rsect(x, (char*)indirect);
+      if(indirect[bn % NINDIRECT] == 0){
+        indirect[bn % NINDIRECT] = xint(freeblock++);
+        wsect(x, (char*)indirect);
+      }
+      x = xint(indirect[bn % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -102,10 +102,56 @@ void test1()
   }
 }
 
+// Several processes allocate and free memory at the same time,
+// to measure how well the page allocator scales.
+void test2()
+{
+  enum { NCHILD = 4, ROUNDS = 200, NPAGE = 64 };
+  int i, j, start;
+  char *a;
+
+  printf("allocbench: start\n");
+  start = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < ROUNDS; j++){
+        a = sbrk(NPAGE*PGSIZE);
+        if(a == (char*)0xffffffffffffffffL)
+          exit(1);
+        for(char *q = a; q < a + NPAGE*PGSIZE; q += PGSIZE)
+          *(int*)q = j;
+        sbrk(-NPAGE*PGSIZE);
+      }
+      exit(0);
+    }
+  }
+
+  int all_ok = 1;
+  for(i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      all_ok = 0;
+  }
+  if(all_ok){
+    printf("allocbench: %d pages in %d ticks\n", NCHILD*ROUNDS*NPAGE,
+           uptime() - start);
+    printf("allocbench: OK\n");
+  } else {
+    printf("allocbench: FAILED\n");
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
   test0();
   test1();
+  test2();
   exit(0);
 }
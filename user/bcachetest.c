@@ -11,12 +11,14 @@
 
 void test0();
 void test1();
+void test2();
 
 int
 main(int argc, char *argv[])
 {
   test0();
   test1();
+  test2();
   exit(0);
 }
 
@@ -137,3 +139,31 @@ void test1()
   }
   printf("test1 done\n");
 }
+
+// shrink the cache to its minimum and grow it again.
+void test2()
+{
+  int i, n;
+
+  printf("start test2\n");
+  createfile("B2", BIG);
+  if((n = bcachesize(1)) != NBUF){
+    printf("test2: bcachesize(1) left %d buffers\n", n);
+    exit(-1);
+  }
+  for(i = 0; i < 10; i++)
+    readfile("B2", BIG);
+  if(bcachesize(0) != NBUF){
+    printf("test2: cache grew past its target\n");
+    exit(-1);
+  }
+  bcachesize(NBUFTARGET);
+  for(i = 0; i < 10; i++)
+    readfile("B2", BIG);
+  if((n = bcachesize(0)) <= NBUF){
+    printf("test2: cache didn't grow (%d buffers)\n", n);
+    exit(-1);
+  }
+  unlink("B2");
+  printf("test2 done: %d buffers\n", n);
+}
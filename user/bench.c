@@ -0,0 +1,454 @@
+//
+// micro-benchmarks.
+// usage: bench [name ...]
+// runs the named benchmarks, or all of them. each result is
+// a line "bench name value unit", for scripts (make bench).
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/disk.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10  // see timerinit()
+#define MINTICKS 20       // run each benchmark at least this long
+
+char buf[8192];
+
+// print a throughput of bytes in ticks as MB/s, with one decimal.
+void
+report(char *name, uint64 bytes, int ticks)
+{
+  uint64 tenths;
+
+  if(ticks <= 0)
+    ticks = 1;
+  tenths = bytes * 10 * TICKS_PER_SEC / ticks / (1024*1024);
+  printf("bench %s %d.%d MB/s\n", name, (int)(tenths / 10), (int)(tenths % 10));
+}
+
+// print a rate of n operations in ticks, per second.
+void
+reportops(char *name, int n, int ticks)
+{
+  if(ticks <= 0)
+    ticks = 1;
+  printf("bench %s %d ops/s\n", name, (int)((uint64)n * TICKS_PER_SEC / ticks));
+}
+
+// print the time each of n operations in ticks took.
+void
+reportlat(char *name, int n, int ticks)
+{
+  if(n <= 0)
+    n = 1;
+  printf("bench %s %d ns\n", name, (int)((uint64)ticks * (1000000000 / TICKS_PER_SEC) / n));
+}
+
+// a null system call: one that does nothing but return.
+// getpid() doesn't enter the kernel (see ulib.c).
+void
+syscallbench(void)
+{
+  int i, n = 0, start, t;
+
+  start = uptime();
+  while((t = uptime() - start) < MINTICKS)
+    for(i = 0; i < 1000; i++, n++)
+      sysgetpid();
+  reportlat("syscall", n, t);
+}
+
+// start a process and wait for it: by fork() and exit(),
+// fork() and exec() of a program that exits at once, and
+// spawn() of one.
+void
+procbench(void)
+{
+  char *argv[] = { "bench", "-exit", 0 };
+  int n, pid, start, how;
+  char *name[] = { "fork-exit", "fork-exec", "spawn" };
+
+  for(how = 0; how < 3; how++){
+    start = uptime();
+    for(n = 0; uptime() - start < MINTICKS; n++){
+      if(how == 2)
+        pid = spawn("bench", argv, 0);
+      else if((pid = fork()) == 0){
+        if(how == 1)
+          exec("bench", argv);
+        exit(0);
+      }
+      if(pid < 0){
+        printf("bench: %s failed\n", name[how]);
+        exit(1);
+      }
+      wait(0);
+    }
+    reportlat(name[how], n, uptime() - start);
+  }
+}
+
+// bounce a byte between two processes through two pipes, for
+// latency; then stream through one, for throughput.
+void
+pipebench(void)
+{
+  enum { TOTAL = 64*1024*1024 };
+  int a[2], b[2], n, start, r;
+  uint64 bytes = 0;
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("bench: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    close(a[1]);
+    close(b[0]);
+    while(read(a[0], &c, 1) == 1)
+      write(b[1], &c, 1);
+    exit(0);
+  }
+  start = uptime();
+  for(n = 0; uptime() - start < MINTICKS; n++){
+    write(a[1], &c, 1);
+    if(read(b[0], &c, 1) != 1){
+      printf("bench: pipe read failed\n");
+      exit(1);
+    }
+  }
+  reportlat("pipe-pingpong", n, uptime() - start);
+  close(a[1]);
+  close(b[0]);
+  wait(0);
+  close(a[0]);
+  close(b[1]);
+
+  if(pipe(a) < 0){
+    printf("bench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(a[0]);
+    for(n = 0; n < TOTAL; n += sizeof(buf))
+      write(a[1], buf, sizeof(buf));
+    exit(0);
+  }
+  close(a[1]);
+  while((r = read(a[0], buf, sizeof(buf))) > 0)
+    bytes += r;
+  report("pipe", bytes, uptime() - start);
+  close(a[0]);
+  wait(0);
+}
+
+// write a file sequentially, then read it back, once from
+// the buffer cache and once with the cache shrunk so that
+// it has to come from the disk.
+void
+seqbench(void)
+{
+  enum { FSIZE = 4*1024*1024 };
+  char *f = "bench.seq";
+  int fd, i, start, old, uncached;
+  uint64 bytes;
+
+  unlink(f);
+  start = uptime();
+  if((fd = open(f, O_CREATE|O_WRONLY)) < 0){
+    printf("bench: create %s failed\n", f);
+    exit(1);
+  }
+  for(i = 0; i < FSIZE; i += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bench: write %s failed\n", f);
+      exit(1);
+    }
+  close(fd);
+  report("write-seq", FSIZE, uptime() - start);
+
+  old = bcachesize(0);
+  for(uncached = 0; uncached < 2; uncached++){
+    if(uncached)
+      bcachesize(1);  // as small as it goes; evicts the file
+    start = uptime();
+    bytes = 0;
+    if((fd = open(f, O_RDONLY)) < 0){
+      printf("bench: open %s failed\n", f);
+      exit(1);
+    }
+    while((i = read(fd, buf, sizeof(buf))) > 0)
+      bytes += i;
+    close(fd);
+    report(uncached ? "read-seq-uncached" : "read-seq", bytes, uptime() - start);
+  }
+  bcachesize(old);
+  unlink(f);
+}
+
+// grow the heap, touch each new page to fault it in, and
+// shrink it again; per page.
+void
+faultbench(void)
+{
+  enum { NPAGE = 256 };
+  int i, n = 0, start, t;
+  char *p;
+
+  start = uptime();
+  while((t = uptime() - start) < MINTICKS){
+    if((p = sbrk(NPAGE * 4096)) == (char*)-1){
+      printf("bench: sbrk failed\n");
+      exit(1);
+    }
+    for(i = 0; i < NPAGE; i++)
+      p[i * 4096] = 1;
+    sbrk(-NPAGE * 4096);
+    n += NPAGE;
+  }
+  reportlat("sbrk-fault", n, t);
+}
+
+// read() a file small enough to stay in the buffer cache,
+// over and over, in chunks of n bytes. measures the syscall
+// path and the copy to user memory, not the disk.
+void
+readn(char *name, int n)
+{
+  enum { FSIZE = 16*1024 };
+  char *f = "bench.tmp";
+  uint64 bytes = 0;
+  int fd, i, start, r;
+
+  unlink(f);
+  if((fd = open(f, O_CREATE|O_WRONLY)) < 0){
+    printf("bench: create %s failed\n", f);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < FSIZE; i += sizeof(buf))
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  if((fd = open(f, O_RDONLY)) < 0){
+    printf("bench: open %s failed\n", f);
+    exit(1);
+  }
+  start = uptime();
+  while(uptime() - start < MINTICKS){
+    for(i = 0; i < 100; i++){
+      while((r = read(fd, buf, n)) > 0)
+        bytes += r;
+      close(fd);
+      fd = open(f, O_RDONLY);
+    }
+  }
+  report(name, bytes, uptime() - start);
+  close(fd);
+  unlink(f);
+}
+
+void
+readbench(void)
+{
+  readn("read-512", 512);
+  readn("read-8192", 8192);
+}
+
+// NCHILD processes create, write and unlink small files at
+// once. each operation is a small transaction, so this
+// measures how well the log merges their commits.
+void
+createbench(void)
+{
+  enum { NCHILD = 4 };
+  char name[] = "bench.c?";
+  int i, n, fd, start, xstatus, tot = 0;
+
+  start = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      name[7] = '0' + i;
+      for(n = 0; uptime() - start < MINTICKS; n++){
+        if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+          printf("bench: create %s failed\n", name);
+          exit(-1);
+        }
+        write(fd, "x", 1);
+        close(fd);
+        unlink(name);
+      }
+      exit(n);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus < 0)
+      exit(1);
+    tot += xstatus;
+  }
+  reportops("create", tot, uptime() - start);
+}
+
+// open() and close() a file some directories down, over and
+// over. measures path name lookup.
+void
+openbench(void)
+{
+  char *dirs[] = { "bench.d", "bench.d/a", "bench.d/a/b", "bench.d/a/b/c" };
+  char *f = "bench.d/a/b/c/file";
+  int i, n, fd, start;
+
+  for(i = 0; i < 4; i++)
+    mkdir(dirs[i]);
+  if((fd = open(f, O_CREATE|O_WRONLY)) < 0){
+    printf("bench: create %s failed\n", f);
+    exit(1);
+  }
+  close(fd);
+
+  start = uptime();
+  for(n = 0; uptime() - start < MINTICKS; n++){
+    if((fd = open(f, O_RDONLY)) < 0){
+      printf("bench: open %s failed\n", f);
+      exit(1);
+    }
+    close(fd);
+  }
+  reportops("open", n, uptime() - start);
+
+  unlink(f);
+  for(i = 3; i >= 0; i--)
+    unlink(dirs[i]);
+}
+
+// one process creating, writing and unlinking a file, which
+// waits for a log commit each time: small synchronous disk
+// writes, with completions taken by interrupt and then by
+// polling.
+void
+diskbench(void)
+{
+  char *f = "bench.tmp";
+  int fd, n, start, old, poll;
+
+  if((old = diskmode(ROOTDEV, -1)) < 0){
+    printf("bench: diskmode failed\n");
+    exit(1);
+  }
+  for(poll = 0; poll < 2; poll++){
+    diskmode(ROOTDEV, poll ? old | DISK_POLL : old & ~DISK_POLL);
+    start = uptime();
+    for(n = 0; uptime() - start < MINTICKS; n++){
+      if((fd = open(f, O_CREATE|O_WRONLY)) < 0){
+        printf("bench: create %s failed\n", f);
+        exit(1);
+      }
+      write(fd, "x", 1);
+      close(fd);
+      unlink(f);
+    }
+    reportops(poll ? "disk-polled" : "disk", n, uptime() - start);
+  }
+  diskmode(ROOTDEV, old);
+}
+
+// run grep over a file of text lines, with output to a file,
+// for a literal pattern, which the prefilter finds, and a
+// regular expression, which the NFA has to run on every line.
+void
+grepn(char *name, char *pattern)
+{
+  char *f = "bench.grep", *argv[] = { "grep", pattern, f, 0 };
+  uint64 bytes = 0;
+  int start, pid;
+
+  start = uptime();
+  while(uptime() - start < MINTICKS){
+    pid = fork();
+    if(pid < 0){
+      printf("bench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      unlink("bench.out");
+      if(open("bench.out", O_CREATE|O_WRONLY) != 1)
+        exit(1);
+      exec("grep", argv);
+      exit(1);
+    }
+    wait(0);
+    bytes += 1024*1024;
+  }
+  report(name, bytes, uptime() - start);
+  unlink("bench.out");
+}
+
+void
+grepbench(void)
+{
+  char *f = "bench.grep";
+  int fd, i, j;
+
+  unlink(f);
+  if((fd = open(f, O_CREATE|O_WRONLY)) < 0){
+    printf("bench: create %s failed\n", f);
+    exit(1);
+  }
+  // 1MB of 64-byte lines.
+  for(i = 0; i < sizeof(buf); i += 64){
+    for(j = 0; j < 63; j++)
+      buf[i+j] = 'a' + (i/64 * 7 + j * 13) % 26;
+    buf[i+63] = '\n';
+  }
+  for(i = 0; i < 1024*1024; i += sizeof(buf))
+    write(fd, buf, sizeof(buf));
+  close(fd);
+  grepn("grep-literal", "qxzy");
+  grepn("grep-regexp", "a.*q.*z$");
+  unlink(f);
+}
+
+struct {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "syscall", syscallbench },
+  { "proc", procbench },
+  { "pipe", pipebench },
+  { "fault", faultbench },
+  { "read", readbench },
+  { "seq", seqbench },
+  { "create", createbench },
+  { "open", openbench },
+  { "disk", diskbench },
+  { "grep", grepbench },
+};
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, found;
+
+  if(argc == 2 && strcmp(argv[1], "-exit") == 0)
+    exit(0);  // for procbench()
+  for(i = 0; i < sizeof(benches)/sizeof(benches[0]); i++){
+    found = argc < 2;
+    for(j = 1; j < argc; j++)
+      if(strcmp(argv[j], benches[i].name) == 0)
+        found = 1;
+    if(found)
+      benches[i].fn();
+  }
+  exit(0);
+}
@@ -2,13 +2,20 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[512];
+char buf[65536];
 
 void
 cat(int fd)
 {
   int n;
 
+  // from a file to a pipe or the console, let the kernel
+  // move the data without copying it through buf.
+  while((n = sendfile(1, fd, -1, sizeof(buf))) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf("cat: write error\n");
@@ -1,42 +1,212 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled to a list of elements, each a
+// character (or . for any) that may be starred, and matched
+// a line at a time by running the NFA the list describes as
+// a bit vector, one bit per element, so that each character
+// of input costs a few instructions. If the pattern starts
+// with a literal string, lines without it are skipped
+// by a Boyer-Moore-Horspool search of the whole buffer.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+#define MAXELEM 63   // elements the bit vector has room for
+
+char buf[65536];
+char out[8192];
+int nout;
 int match(char*, char*);
 
+// the compiled pattern.
+struct {
+  int n;             // elements
+  int bol, eol;      // anchored by ^, $
+  uint64 mask[256];  // bit k set if element k matches the char
+  uint64 star;       // bit k set if element k is starred
+  char lit[MAXELEM]; // the literal the pattern starts with
+  int nlit;
+  int skip[256];     // Horspool's shifts for lit
+} re;
+
+// Compile pattern, parsing it as matchhere() does below.
+// Returns -1 if it's too long; then grep uses match().
+int
+compile(char *p)
+{
+  int c, i, star, lit = 1;
+
+  if(*p == '^'){
+    re.bol = 1;
+    p++;
+  }
+  for(; *p; p += star ? 2 : 1){
+    if(p[0] == '$' && p[1] == '\0'){
+      re.eol = 1;
+      break;
+    }
+    if(re.n == MAXELEM)
+      return -1;
+    star = p[1] == '*';
+    if(star)
+      re.star |= (uint64)1 << re.n;
+    for(c = 1; c < 256; c++)
+      if(p[0] == '.' || p[0] == c)
+        re.mask[c] |= (uint64)1 << re.n;
+    if(lit && !star && p[0] != '.')
+      re.lit[re.nlit++] = p[0];
+    else
+      lit = 0;
+    re.n++;
+  }
+  for(c = 0; c < 256; c++)
+    re.skip[c] = re.nlit;
+  for(i = 0; i < re.nlit - 1; i++)
+    re.skip[re.lit[i] & 0xff] = re.nlit - 1 - i;
+  return 0;
+}
+
+// Add the states reachable by skipping starred elements.
+static uint64
+closure(uint64 d)
+{
+  uint64 e;
+
+  while((e = d | ((d & re.star) << 1)) != d)
+    d = e;
+  return d;
+}
+
+// Does the compiled pattern match the line s[0..n)?
+int
+nfamatch(char *s, int n)
+{
+  uint64 d, m, start, accept = (uint64)1 << re.n;
+  int i;
+
+  start = closure(1);
+  d = start;
+  for(i = 0; ; i++){
+    if((d & accept) && (!re.eol || i == n))
+      return 1;
+    if(i == n || (d == 0 && re.bol))
+      return 0;
+    m = d & re.mask[s[i] & 0xff];
+    d = closure(((m & ~re.star) << 1) | (m & re.star));
+    if(!re.bol)
+      d |= start;
+  }
+}
+
+// The first occurrence of re.lit in s[0..n), or 0.
+char*
+findlit(char *s, int n)
+{
+  char *end = s + n - re.nlit;
+  int last = re.nlit - 1;
+
+  for(; s <= end; s += re.skip[s[last] & 0xff])
+    if(s[last] == re.lit[last] && memcmp(s, re.lit, last) == 0)
+      return s;
+  return 0;
+}
+
 void
-grep(char *pattern, int fd)
+flush(void)
 {
-  int n, m;
-  char *p, *q;
+  if(nout > 0)
+    write(1, out, nout);
+  nout = 0;
+}
 
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
+// Print the line s[0..n) and its newline.
+void
+emit(char *s, int n)
+{
+  if(nout + n + 1 > sizeof(out)){
+    flush();
+    if(n + 1 > sizeof(out)){
+      write(1, s, n);
+      write(1, "\n", 1);
+      return;
+    }
+  }
+  memmove(out + nout, s, n);
+  out[nout + n] = '\n';
+  nout += n + 1;
+}
+
+static char*
+eol(char *p, char *end)
+{
+  while(p < end && *p != '\n')
+    p++;
+  return p;
+}
+
+// Print the lines of p[0..n) that match, each ending at a
+// newline, or at end.
+void
+lines(char *pattern, char *p, char *end, int compiled)
+{
+  char *q, *l;
+
+  while(p < end){
+    if(compiled && re.nlit > 0 && !re.bol){
+      // skip to the line with the literal in it.
+      if((l = findlit(p, end - p)) == 0)
+        return;
+      while(l > p && l[-1] != '\n')
+        l--;
+      p = l;
+    }
+    q = eol(p, end);
+    if(compiled){
+      if((!re.bol || (q - p >= re.nlit && memcmp(p, re.lit, re.nlit) == 0)) &&
+         nfamatch(p, q - p))
+        emit(p, q - p);
+    } else {
       *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
+      if(match(pattern, p))
+        emit(p, q - p);
+      *q = '\n';
     }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    p = q + 1;
+  }
+}
+
+void
+grep(char *pattern, int fd, int compiled)
+{
+  int n, m;
+  char *p;
+
+  m = 0;
+  for(;;){
+    n = read(fd, buf+m, sizeof(buf)-m-1);
+    if(n <= 0){
+      if(m > 0)
+        lines(pattern, buf, buf + m, compiled);  // no newline at the end
+      break;
     }
+    m += n;
+    // up to the last newline, or all of a full buffer.
+    for(p = buf + m; p > buf && p[-1] != '\n'; p--)
+      ;
+    if(p == buf && m == sizeof(buf)-1)
+      p = buf + m;
+    lines(pattern, buf, p, compiled);
+    m -= p - buf;
+    memmove(buf, p, m);
   }
+  flush();
 }
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, compiled;
   char *pattern;
 
   if(argc <= 1){
@@ -44,9 +214,10 @@ main(int argc, char *argv[])
     exit(1);
   }
   pattern = argv[1];
+  compiled = compile(pattern) == 0;
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(pattern, 0, compiled);
     exit(0);
   }
 
@@ -55,7 +226,7 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(pattern, fd, compiled);
     close(fd);
   }
   exit(0);
@@ -63,6 +234,7 @@ main(int argc, char *argv[])
 
 // Regexp matcher from Kernighan & Pike,
 // The Practice of Programming, Chapter 9.
+// Used for patterns too long to compile.
 
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
@@ -102,4 +274,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
@@ -1,6 +1,7 @@
 // init: The initial user-level program
 
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
@@ -19,6 +20,13 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // the RAM disk, a scratch file system, on /tmp.
+  // major 0 is DISK; the minor is the device number.
+  mkdir("tmp");
+  mknod("ramdisk", 0, RAMDEV);
+  if(mount("ramdisk", "tmp") < 0)
+    printf("init: mount /tmp failed\n");
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
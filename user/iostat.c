@@ -0,0 +1,62 @@
+// print each block device's I/O statistics: cache hits,
+// disk traffic, request latency, queue depth, commit sizes.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/iostat.h"
+#include "kernel/logstat.h"
+#include "user/user.h"
+
+// print histogram h of n entries, and the entries holding
+// its median and 99th percentile.
+void
+hist(char *name, uint64 *h, int n)
+{
+  uint64 tot = 0, sum = 0;
+  int k, p50 = -1, p99 = -1;
+
+  for(k = 0; k < n; k++)
+    tot += h[k];
+  if(tot == 0)
+    return;
+  printf("  %s:", name);
+  for(k = 0; k < n; k++){
+    sum += h[k];
+    if(p50 < 0 && sum*2 >= tot)
+      p50 = k;
+    if(p99 < 0 && sum*100 >= tot*99)
+      p99 = k;
+    if(h[k])
+      printf(" %s%d:%d", k == n-1 ? ">=" : "<", 1 << (k == n-1 ? k-1 : k), (int)h[k]);
+  }
+  printf("\n  %s: p50 < %d, p99 < %d\n", name, 1 << p50, 1 << p99);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat st;
+  struct logstat ls;
+  uint64 n;
+  int dev;
+
+  for(dev = 0; dev < NDISK; dev++){
+    if(iostat(dev, &st) < 0)
+      continue;
+    n = st.hits + st.misses;
+    printf("dev %d: cache %d hits, %d misses (%d%% hits)\n", dev,
+           (int)st.hits, (int)st.misses, n ? (int)(st.hits * 100 / n) : 0);
+    printf("  %d reads, %d KB; %d writes, %d KB\n",
+           (int)st.nread, (int)(st.rbytes / 1024),
+           (int)st.nwrite, (int)(st.wbytes / 1024));
+    if(st.nsample > 0)
+      printf("  queue depth: average %d.%d, max %d\n",
+             (int)(st.depthsum / st.nsample),
+             (int)(st.depthsum * 10 / st.nsample % 10), (int)st.maxdepth);
+    hist("read us", st.rlat, NIOHIST);
+    hist("write us", st.wlat, NIOHIST);
+    if(logstat(dev, &ls) == 0)
+      hist("commit blocks", ls.sizes, NCOMMITHIST);
+  }
+  exit(0);
+}
@@ -0,0 +1,43 @@
+// print the most contended locks: lockstat [n]
+
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat st[NLOCKSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, top = 10;
+  struct lockstat t;
+
+  if(argc > 2){
+    fprintf(2, "usage: lockstat [n]\n");
+    exit(1);
+  }
+  if(argc == 2)
+    top = atoi(argv[1]);
+  if((n = lockstat(st, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: failed; is LOCKSTAT set in kernel/param.h?\n");
+    exit(1);
+  }
+
+  // most contended first, then most acquired.
+  for(i = 1; i < n; i++){
+    t = st[i];
+    for(j = i; j > 0 && (st[j-1].ncontend < t.ncontend ||
+        (st[j-1].ncontend == t.ncontend && st[j-1].nacquire < t.nacquire)); j--)
+      st[j] = st[j-1];
+    st[j] = t;
+  }
+
+  printf("name\t\tkind\tinits\tacquires\tcontended\twait\tmaxhold\n");
+  for(i = 0; i < n && i < top; i++){
+    printf("%s\t%s%s\t%d\t%d\t\t%d\t\t%d\t%d\n", st[i].name,
+           strlen(st[i].name) < 8 ? "\t" : "", st[i].sleep ? "sleep" : "spin",
+           st[i].nlocks, (int)st[i].nacquire, (int)st[i].ncontend,
+           (int)st[i].wait, (int)st[i].maxhold);
+  }
+  exit(0);
+}
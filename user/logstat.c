@@ -0,0 +1,31 @@
+// print each disk's log statistics.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/logstat.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10  // see timerinit()
+
+int
+main(int argc, char *argv[])
+{
+  struct logstat st;
+  int dev, ops, blocks, ms;
+
+  for(dev = 0; dev < NDISK; dev++){
+    if(logstat(dev, &st) < 0)
+      continue;  // no file system
+    ops = blocks = ms = 0;
+    if(st.ncommit > 0){
+      ops = st.nops / st.ncommit;
+      blocks = st.nblocks / st.ncommit;
+      ms = st.ticks * 1000 / TICKS_PER_SEC / st.ncommit;
+    }
+    printf("dev %d: %d ops, %d commits, %d blocks\n", dev,
+           (int)st.nops, (int)st.ncommit, (int)st.nblocks);
+    printf("dev %d: per commit %d ops, %d blocks, %d ms\n", dev,
+           ops, blocks, ms);
+  }
+  exit(0);
+}
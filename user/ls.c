@@ -22,12 +22,12 @@ fmtname(char *path)
   return buf;
 }
 
+struct dent ents[32];
+
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -47,24 +47,14 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+    // a batch of entries, with their stat, per system call.
+    while((n = getdents(fd, ents, sizeof(ents)/sizeof(ents[0]), GD_STAT)) > 0){
+      for(i = 0; i < n; i++)
+        printf("%s %d %d %d\n", fmtname(ents[i].name), ents[i].st.type,
+               ents[i].st.ino, ents[i].st.size);
     }
+    if(n < 0)
+      printf("ls: cannot read %s\n", path);
     break;
   }
   close(fd);
@@ -0,0 +1,60 @@
+//
+// malloc() and free() throughput.
+// usage: mallocbench
+// each test keeps NSLOT blocks live, and frees one and
+// allocates another at random, of sizes up to max bytes.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10  // see timerinit()
+#define MINTICKS 20       // run each benchmark at least this long
+#define NSLOT 512
+
+void *slot[NSLOT];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+churn(char *name, uint min, uint max)
+{
+  int i, n = 0, start, t;
+  uint s;
+
+  start = uptime();
+  while(uptime() - start < MINTICKS){
+    for(i = 0; i < 1000; i++, n++){
+      s = rnd() % NSLOT;
+      if(slot[s]){
+        free(slot[s]);
+        slot[s] = 0;
+      } else if((slot[s] = malloc(min + rnd() % (max - min + 1))) == 0){
+        printf("mallocbench: out of memory\n");
+        exit(1);
+      }
+    }
+  }
+  t = uptime() - start;
+  printf("%s: %d ops/s\n", name, n * TICKS_PER_SEC / (t > 0 ? t : 1));
+  for(s = 0; s < NSLOT; s++){
+    if(slot[s])
+      free(slot[s]);
+    slot[s] = 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  churn("malloc 8-64", 8, 64);
+  churn("malloc 8-256", 8, 256);
+  churn("malloc 1k-16k", 1024, 16384);
+  exit(0);
+}
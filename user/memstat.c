@@ -0,0 +1,37 @@
+// print the page allocator's statistics.
+
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+struct memstat st;
+
+int
+main(int argc, char *argv[])
+{
+  int k;
+
+  if(memstat(&st) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+
+  printf("buddy: %d KB in use, %d KB at most\n",
+         (int)(st.bdinuse / 1024), (int)(st.bdmaxinuse / 1024));
+  printf("buddy: %d splits, %d merges, %d lock spins\n",
+         (int)st.split, (int)st.merge, (int)st.bdspin);
+  printf("size\tblksz\tallocs\tfrees\tfree blocks\n");
+  for(k = 0; k < st.nsizes; k++){
+    if(st.alloc[k] == 0 && st.free[k] == 0 && st.freeblks[k] == 0)
+      continue;
+    printf("%d\t%d\t%d\t%d\t%d\n", k, st.leafsize << k,
+           (int)st.alloc[k], (int)st.free[k], (int)st.freeblks[k]);
+  }
+  printf("kalloc: %d allocs, %d frees, %d from zeroed pools, %d stolen\n",
+         (int)st.kalloc, (int)st.kfree, (int)st.kzeroed, (int)st.ksteal);
+  printf("kalloc: %d pages cached, %d pages zeroed, %d lock spins\n",
+         (int)st.kcached, (int)st.kpooled, (int)st.kspin);
+  printf("swap: %d of %d pages used, %d swapped out, %d swapped in\n",
+         (int)st.swapused, (int)st.swapsize, (int)st.swapout, (int)st.swapin);
+  exit(0);
+}
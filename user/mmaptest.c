@@ -0,0 +1,223 @@
+//
+// tests for mmap() and munmap().
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char*)0xffffffffffffffffL)
+
+char *testname = "???";
+char buf[PGSIZE];
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// make a file of 2.5 pages, with byte i = i % 251.
+void
+makefile(const char *f)
+{
+  char buf[BSIZE];
+  int i, n = PGSIZE*2 + PGSIZE/2;
+
+  unlink(f);
+  int fd = open(f, O_WRONLY | O_CREATE);
+  if(fd < 0)
+    err("open");
+  for(i = 0; i < n; i++){
+    buf[i % BSIZE] = i % 251;
+    if(i % BSIZE == BSIZE-1 || i == n-1)
+      if(write(fd, buf, i % BSIZE + 1) != i % BSIZE + 1)
+        err("write");
+  }
+  close(fd);
+}
+
+// check that p holds the beginning of makefile()'s file,
+// with zeros after its end.
+void
+checkfile(char *p, int len)
+{
+  for(int i = 0; i < len; i++){
+    int want = i < PGSIZE*2 + PGSIZE/2 ? i % 251 : 0;
+    if((p[i] & 0xff) != want)
+      err("wrong content");
+  }
+}
+
+// run f in a child, which should be killed.
+void
+mustfault(void (*f)(char*), char *p)
+{
+  int xstatus;
+  int pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    f(p);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    err("bad access was not killed");
+}
+
+void
+store(char *p)
+{
+  *p = 1;
+}
+
+void
+load(char *p)
+{
+  printf("%d", *(volatile char*)p);
+}
+
+void
+filetest()
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "private read";
+  printf("%s: ", testname);
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  checkfile(p, PGSIZE*3);
+  mustfault(store, p);
+  if(munmap(p, PGSIZE*3) < 0)
+    err("munmap");
+  mustfault(load, p);
+  printf("ok\n");
+
+  testname = "offset";
+  printf("%s: ", testname);
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 1) != MAP_FAILED)
+    err("unaligned offset accepted");
+  p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, PGSIZE);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(int i = 0; i < PGSIZE; i++)
+    if((p[i] & 0xff) != (PGSIZE + i) % 251)
+      err("wrong content");
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap");
+  close(fd);
+  printf("ok\n");
+
+  testname = "shared write";
+  printf("%s: ", testname);
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    err("writable shared mapping of read-only file");
+  close(fd);
+  if((fd = open(f, O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(int i = 0; i < PGSIZE*2; i++)
+    p[i] = 'Z';
+  // unmap the pages one at a time, from both ends.
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE*2, PGSIZE) < 0)
+    err("munmap");
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    err("munmap");
+  if(read(fd, buf, PGSIZE) != PGSIZE)
+    err("read");
+  for(int i = 0; i < PGSIZE; i++)
+    if(buf[i] != 'Z')
+      err("write-back");
+  close(fd);
+  struct stat st;
+  if(stat(f, &st) < 0 || st.size != PGSIZE*2 + PGSIZE/2)
+    err("file size changed");
+  printf("ok\n");
+
+  testname = "private write";
+  printf("%s: ", testname);
+  makefile(f);
+  if((fd = open(f, O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  p[0] = 'P';
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap");
+  if(read(fd, buf, 1) != 1 || buf[0] != 0)
+    err("private write reached the file");
+  close(fd);
+  unlink(f);
+  printf("ok\n");
+}
+
+void
+anontest()
+{
+  char *p, *q;
+  int xstatus;
+
+  testname = "anonymous";
+  printf("%s: ", testname);
+  p = mmap(0, PGSIZE*4, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  q = mmap(0, PGSIZE*4, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED)
+    err("mmap");
+  for(int i = 0; i < PGSIZE*4; i++)
+    if(p[i] != 0 || q[i] != 0)
+      err("not zero");
+  p[0] = 'a';
+  q[0] = 'a';
+
+  int pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(p[0] != 'a' || q[0] != 'a')
+      err("child content");
+    p[0] = 'c';
+    q[0] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(p[0] != 'a')
+    err("private page shared with child");
+  if(q[0] != 'c')
+    err("shared page not shared with child");
+  if(munmap(p + PGSIZE, PGSIZE) == 0)
+    err("munmap punched a hole");
+  if(munmap(p, PGSIZE*4) < 0 || munmap(q, PGSIZE*4) < 0)
+    err("munmap");
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  filetest();
+  anontest();
+  printf("ALL MMAP TESTS PASSED\n");
+  exit(0);
+}
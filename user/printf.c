@@ -9,7 +9,7 @@ static char digits[] = "0123456789ABCDEF";
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  bputc(fd, c);
 }
 
 static void
@@ -92,6 +92,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  bflushline(fd);
 }
 
 void
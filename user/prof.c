@@ -0,0 +1,266 @@
+// profile a command: prof [-n rows] command [args...]
+// prints where the CPUs spent their time while it ran,
+// by function, using /kernel.sym and each program's .sym.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NHIST 4096   // distinct (program, pc) pairs kept
+#define NSYMF 16     // symbol files loaded
+
+// samples per pc, filled in by the drain thread.
+struct hent {
+  uint64 pc;
+  int user;
+  char name[16];     // program, for a user pc
+  int n;
+} hist[NHIST];
+int nlost;           // samples that didn't fit in hist
+
+struct profsample buf[128];
+char drainstack[4096] __attribute__((aligned(16)));
+volatile int done;
+
+struct sym {
+  uint64 addr;
+  char *name;
+};
+
+struct symf {
+  char name[16];     // program, or "kernel"
+  struct sym *sym;   // 0 if it has no .sym file
+  int nsym;
+} symf[NSYMF];
+int nsymf;
+
+struct row {
+  char *where;
+  char *func;
+  int n;
+} row[NHIST];
+int nrow;
+
+void
+add(struct profsample *s)
+{
+  struct hent *h;
+  uint i, k;
+
+  k = s->pc >> 1;
+  for(i = 0; i < NHIST; i++){
+    h = &hist[(k + i) % NHIST];
+    if(h->n == 0){
+      h->pc = s->pc;
+      h->user = s->user;
+      strcpy(h->name, s->user ? s->name : "kernel");
+      h->n = 1;
+      return;
+    }
+    if(h->pc == s->pc && h->user == s->user &&
+       (!s->user || strcmp(h->name, s->name) == 0)){
+      h->n++;
+      return;
+    }
+  }
+  nlost++;
+}
+
+int
+drain(void)
+{
+  int i, n, total = 0;
+
+  while((n = prof(PROF_READ, buf, sizeof(buf)/sizeof(buf[0]))) > 0){
+    for(i = 0; i < n; i++)
+      add(&buf[i]);
+    total += n;
+  }
+  return total;
+}
+
+// keep the kernel's buffers from filling while the command runs.
+void
+drainer(void *arg)
+{
+  while(!done){
+    drain();
+    usleep(100000);
+  }
+}
+
+uint64
+hex(char **sp)
+{
+  uint64 x = 0;
+  char *s = *sp;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x*16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  *sp = s;
+  return x;
+}
+
+// Read an objdump symbol table, as the Makefile makes
+// kernel.sym and the programs' .sym files: "address name"
+// per line. Keeps function-like names only.
+void
+loadsyms(struct symf *f, char *path)
+{
+  struct stat st;
+  char *text, *s, *e, *name;
+  int fd, n;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (text = malloc(st.size + 1)) == 0){
+    close(fd);
+    return;
+  }
+  n = read(fd, text, st.size);
+  close(fd);
+  if(n < 0)
+    n = 0;
+  text[n] = 0;
+  for(s = text, n = 1; *s; s++)
+    if(*s == '\n')
+      n++;
+  if((f->sym = malloc(n * sizeof(struct sym))) == 0)
+    return;
+  for(s = text; *s; s = e){
+    for(e = s; *e && *e != '\n'; e++)
+      ;
+    if(*e)
+      *e++ = 0;
+    f->sym[f->nsym].addr = hex(&s);
+    if(*s++ != ' ')
+      continue;
+    name = s;
+    n = strlen(name);
+    if(name[0] == '.' || name[0] == '$' || name[0] == 0 ||
+       (n > 2 && name[n-2] == '.'))  // sections, labels, files
+      continue;
+    f->sym[f->nsym++].name = name;
+  }
+}
+
+struct symf*
+symfile(char *name)
+{
+  struct symf *f;
+  char path[32];
+
+  for(f = symf; f < &symf[nsymf]; f++)
+    if(strcmp(f->name, name) == 0)
+      return f;
+  if(nsymf == NSYMF)
+    return 0;
+  f = &symf[nsymf++];
+  strcpy(f->name, name);
+  strcpy(path, "/");
+  strcpy(path + 1, name);
+  strcpy(path + strlen(path), ".sym");
+  loadsyms(f, path);
+  return f;
+}
+
+// The function containing pc: the symbol with the highest
+// address at or below it.
+char*
+func(struct symf *f, uint64 pc)
+{
+  struct sym *s, *best = 0;
+
+  if(f == 0)
+    return "?";
+  for(s = f->sym; s < &f->sym[f->nsym]; s++)
+    if(s->addr <= pc && (best == 0 || s->addr > best->addr))
+      best = s;
+  return best ? best->name : "?";
+}
+
+void
+addrow(char *where, char *fn, int n)
+{
+  struct row *r;
+
+  for(r = row; r < &row[nrow]; r++){
+    if(r->func == fn && strcmp(r->where, where) == 0){
+      r->n += n;
+      return;
+    }
+  }
+  r->where = where;
+  r->func = fn;
+  r->n = n;
+  nrow++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, pid, tid, total, top = 20;
+  struct hent *h;
+  struct row t;
+
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    i = 3;
+  }
+  if(i >= argc){
+    fprintf(2, "usage: prof [-n rows] command [args...]\n");
+    exit(1);
+  }
+
+  if(prof(PROF_START, 0, 0) < 0){
+    fprintf(2, "prof: can't start profiling\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[i], argv + i);
+    fprintf(2, "prof: exec %s failed\n", argv[i]);
+    exit(1);
+  }
+  tid = thread_start(drainer, 0, drainstack, sizeof(drainstack));
+  wait(0);
+  prof(PROF_STOP, 0, 0);
+  done = 1;
+  if(tid >= 0)
+    join(tid, 0);
+  drain();
+
+  for(h = hist; h < &hist[NHIST]; h++)
+    if(h->n > 0)
+      addrow(h->name, func(symfile(h->name), h->pc), h->n);
+  for(i = 1; i < nrow; i++){
+    t = row[i];
+    for(j = i; j > 0 && row[j-1].n < t.n; j--)
+      row[j] = row[j-1];
+    row[j] = t;
+  }
+  total = nlost;
+  for(i = 0; i < nrow; i++)
+    total += row[i].n;
+
+  printf("samples\t%%\twhere\t\tfunction\n");
+  for(i = 0; i < nrow && i < top; i++)
+    printf("%d\t%d\t%s\t%s%s\n", row[i].n, row[i].n * 100 / total,
+           row[i].where, strlen(row[i].where) < 8 ? "\t" : "", row[i].func);
+  if(nlost > 0 || prof(PROF_DROP, 0, 0) > 0)
+    printf("(%d samples lost)\n", nlost + prof(PROF_DROP, 0, 0));
+  exit(0);
+}
@@ -0,0 +1,165 @@
+//
+// multi-core scaling workloads, for run-scale.
+// usage: scale nproc [workload ...]
+// runs each workload (or all of them) in nproc processes at
+// once for a fixed time, and prints a line per workload:
+// "scale workload nproc ops/s test-and-sets".
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10  // see timerinit()
+#define MINTICKS 20       // run each workload this long
+
+int start;
+
+int
+running(void)
+{
+  return uptime() - start < MINTICKS;
+}
+
+// page allocator churn, as in kalloctest.
+int
+alloc(int id)
+{
+  int n;
+  char *a;
+
+  for(n = 0; running(); n++){
+    if((a = sbrk(4096)) == (char*)-1)
+      exit(-1);
+    a[4] = 1;
+    sbrk(-4096);
+  }
+  return n;
+}
+
+// re-read a cached file of our own, as in bcachetest.
+int
+bread(int id)
+{
+  char file[] = "scale.f?", buf[512];
+  int n, fd;
+
+  file[7] = 'a' + id % 26;
+  if((fd = open(file, O_CREATE|O_WRONLY)) < 0)
+    exit(-1);
+  write(fd, buf, sizeof(buf));
+  close(fd);
+  for(n = 0; running(); n++){
+    if((fd = open(file, O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf))
+      exit(-1);
+    close(fd);
+  }
+  unlink(file);
+  return n;
+}
+
+// fork, exec and wait for a program that exits at once.
+int
+forkexec(int id)
+{
+  char *argv[] = { "scale", "-exit", 0 };
+  int n, pid;
+
+  for(n = 0; running(); n++){
+    if((pid = fork()) < 0)
+      exit(-1);
+    if(pid == 0){
+      exec("scale", argv);
+      exit(-1);
+    }
+    wait(0);
+  }
+  return n;
+}
+
+// bounce a byte with a process of our own through two pipes.
+int
+pingpong(int id)
+{
+  int a[2], b[2], n;
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0)
+    exit(-1);
+  if(fork() == 0){
+    close(a[1]);
+    close(b[0]);
+    while(read(a[0], &c, 1) == 1)
+      write(b[1], &c, 1);
+    exit(0);
+  }
+  close(a[0]);
+  close(b[1]);
+  for(n = 0; running(); n++){
+    write(a[1], &c, 1);
+    if(read(b[0], &c, 1) != 1)
+      exit(-1);
+  }
+  close(a[1]);
+  wait(0);
+  return n;
+}
+
+struct {
+  char *name;
+  int (*fn)(int);
+} workloads[] = {
+  { "alloc", alloc },
+  { "bread", bread },
+  { "forkexec", forkexec },
+  { "pipe", pingpong },
+};
+
+void
+run(char *name, int (*fn)(int), int nproc)
+{
+  int i, xstatus, ops = 0, tas, t;
+
+  tas = ntas();
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      exit(fn(i));
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus < 0){
+      printf("scale: %s failed\n", name);
+      exit(1);
+    }
+    ops += xstatus;
+  }
+  t = uptime() - start;
+  if(t <= 0)
+    t = 1;
+  printf("scale %s %d %d %d\n", name, nproc,
+         (int)((uint64)ops * TICKS_PER_SEC / t), ntas() - tas);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, nproc, found;
+
+  if(argc == 2 && strcmp(argv[1], "-exit") == 0)
+    exit(0);  // for forkexec()
+  if(argc < 2 || (nproc = atoi(argv[1])) < 1){
+    fprintf(2, "usage: scale nproc [workload ...]\n");
+    exit(1);
+  }
+  for(i = 0; i < sizeof(workloads)/sizeof(workloads[0]); i++){
+    found = argc < 3;
+    for(j = 2; j < argc; j++)
+      if(strcmp(argv[j], workloads[i].name) == 0)
+        found = 1;
+    if(found)
+      run(workloads[i].name, workloads[i].fn, nproc);
+  }
+  exit(0);
+}
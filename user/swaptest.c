@@ -0,0 +1,78 @@
+//
+// test swapping: several processes together use more
+// memory than the machine has, and check that every
+// page still holds what they wrote to it.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define NCHILD 3
+#define NPAGE  (48*1024*1024/PGSIZE)   // per child
+
+struct memstat st;
+
+void
+child(int id)
+{
+  char *a;
+  int i, pass;
+
+  a = sbrk(NPAGE*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("swaptest: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NPAGE; i++)
+    *(int*)(a + i*PGSIZE) = id*NPAGE + i;
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < NPAGE; i++){
+      if(*(int*)(a + i*PGSIZE) != id*NPAGE + i){
+        printf("swaptest: child %d page %d: wrong content\n", id, i);
+        exit(1);
+      }
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, xstatus, ok = 1;
+
+  printf("swaptest: start\n");
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("swaptest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      child(i);
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  if(memstat(&st) < 0){
+    printf("swaptest: memstat failed\n");
+    exit(1);
+  }
+  if(st.swapused != 0){
+    printf("swaptest: %d swap slots leaked\n", (int)st.swapused);
+    ok = 0;
+  }
+  if(!ok){
+    printf("swaptest: FAILED\n");
+    exit(1);
+  }
+  printf("swaptest: %d pages swapped out, %d in\n", (int)st.swapout, (int)st.swapin);
+  printf("swaptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,37 @@
+// time: run a command, then report how long it took
+// and what it used.
+// usage: time command [args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage r0, r1;
+  int t0, t1, xstatus;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [args...]\n");
+    exit(1);
+  }
+  getrusage(RUSAGE_CHILDREN, &r0);
+  t0 = uptime();
+  if(spawn(argv[1], argv + 1, 0) < 0){
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(&xstatus);
+  t1 = uptime();
+  getrusage(RUSAGE_CHILDREN, &r1);
+
+  fprintf(2, "real %d ms, user %d ms, sys %d ms\n", (t1 - t0) * 100,
+          (int)((r1.utime - r0.utime) / 1000), (int)((r1.stime - r0.stime) / 1000));
+  fprintf(2, "%d faults, %d blocks in, %d out, %d+%d switches\n",
+          (int)(r1.nfault - r0.nfault), (int)(r1.inblock - r0.inblock),
+          (int)(r1.oublock - r0.oublock), (int)(r1.nvcsw - r0.nvcsw),
+          (int)(r1.nivcsw - r0.nivcsw));
+  exit(xstatus);
+}
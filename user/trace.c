@@ -0,0 +1,179 @@
+// show the system call, scheduling and disk event trace:
+// trace [-p pid] command [args...], or trace [-p pid] [-t ticks]
+// with no command to watch everything for ticks (default 10).
+// Records the trace program makes itself are left out.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define TRACEDEV 2  // TRACE in kernel/file.h
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+char *sysname[] = {
+  [SYS_fork] "fork",
+  [SYS_exit] "exit",
+  [SYS_wait] "wait",
+  [SYS_pipe] "pipe",
+  [SYS_read] "read",
+  [SYS_kill] "kill",
+  [SYS_exec] "exec",
+  [SYS_fstat] "fstat",
+  [SYS_chdir] "chdir",
+  [SYS_dup] "dup",
+  [SYS_getpid] "getpid",
+  [SYS_sbrk] "sbrk",
+  [SYS_sleep] "sleep",
+  [SYS_uptime] "uptime",
+  [SYS_open] "open",
+  [SYS_write] "write",
+  [SYS_mknod] "mknod",
+  [SYS_unlink] "unlink",
+  [SYS_link] "link",
+  [SYS_mkdir] "mkdir",
+  [SYS_close] "close",
+  [SYS_ntas] "ntas",
+  [SYS_crash] "crash",
+  [SYS_mount] "mount",
+  [SYS_umount] "umount",
+  [SYS_mmap] "mmap",
+  [SYS_munmap] "munmap",
+  [SYS_memstat] "memstat",
+  [SYS_bcachesize] "bcachesize",
+  [SYS_logstat] "logstat",
+  [SYS_pread] "pread",
+  [SYS_pwrite] "pwrite",
+  [SYS_readv] "readv",
+  [SYS_writev] "writev",
+  [SYS_sendfile] "sendfile",
+  [SYS_diskmode] "diskmode",
+  [SYS_iostat] "iostat",
+  [SYS_setpriority] "setpriority",
+  [SYS_clone] "clone",
+  [SYS_join] "join",
+  [SYS_usleep] "usleep",
+  [SYS_spawn] "spawn",
+  [SYS_lockstat] "lockstat",
+  [SYS_prof] "prof",
+};
+
+char *statename[] = { "unused", "sleep", "runble", "run", "zombie" };
+
+struct trace buf[64];
+uint lastseq[NCPU];
+int fd, pid = -1, self, tid = -1;
+uint64 start;       // time of the first record, which times count from
+char drainstack[4096] __attribute__((aligned(16)));
+volatile int done;
+
+void
+show(struct trace *t)
+{
+  if(t->cpu >= 0 && t->cpu < NCPU){
+    if(lastseq[t->cpu] && t->seq != lastseq[t->cpu] + 1)
+      printf("cpu%d: %d records lost\n", t->cpu, t->seq - lastseq[t->cpu] - 1);
+    lastseq[t->cpu] = t->seq;
+  }
+  if(t->pid == self || t->pid == tid || (pid >= 0 && t->pid != pid))
+    return;
+  if(start == 0)
+    start = t->time;
+  printf("%d cpu%d pid %d ", (int)((t->time - start) / 10), t->cpu, t->pid);
+  switch(t->type){
+  case TR_SYSCALL:
+    if(t->num > 0 && t->num < NELEM(sysname) && sysname[t->num])
+      printf("%s", sysname[t->num]);
+    else
+      printf("syscall %d", t->num);
+    printf("(%p, %p, %p) = %d", t->arg[0], t->arg[1], t->arg[2], (int)t->ret);
+    break;
+  case TR_SCHED:
+    printf("ran until %s", t->num >= 0 && t->num < NELEM(statename) ? statename[t->num] : "?");
+    break;
+  case TR_DISK:
+    printf("disk %d %s block %d x%d", t->num, t->arg[2] ? "write" : "read",
+           (int)t->arg[0], (int)t->arg[1]);
+    break;
+  default:
+    printf("type %d", t->type);
+  }
+  printf(" %dus\n", (int)(t->dur / 10));
+}
+
+void
+drain(void)
+{
+  int i, n;
+
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    for(i = 0; i < n / sizeof(buf[0]); i++)
+      show(&buf[i]);
+}
+
+void
+drainer(void *arg)
+{
+  while(!done){
+    drain();
+    usleep(50000);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, child, ticks = 10;
+
+  for(i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2){
+    if(strcmp(argv[i], "-p") == 0)
+      pid = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-t") == 0)
+      ticks = atoi(argv[i+1]);
+    else
+      break;
+  }
+  if(i < argc && argv[i][0] == '-'){
+    fprintf(2, "usage: trace [-p pid] [-t ticks] [command [args...]]\n");
+    exit(1);
+  }
+
+  if((fd = open("trace", O_RDWR)) < 0){
+    mknod("trace", TRACEDEV, 0);
+    if((fd = open("trace", O_RDWR)) < 0){
+      fprintf(2, "trace: can't open trace\n");
+      exit(1);
+    }
+  }
+  self = getpid();
+  write(fd, "1", 1);
+
+  if(i < argc){
+    child = fork();
+    if(child < 0){
+      fprintf(2, "trace: fork failed\n");
+      exit(1);
+    }
+    if(child == 0){
+      close(fd);
+      exec(argv[i], argv + i);
+      fprintf(2, "trace: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    tid = thread_start(drainer, 0, drainstack, sizeof(drainstack));
+    wait(0);
+    done = 1;
+    if(tid >= 0)
+      join(tid, 0);
+  } else {
+    for(i = 0; i < ticks; i++){
+      drain();
+      sleep(1);
+    }
+  }
+  write(fd, "0", 1);
+  drain();
+  exit(0);
+}
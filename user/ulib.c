@@ -1,6 +1,11 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
+#include "kernel/futex.h"
 #include "user/user.h"
 
 char*
@@ -32,17 +37,6 @@ strlen(const char *s)
   return n;
 }
 
-void*
-memset(void *dst, int c, uint n)
-{
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
-  return dst;
-}
-
 char*
 strchr(const char *s, char c)
 {
@@ -95,15 +89,324 @@ atoi(const char *s)
   return n;
 }
 
+// memset(), memcmp() and memmove() as in kernel/string.c, a
+// 64-bit word at a time, for grep, cat and malloc's users.
+
+#define WSIZE       sizeof(uint64)
+#define ALIGNED(p)  (((uint64)(p) & (WSIZE-1)) == 0)
+#define COALIGNED(p, q)  ((((uint64)(p) ^ (uint64)(q)) & (WSIZE-1)) == 0)
+
 void*
-memmove(void *vdst, const void *vsrc, int n)
+memset(void *dst, int c, uint n)
+{
+  char *d = (char *) dst;
+  uint64 w, *wd;
+
+  for(; n > 0 && !ALIGNED(d); n--)
+    *d++ = c;
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64*)d;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (char*)wd;
+  }
+  for(; n > 0; n--)
+    *d++ = c;
+  return dst;
+}
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1, *s2;
+
+  s1 = v1;
+  s2 = v2;
+  if(COALIGNED(s1, s2)){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes below find which differs.
+    for(; n >= WSIZE && *(uint64*)s1 == *(uint64*)s2; n -= WSIZE){
+      s1 += WSIZE;
+      s2 += WSIZE;
+    }
+  }
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+
+  return 0;
+}
+
+void*
+memmove(void *dst, const void *src, int n)
+{
+  const char *s;
+  char *d;
+  const uint64 *ws;
+  uint64 *wd, w0, w1, w2, w3;
+
+  if(n <= 0)
+    return dst;
+  s = src;
+  d = dst;
+  if(s < d && s + n > d){
+    // dst overlaps the end of src: copy backwards. Each
+    // group of words is loaded before any is stored.
+    s += n;
+    d += n;
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        ws -= 4;
+        wd -= 4;
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
+    while(n-- > 0)
+      *--d = *--s;
+  } else {
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, ws += 4, wd += 4){
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
+    while(n-- > 0)
+      *d++ = *s++;
+  }
+
+  return dst;
+}
+
+// a new thread's first function; a points at {fn, arg}
+// on top of its stack.
+static void
+threadmain(void *a)
+{
+  void **fa = a;
+
+  ((void (*)(void*))fa[0])(fa[1]);
+  exit(0);
+}
+
+// Start a thread running fn(arg) on the stack of size bytes
+// at stack; it exits when fn returns. Returns its id, for
+// join(), or -1.
+int
+thread_start(void (*fn)(void*), void *arg, void *stack, int size)
 {
-  char *dst;
-  const char *src;
+  void **top;
 
-  dst = vdst;
-  src = vsrc;
-  while(n-- > 0)
-    *dst++ = *src++;
-  return vdst;
+  top = (void**)(((uint64)stack + size) & ~15L) - 2;
+  top[0] = fn;
+  top[1] = arg;
+  return clone(threadmain, top, top);
+}
+
+// A mutex is an int: 0 if unlocked, 1 if locked, 2 if locked
+// and someone may be waiting in futex(). Taking or releasing
+// it without contention never enters the kernel.
+void
+mutex_lock(int *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(m, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex(m, FUTEX_WAIT, 2);
+    c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(int *m)
+{
+  if(__sync_fetch_and_sub(m, 1) != 1){
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+    futex(m, FUTEX_WAKE, 1);
+  }
+}
+
+// A condition variable is an int that counts signals, so
+// that a signal between cond_wait()'s unlock of m and its
+// futex() isn't lost: the futex() sees the count changed.
+void
+cond_wait(int *cv, int *m)
+{
+  int seq = __atomic_load_n(cv, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex(cv, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(int *cv)
+{
+  __sync_fetch_and_add(cv, 1);
+  futex(cv, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(int *cv)
+{
+  __sync_fetch_and_add(cv, 1);
+  futex(cv, FUTEX_WAKE, 1 << 30);
+}
+
+// The kernel keeps these up to date in pages mapped
+// read-only into every process (see kernel/vdso.h),
+// which saves a trap into the kernel for each call.
+int
+getpid(void)
+{
+  int pid = ((volatile struct vproc*)VPROC)->pid;
+
+  if(pid == 0)
+    return sysgetpid();  // threads share the page
+  return pid;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
+
+// Buffered output, for printf() and fprintf(). Output to the
+// console, or to fd 2, goes out at the end of each printf();
+// to a file or pipe, when its buffer fills, or at fflush(),
+// close(), fork(), exec() or exit().
+#define OBUFSIZE 512
+#define OB_CALL 1  // flushed by bflushline()
+#define OB_FULL 2  // not
+
+struct obuf {
+  int mode;        // or 0 if not yet known
+  int n;
+  char buf[OBUFSIZE];
+} obuf[NOFILE];
+
+void
+fflush(int fd)
+{
+  struct obuf *b;
+
+  if(fd < 0 || fd >= NOFILE)
+    return;
+  b = &obuf[fd];
+  if(b->n > 0)
+    write(fd, b->buf, b->n);
+  b->n = 0;
+}
+
+static void
+flushall(void)
+{
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    fflush(fd);
+}
+
+void
+bputc(int fd, char c)
+{
+  struct obuf *b;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  b = &obuf[fd];
+  if(b->mode == 0){
+    if(fd == 2 || (fstat(fd, &st) == 0 && st.type == T_DEVICE))
+      b->mode = OB_CALL;
+    else
+      b->mode = OB_FULL;
+  }
+  b->buf[b->n++] = c;
+  if(b->n == OBUFSIZE)
+    fflush(fd);
+}
+
+// The end of a printf() to fd.
+void
+bflushline(int fd)
+{
+  if(fd >= 0 && fd < NOFILE && obuf[fd].mode == OB_CALL)
+    fflush(fd);
+}
+
+// These flush buffered output first, so that none is lost,
+// or written twice after fork(), or after a spawn()ed child's.
+int
+fork(void)
+{
+  flushall();
+  return sysfork();
+}
+
+int
+exit(int status)
+{
+  flushall();
+  sysexit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  flushall();
+  return sysexec(path, argv);
+}
+
+int
+spawn(char *path, char **argv, int *fds)
+{
+  flushall();
+  return sysspawn(path, argv, fds);
+}
+
+int
+close(int fd)
+{
+  fflush(fd);
+  if(fd >= 0 && fd < NOFILE)
+    obuf[fd].mode = 0;  // the fd may be reused for something else
+  return sysclose(fd);
 }
@@ -3,8 +3,12 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Small blocks, of up to NSMALL units of data, come from a
+// free list per size, so that malloc() and free() of them
+// don't search: a list is refilled a chunk at a time. The
+// rest use the allocator by Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7,
+// which asks sbrk() for geometrically more each time.
 
 typedef long Align;
 
@@ -18,8 +22,15 @@ union header {
 
 typedef union header Header;
 
+#define NSMALL 16          // units of data in the largest small block
+#define CHUNK 4096         // bytes of small blocks made at a time
+#define MINGROW 4096       // units of the first sbrk()
+#define MAXGROW (1 << 16)  // and the most it grows to
+
 static Header base;
 static Header *freep;
+static Header *smallfree[NSMALL+2];  // by size in units, with header
+static uint grow = MINGROW;
 
 void
 free(void *ap)
@@ -27,6 +38,11 @@ free(void *ap)
   Header *bp, *p;
 
   bp = (Header*)ap - 1;
+  if(bp->s.size <= NSMALL+1){
+    bp->s.ptr = smallfree[bp->s.size];
+    smallfree[bp->s.size] = bp;
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -48,25 +64,30 @@ morecore(uint nu)
 {
   char *p;
   Header *hp;
+  uint n;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
-    return 0;
+  // twice as much as last time, up to MAXGROW, unless
+  // there isn't that much memory to spare.
+  n = nu > grow ? nu : grow;
+  if((p = sbrk(n * sizeof(Header))) == (char*)-1){
+    n = nu;
+    if((p = sbrk(n * sizeof(Header))) == (char*)-1)
+      return 0;
+  }
+  if(grow < MAXGROW)
+    grow *= 2;
   hp = (Header*)p;
-  hp->s.size = nu;
+  hp->s.size = n;
   free((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// First fit from the K&R free list.
+static void*
+bigmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -88,3 +109,37 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Make a chunk's worth of free blocks of nunits.
+static int
+refill(uint nunits)
+{
+  Header *p;
+  uint n, i;
+
+  n = CHUNK / (nunits * sizeof(Header));
+  if((p = bigmalloc(n * nunits + 1)) == 0)  // and its own header
+    return -1;
+  for(i = 0; i < n; i++, p += nunits){
+    p->s.size = nunits;
+    p->s.ptr = smallfree[nunits];
+    smallfree[nunits] = p;
+  }
+  return 0;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits > NSMALL+1)
+    return bigmalloc(nunits);
+  if(smallfree[nunits] == 0 && refill(nunits) < 0)
+    return 0;
+  p = smallfree[nunits];
+  smallfree[nunits] = p->s.ptr;
+  return (void*)(p + 1);
+}
@@ -1,16 +1,25 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct lockstat;
+struct profsample;
+struct logstat;
+struct iovec;
+struct iostat;
+struct pollfd;
+struct rusage;
+struct dent;
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int sysfork(void);  // fork(), exit(), close(), exec() and spawn() are in ulib.c
+int sysexit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
-int close(int);
+int sysclose(int);
 int kill(int);
-int exec(char*, char**);
+int sysexec(char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -19,14 +28,39 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int sysgetpid(void);  // getpid() is in ulib.c
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
+int sysuptime(void);  // so is uptime()
 int ntas();
 int crash(const char*, int);
 int mount(char*, char *);
 int umount(char*);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int memstat(struct memstat*);
+int bcachesize(int);
+int logstat(int, struct logstat*);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int sendfile(int, int, int, int);
+int diskmode(int, int);
+int iostat(int, struct iostat*);
+int setpriority(int, int);
+int clone(void (*)(void*), void*, void*);  // shares memory, open files and cwd
+int join(int, int*);
+int usleep(int);
+int sysspawn(char*, char**, int*);
+int lockstat(struct lockstat*, int);
+int prof(int, struct profsample*, int);
+int shmget(int, int);
+int poll(struct pollfd*, int, int);
+int futex(int*, int, int);
+int dmesg(char*, int);
+int getrusage(int, struct rusage*);
+int getdents(int, struct dent*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,6 +73,23 @@ void printf(const char*, ...);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
+int memcmp(const void*, const void*, uint);
+int thread_start(void (*)(void*), void*, void*, int);
+void mutex_lock(int*);
+void mutex_unlock(int*);
+void cond_wait(int*, int*);
+void cond_signal(int*);
+void cond_broadcast(int*);
+int getpid(void);
+int uptime(void);
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int close(int);
+int exec(char*, char**);
+int spawn(char*, char**, int*);
+void bputc(int, char);
+void bflushline(int);
+void fflush(int);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
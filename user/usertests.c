@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/uio.h"
+#include "kernel/poll.h"
+#include "kernel/futex.h"
+#include "kernel/rusage.h"
 
 #define BUFSZ  (MAXOPBLOCKS+2)*BSIZE
 
@@ -122,7 +126,7 @@ opentest(void)
   int fd;
 
   printf("open test\n");
-  fd = open("echo", 0);
+  fd = open("/echo", 0);
   if(fd < 0){
     printf("open echo failed!\n");
     exit(1);
@@ -303,6 +307,35 @@ exectest(void)
   }
 }
 
+// exec() maps nothing of the program, so a new program's
+// first instruction fetch, and each later text page, faults.
+// grep is several pages of text, data and bss.
+void
+execfetchtest(void)
+{
+  char *args[] = { "grep", "xv6", "/README", 0 };
+  int pid, xstatus;
+
+  printf("exec fetch test\n");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    exec("/grep", args);
+    fprintf(2, "exec fetch: exec grep failed\n");
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("exec fetch: grep exited %d\n", xstatus);
+    exit(1);
+  }
+  printf("exec fetch test ok\n");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -835,227 +868,1300 @@ unlinkread(void)
   write(fd, "hello", SZ);
   close(fd);
 
-  fd = open("unlinkread", O_RDWR);
-  if(fd < 0){
-    printf("open unlinkread failed\n");
+  fd = open("unlinkread", O_RDWR);
+  if(fd < 0){
+    printf("open unlinkread failed\n");
+    exit(1);
+  }
+  if(unlink("unlinkread") != 0){
+    printf("unlink unlinkread failed\n");
+    exit(1);
+  }
+
+  fd1 = open("unlinkread", O_CREATE | O_RDWR);
+  write(fd1, "yyy", 3);
+  close(fd1);
+
+  if(read(fd, buf, sizeof(buf)) != SZ){
+    printf("unlinkread read failed");
+    exit(1);
+  }
+  if(buf[0] != 'h'){
+    printf("unlinkread wrong data\n");
+    exit(1);
+  }
+  if(write(fd, buf, 10) != 10){
+    printf("unlinkread write failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("unlinkread");
+  printf("unlinkread ok\n");
+}
+
+void
+linktest(void)
+{
+  enum { SZ = 5 };
+  int fd;
+
+  printf("linktest\n");
+
+  unlink("lf1");
+  unlink("lf2");
+
+  fd = open("lf1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("create lf1 failed\n");
+    exit(1);
+  }
+  if(write(fd, "hello", SZ) != SZ){
+    printf("write lf1 failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  if(link("lf1", "lf2") < 0){
+    printf("link lf1 lf2 failed\n");
+    exit(1);
+  }
+  unlink("lf1");
+
+  if(open("lf1", 0) >= 0){
+    printf("unlinked lf1 but it is still there!\n");
+    exit(1);
+  }
+
+  fd = open("lf2", 0);
+  if(fd < 0){
+    printf("open lf2 failed\n");
+    exit(1);
+  }
+  if(read(fd, buf, sizeof(buf)) != SZ){
+    printf("read lf2 failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  if(link("lf2", "lf2") >= 0){
+    printf("link lf2 lf2 succeeded! oops\n");
+    exit(1);
+  }
+
+  unlink("lf2");
+  if(link("lf2", "lf1") >= 0){
+    printf("link non-existant succeeded! oops\n");
+    exit(1);
+  }
+
+  if(link(".", "lf1") >= 0){
+    printf("link . lf1 succeeded! oops\n");
+    exit(1);
+  }
+
+  printf("linktest ok\n");
+}
+
+// test concurrent create/link/unlink of the same file
+void
+concreate(void)
+{
+  enum { N = 40 };
+  char file[3];
+  int i, pid, n, fd;
+  char fa[N];
+  struct {
+    ushort inum;
+    char name[DIRSIZ];
+  } de;
+
+  printf("concreate test\n");
+  file[0] = 'C';
+  file[2] = '\0';
+  for(i = 0; i < N; i++){
+    file[1] = '0' + i;
+    unlink(file);
+    pid = fork();
+    if(pid && (i % 3) == 1){
+      link("C0", file);
+    } else if(pid == 0 && (i % 5) == 1){
+      link("C0", file);
+    } else {
+      fd = open(file, O_CREATE | O_RDWR);
+      if(fd < 0){
+        printf("concreate create %s failed\n", file);
+        exit(1);
+      }
+      close(fd);
+    }
+    if(pid == 0)
+      exit(0);
+    else
+      wait(0);
+  }
+
+  memset(fa, 0, sizeof(fa));
+  fd = open(".", 0);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) > 0){
+    if(de.inum == 0)
+      continue;
+    if(de.name[0] == 'C' && de.name[2] == '\0'){
+      i = de.name[1] - '0';
+      if(i < 0 || i >= sizeof(fa)){
+        printf("concreate weird file %s\n", de.name);
+        exit(1);
+      }
+      if(fa[i]){
+        printf("concreate duplicate file %s\n", de.name);
+        exit(1);
+      }
+      fa[i] = 1;
+      n++;
+    }
+  }
+  close(fd);
+
+  if(n != N){
+    printf("concreate not enough files in directory listing\n");
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    file[1] = '0' + i;
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(((i % 3) == 0 && pid == 0) ||
+       ((i % 3) == 1 && pid != 0)){
+      close(open(file, 0));
+      close(open(file, 0));
+      close(open(file, 0));
+      close(open(file, 0));
+    } else {
+      unlink(file);
+      unlink(file);
+      unlink(file);
+      unlink(file);
+    }
+    if(pid == 0)
+      exit(0);
+    else
+      wait(0);
+  }
+
+  printf("concreate ok\n");
+}
+
+// another concurrent link/unlink/create test,
+// to look for deadlocks.
+void
+linkunlink()
+{
+  int pid, i;
+
+  printf("linkunlink test\n");
+
+  unlink("x");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+
+  unsigned int x = (pid ? 1 : 97);
+  for(i = 0; i < 100; i++){
+    x = x * 1103515245 + 12345;
+    if((x % 3) == 0){
+      close(open("x", O_RDWR | O_CREATE));
+    } else if((x % 3) == 1){
+      link("/cat", "x");
+    } else {
+      unlink("x");
+    }
+  }
+
+  if(pid)
+    wait(0);
+  else
+    exit(0);
+
+  printf("linkunlink ok\n");
+}
+
+// a small file lives in its inode; check that growing it
+// past that moves its contents into a block intact.
+void
+inlinefile(void)
+{
+  enum { N = 40 };
+  char b[N];
+  int i, fd, sz;
+
+  printf("inlinefile test\n");
+  unlink("inl");
+  for(sz = 0; sz < 3*N; sz += N){
+    // append N more bytes; the second time, they no longer fit.
+    fd = open("inl", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("inlinefile create failed\n");
+      exit(1);
+    }
+    while(read(fd, b, 1) == 1)
+      ;
+    for(i = 0; i < N; i++)
+      b[i] = 'a' + (sz + i) % 26;
+    if(write(fd, b, N) != N){
+      printf("inlinefile write failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open("inl", O_RDONLY);
+  for(i = 0; i < 3*N; i++){
+    if(read(fd, b, 1) != 1 || b[0] != 'a' + i % 26){
+      printf("inlinefile wrong content at %d\n", i);
+      exit(1);
+    }
+  }
+  if(read(fd, b, 1) != 0){
+    printf("inlinefile too long\n");
+    exit(1);
+  }
+  close(fd);
+  if(unlink("inl") < 0){
+    printf("inlinefile unlink failed\n");
+    exit(1);
+  }
+  printf("inlinefile ok\n");
+}
+
+// O_DIRECT reads and writes must agree with ordinary ones,
+// block-aligned or not.
+void
+directtest(void)
+{
+  enum { NB = 8 };
+  static char db[NB*BSIZE] __attribute__((aligned(BSIZE)));
+  int i, fd;
+
+  printf("direct test\n");
+  unlink("direct");
+  fd = open("direct", O_CREATE|O_WRONLY);
+  for(i = 0; i < NB*BSIZE; i++)
+    db[i] = i % 253;
+  if(fd < 0 || write(fd, db, NB*BSIZE) != NB*BSIZE){
+    printf("direct: write failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // read it back directly, then overwrite the middle.
+  fd = open("direct", O_RDWR|O_DIRECT);
+  memset(db, 0, sizeof(db));
+  if(fd < 0 || read(fd, db, 2*BSIZE) != 2*BSIZE){
+    printf("direct: read failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 2*BSIZE; i++)
+    if(db[i] != (char)(i % 253)){
+      printf("direct: wrong content\n");
+      exit(1);
+    }
+  memset(db, 'd', 4*BSIZE);
+  if(write(fd, db, 4*BSIZE) != 4*BSIZE){
+    printf("direct: direct write failed\n");
+    exit(1);
+  }
+  // an unaligned one goes through the cache.
+  if(write(fd, "xyz", 3) != 3){
+    printf("direct: unaligned write failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("direct", O_RDONLY);
+  if(fd < 0 || read(fd, db, NB*BSIZE) != NB*BSIZE){
+    printf("direct: read failed\n");
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < NB*BSIZE; i++){
+    int want = i % 253;
+    if(i >= 2*BSIZE && i < 6*BSIZE)
+      want = 'd';
+    else if(i >= 6*BSIZE && i < 6*BSIZE+3)
+      want = "xyz"[i - 6*BSIZE];
+    if(db[i] != (char)want){
+      printf("direct: wrong content at %d\n", i);
+      exit(1);
+    }
+  }
+  unlink("direct");
+  printf("direct ok\n");
+}
+
+// pread() and pwrite() use their own offset, not the fd's;
+// readv() and writev() move through several buffers at once.
+void
+preadtest(void)
+{
+  char a[10], b[20];
+  struct iovec iov[3];
+  int fd, p[2];
+
+  printf("pread test\n");
+  unlink("pread");
+  fd = open("pread", O_CREATE|O_RDWR);
+  iov[0].base = "hello, ";
+  iov[0].len = 7;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "world";
+  iov[2].len = 5;
+  if(fd < 0 || writev(fd, iov, 3) != 12){
+    printf("pread: writev failed\n");
+    exit(1);
+  }
+  if(pwrite(fd, "W", 1, 7) != 1 || pread(fd, b, 5, 7) != 5 ||
+     memcmp(b, "World", 5) != 0){
+    printf("pread: pwrite/pread failed\n");
+    exit(1);
+  }
+  // the fd's offset is still at the end.
+  if(read(fd, b, 1) != 0 || pread(fd, b, 20, 12) != 0){
+    printf("pread: offset moved\n");
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("pread", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  if(fd < 0 || readv(fd, iov, 2) != 12 ||
+     memcmp(a, "hello, Wor", 10) != 0 || memcmp(b, "ld", 2) != 0){
+    printf("pread: readv failed\n");
+    exit(1);
+  }
+  if(pwrite(fd, "x", 1, 0) != -1 || pread(fd, b, 1, -1) != -1){
+    printf("pread: bad pwrite/pread succeeded\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("pread");
+
+  // pipes have no offsets, but do have readv() and writev().
+  if(pipe(p) < 0){
+    printf("pread: pipe failed\n");
+    exit(1);
+  }
+  iov[0].base = "ab";
+  iov[0].len = 2;
+  iov[1].base = "cd";
+  iov[1].len = 2;
+  if(writev(p[1], iov, 2) != 4 || pread(p[0], b, 4, 0) != -1 ||
+     read(p[0], b, 4) != 4 || memcmp(b, "abcd", 4) != 0){
+    printf("pread: pipe failed\n");
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+  printf("pread ok\n");
+}
+
+// sendfile() copies a file into a pipe inside the kernel.
+void
+sendfiletest(void)
+{
+  enum { N = 3000 };  // more than a pipe holds
+  int fd, i, n, tot, p[2], pid, xstatus;
+
+  printf("sendfile test\n");
+  unlink("sendfile");
+  fd = open("sendfile", O_CREATE|O_RDWR);
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("sendfile: write failed\n");
+    exit(1);
+  }
+  // only pipes and devices take the data.
+  if(sendfile(fd, fd, 0, 10) != -1){
+    printf("sendfile: to a file succeeded\n");
+    exit(1);
+  }
+  if(pipe(p) < 0){
+    printf("sendfile: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("sendfile: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    // from offset 1 to the end, then nothing more.
+    if(sendfile(p[1], fd, 1, N) != N-1 || sendfile(p[1], fd, N, 10) != 0)
+      exit(1);
+    exit(0);
+  }
+  close(p[1]);
+  memset(buf, 0, N);
+  for(tot = 0; (n = read(p[0], buf + tot, N - tot)) > 0; tot += n)
+    ;
+  close(p[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || tot != N-1){
+    printf("sendfile: sent %d bytes\n", tot);
+    exit(1);
+  }
+  for(i = 0; i < N-1; i++)
+    if(buf[i] != 'a' + (i+1) % 26){
+      printf("sendfile: wrong content\n");
+      exit(1);
+    }
+  close(fd);
+  unlink("sendfile");
+  printf("sendfile ok\n");
+}
+
+// /tmp is the RAM disk, a file system of its own.
+void
+tmptest(void)
+{
+  struct stat st;
+  int fd, i;
+
+  printf("tmp test\n");
+  if(stat("/tmp", &st) < 0 || st.type != T_DIR || st.dev != RAMDEV){
+    printf("tmp: /tmp isn't the RAM disk\n");
+    exit(1);
+  }
+  fd = open("/tmp/t", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("tmp: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("tmp: write failed\n");
+      exit(1);
+    }
+  }
+  if(fstat(fd, &st) < 0 || st.dev != RAMDEV || st.size != 20*BSIZE){
+    printf("tmp: fstat wrong\n");
+    exit(1);
+  }
+  close(fd);
+  fd = open("/tmp/t", O_RDONLY);
+  for(i = 0; i < 20; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE-1] != i){
+      printf("tmp: read back wrong\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  if(link("/tmp/t", "tlink") == 0){
+    printf("tmp: link across file systems succeeded\n");
+    exit(1);
+  }
+  if(unlink("/tmp/t") < 0){
+    printf("tmp: unlink failed\n");
+    exit(1);
+  }
+  printf("tmp ok\n");
+}
+
+// setpriority() sets and reports base priorities, which fork
+// passes on.
+void
+priotest(void)
+{
+  int pid, xstatus;
+
+  printf("prio test\n");
+  if(setpriority(getpid(), 2) != 0 || setpriority(getpid(), -1) != 2){
+    printf("prio: set failed\n");
+    exit(1);
+  }
+  if(setpriority(getpid(), 99) != -1 || setpriority(-5, -1) != -1){
+    printf("prio: bad argument accepted\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("prio: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    exit(setpriority(getpid(), -1) == 2 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("prio: child didn't inherit priority\n");
+    exit(1);
+  }
+  setpriority(getpid(), 0);
+  printf("prio ok\n");
+}
+
+#define NCLONE 4
+static char clonestack[NCLONE][PGSIZE] __attribute__((aligned(16)));
+static int clonecount;
+static int cloneout[NCLONE];
+static char *clonemem;
+static int clonefd = -1;
+
+static void
+clonefn(void *arg)
+{
+  int i = (uint64)arg;
+
+  for(int j = 0; j < 1000; j++)
+    __sync_fetch_and_add(&clonecount, 1);
+  cloneout[i] = i * i;
+  if(i == 0){
+    // the heap is shared too.
+    clonemem = sbrk(PGSIZE);
+    clonemem[10] = 'x';
+  } else if(i == 1){
+    // and so are open files ...
+    clonefd = dup(1);
+  } else if(i == 2){
+    // ... and the cwd.
+    if(mkdir("clonedir") == 0)
+      chdir("clonedir");
+  }
+}
+
+// threads from clone() share memory, and join() reaps them.
+void
+clonetest(void)
+{
+  int i, tid[NCLONE], xstatus;
+
+  printf("clone test\n");
+  for(i = 0; i < NCLONE; i++){
+    tid[i] = thread_start(clonefn, (void*)(uint64)i, clonestack[i], PGSIZE);
+    if(tid[i] < 0){
+      printf("clone: thread_start failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != 0){
+      printf("clone: join failed\n");
+      exit(1);
+    }
+  }
+  if(join(tid[0], 0) != -1){
+    printf("clone: joined twice\n");
+    exit(1);
+  }
+  if(clonecount != NCLONE*1000){
+    printf("clone: count %d\n", clonecount);
+    exit(1);
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(cloneout[i] != i*i){
+      printf("clone: thread %d's result missing\n", i);
+      exit(1);
+    }
+  }
+  if(clonemem == 0 || clonemem[10] != 'x'){
+    printf("clone: sbrk() memory not shared\n");
+    exit(1);
+  }
+  if(clonefd < 0 || close(clonefd) < 0){
+    printf("clone: open file not shared\n");
+    exit(1);
+  }
+  if(chdir("..") < 0 || unlink("clonedir") < 0){
+    printf("clone: cwd not shared\n");
+    exit(1);
+  }
+  printf("clone ok\n");
+}
+
+// timed sleeps wake up no sooner than asked, and in
+// deadline order.
+void
+sleeptest(void)
+{
+  int fds[2], i, t0;
+  char c, order[4];
+
+  printf("sleep test\n");
+  t0 = uptime();
+  if(sleep(3) < 0 || uptime() - t0 < 3){
+    printf("sleep: woke early\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if(usleep(250000) < 0 || uptime() - t0 < 2){
+    printf("usleep: woke early\n");
+    exit(1);
+  }
+  if(sleep(-1) != -1 || usleep(-1) != -1){
+    printf("sleep: negative time accepted\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("sleep: pipe() failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("sleep: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // start in reverse order of wakeup.
+      usleep((4 - i) * 100000);
+      c = '0' + i;
+      write(fds[1], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < 4; i++){
+    if(read(fds[0], &order[i], 1) != 1){
+      printf("sleep: read failed\n");
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  for(i = 0; i < 4; i++)
+    wait(0);
+  for(i = 0; i < 4; i++){
+    if(order[i] != '3' - i){
+      printf("sleep: woke out of order\n");
+      exit(1);
+    }
+  }
+  printf("sleep ok\n");
+}
+
+// more processes at once than the process table used to
+// hold, found again by pid for kill().
+void
+manyproctest(void)
+{
+  enum { N = 100 };
+  int fds[2], i, pid[N], n;
+  char c;
+
+  printf("many proc test\n");
+  if(pipe(fds) < 0){
+    printf("manyproc: pipe() failed\n");
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pid[i] = fork();
+    if(pid[i] < 0){
+      printf("manyproc: fork %d failed\n", i);
+      exit(1);
+    }
+    if(pid[i] == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);  // until the parent closes fds[1]
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  for(i = 0; i < N; i += 2){
+    if(kill(pid[i]) < 0){
+      printf("manyproc: kill %d failed\n", pid[i]);
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  for(n = 0; wait(0) >= 0; n++)
+    ;
+  if(n != N){
+    printf("manyproc: waited for %d children\n", n);
+    exit(1);
+  }
+  if(kill(pid[0]) != -1){
+    printf("manyproc: killed a reaped child\n");
+    exit(1);
+  }
+  printf("many proc ok\n");
+}
+
+// spawn() starts a program with the descriptors it's given,
+// and no others.
+void
+spawntest(void)
+{
+  int fds[2], cfds[3], pid, xstatus, n;
+  char buf[16];
+  char *echoargv[] = { "echo", "spawned", 0 };
+  char *noargv[] = { "nosuchprogram", 0 };
+
+  printf("spawn test\n");
+  if(pipe(fds) < 0){
+    printf("spawn: pipe() failed\n");
+    exit(1);
+  }
+  cfds[0] = -1;
+  cfds[1] = fds[1];
+  cfds[2] = 2;
+  if((pid = spawn("echo", echoargv, cfds)) < 0){
+    printf("spawn: spawn echo failed\n");
+    exit(1);
+  }
+  close(fds[1]);
+  // the child has no copy of fds[1], so this sees EOF.
+  for(n = 0; n < sizeof(buf) - 1; ){
+    int m = read(fds[0], buf + n, sizeof(buf) - 1 - n);
+    if(m <= 0)
+      break;
+    n += m;
+  }
+  buf[n] = 0;
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("spawn: wait failed\n");
+    exit(1);
+  }
+  if(strcmp(buf, "spawned\n") != 0){
+    printf("spawn: wrong output %s\n", buf);
+    exit(1);
+  }
+  if(spawn("nosuchprogram", noargv, 0) != -1){
+    printf("spawn: spawned a missing program\n");
+    exit(1);
+  }
+  cfds[1] = NOFILE - 1;
+  if(spawn("echo", echoargv, cfds) != -1){
+    printf("spawn: accepted a closed fd\n");
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("spawn: failed spawn left a child\n");
+    exit(1);
+  }
+  printf("spawn ok\n");
+}
+
+int vdsopid;
+
+void
+vdsofn(void *arg)
+{
+  vdsopid = getpid();
+}
+
+// getpid() and uptime() read the VDSO and VPROC pages;
+// they must agree with the system calls, and be read-only.
+void
+vdsotest(void)
+{
+  int pid, tid, xstatus, t;
+
+  printf("vdso test\n");
+  if(getpid() != sysgetpid()){
+    printf("vdso: getpid %d, not %d\n", getpid(), sysgetpid());
+    exit(1);
+  }
+  t = uptime();
+  if(sysuptime() - t > 1 || uptime() < t){
+    printf("vdso: uptime %d, not %d\n", t, sysuptime());
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("vdso: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(getpid() != sysgetpid())
+      exit(1);
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("vdso: child's getpid wrong\n");
+    exit(1);
+  }
+
+  // threads share VPROC, but each has its own pid.
+  pid = fork();
+  if(pid == 0){
+    tid = thread_start(vdsofn, 0, clonestack[0], PGSIZE);
+    if(tid < 0 || join(tid, 0) != tid)
+      exit(1);
+    if(vdsopid != tid || getpid() != sysgetpid())
+      exit(1);
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("vdso: thread's getpid wrong\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    *(volatile int*)VPROC = 1;
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != -1){
+    printf("vdso: VPROC is writable\n");
+    exit(1);
+  }
+  printf("vdso ok\n");
+}
+
+// writes much bigger than the pipe's ring, read back in
+// pieces that don't line up with it.
+void
+pipebig(void)
+{
+  enum { N = 10000, NW = 3 };
+  int fds[2], pid, i, j, n, cc, xstatus;
+  static char wb[N];
+
+  printf("pipebig test\n");
+  if(pipe(fds) != 0){
+    printf("pipebig: pipe() failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("pipebig: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < NW; i++){
+      for(j = 0; j < N; j++)
+        wb[j] = (i * N + j) % 251;
+      if(write(fds[1], wb, N) != N){
+        printf("pipebig: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  n = 0;
+  while((cc = read(fds[0], buf, 777)) > 0){
+    for(j = 0; j < cc; j++, n++){
+      if((buf[j] & 0xff) != n % 251){
+        printf("pipebig: wrong byte %d\n", n);
+        exit(1);
+      }
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(n != N * NW || xstatus != 0){
+    printf("pipebig: read %d bytes\n", n);
+    exit(1);
+  }
+  printf("pipebig ok\n");
+}
+
+// page-aligned pipe writes and reads pass the pages
+// themselves; each side must still see its own copy.
+void
+pipegift(void)
+{
+  int fds[2], i;
+  char *a, *src, *dst;
+
+  printf("pipegift test\n");
+  a = sbrk(5*PGSIZE);
+  src = (char*)PGROUNDUP((uint64)a);
+  dst = src + 2*PGSIZE;
+  for(i = 0; i < 2*PGSIZE; i++)
+    src[i] = i % 199;
+  if(pipe(fds) != 0){
+    printf("pipegift: pipe() failed\n");
+    exit(1);
+  }
+  if(write(fds[1], src, 2*PGSIZE) != 2*PGSIZE ||
+     write(fds[1], "xyz", 3) != 3){
+    printf("pipegift: write failed\n");
+    exit(1);
+  }
+  memset(src, 'w', 2*PGSIZE);  // after the write: mustn't show
+  if(read(fds[0], dst, 2*PGSIZE) != 2*PGSIZE){
+    printf("pipegift: read failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 2*PGSIZE; i++){
+    if(dst[i] != i % 199){
+      printf("pipegift: wrong byte %d\n", i);
+      exit(1);
+    }
+  }
+  memset(dst, 'r', 2*PGSIZE);
+  if(src[0] != 'w' || src[2*PGSIZE-1] != 'w'){
+    printf("pipegift: reader's write showed in writer\n");
+    exit(1);
+  }
+  if(read(fds[0], dst, 3) != 3 || dst[0] != 'x' || dst[2] != 'z'){
+    printf("pipegift: lost the tail\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-5*PGSIZE);
+  printf("pipegift ok\n");
+}
+
+// a shared memory segment, mapped before fork() and after it
+// by key, is the same memory in every process.
+void
+shmtest(void)
+{
+  int fd, fd2, pid, xstatus;
+  char *hint = (char*)(MMAPTOP - 64*PGSIZE), *a, *b;
+
+  printf("shm test\n");
+  if((fd = shmget(0, 3*PGSIZE)) < 0){
+    printf("shm: shmget failed\n");
+    exit(1);
+  }
+  a = mmap(hint, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a != hint){
+    printf("shm: mmap at %p, not %p\n", a, hint);
+    exit(1);
+  }
+  close(fd);  // the mapping keeps the segment
+  a[0] = 'p';
+  pid = fork();
+  if(pid < 0){
+    printf("shm: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // touches a page the parent hasn't yet.
+    a[2*PGSIZE] = 'c';
+    exit(a[0] == 'p' ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[2*PGSIZE] != 'c'){
+    printf("shm: child and parent disagree\n");
+    exit(1);
+  }
+  munmap(a, 3*PGSIZE);
+
+  if((fd = shmget(7253, PGSIZE)) < 0){
+    printf("shm: keyed shmget failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fd);
+    if((fd2 = shmget(7253, PGSIZE)) < 0)
+      exit(1);
+    b = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd2, 0);
+    if(b == (char*)-1)
+      exit(1);
+    strcpy(b, "hello");
+    exit(0);
+  }
+  wait(&xstatus);
+  b = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(xstatus != 0 || b == (char*)-1 || strcmp(b, "hello") != 0){
+    printf("shm: keyed segment not shared\n");
+    exit(1);
+  }
+  if(shmget(7253, 2*PGSIZE) >= 0){
+    printf("shm: segment grew\n");
+    exit(1);
+  }
+  munmap(b, PGSIZE);
+  close(fd);
+  printf("shm ok\n");
+}
+
+// poll() waits on several pipes at once, wakes for the one
+// that becomes ready, and times out.
+void
+polltest(void)
+{
+  struct pollfd pfd[3];
+  int a[2], b[2], pid, n, t0;
+  char c;
+
+  printf("poll test\n");
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("poll: pipe failed\n");
     exit(1);
   }
-  if(unlink("unlinkread") != 0){
-    printf("unlink unlinkread failed\n");
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = a[1];
+  pfd[2].events = POLLOUT;
+  if(poll(pfd, 3, 0) != 1 || pfd[0].revents || pfd[1].revents ||
+     pfd[2].revents != POLLOUT){
+    printf("poll: wrong readiness of empty pipes\n");
     exit(1);
   }
 
-  fd1 = open("unlinkread", O_CREATE | O_RDWR);
-  write(fd1, "yyy", 3);
-  close(fd1);
+  pid = fork();
+  if(pid < 0){
+    printf("poll: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    usleep(200000);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  n = poll(pfd, 2, -1);
+  if(n != 1 || pfd[0].revents || pfd[1].revents != POLLIN){
+    printf("poll: woke with %d ready\n", n);
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("poll: read failed\n");
+    exit(1);
+  }
+  wait(0);
 
-  if(read(fd, buf, sizeof(buf)) != SZ){
-    printf("unlinkread read failed");
+  t0 = uptime();
+  if(poll(pfd, 2, 300) != 0){
+    printf("poll: ready without a writer\n");
     exit(1);
   }
-  if(buf[0] != 'h'){
-    printf("unlinkread wrong data\n");
+  if(uptime() - t0 < 2){
+    printf("poll: timed out early\n");
     exit(1);
   }
-  if(write(fd, buf, 10) != 10){
-    printf("unlinkread write failed\n");
+
+  close(b[1]);
+  pfd[2].fd = 99;
+  if(poll(pfd, 3, -1) != 2 || pfd[1].revents != POLLHUP ||
+     pfd[2].revents != POLLNVAL){
+    printf("poll: missed a closed pipe\n");
     exit(1);
   }
-  close(fd);
-  unlink("unlinkread");
-  printf("unlinkread ok\n");
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  printf("poll ok\n");
+}
+
+static int futexmu, futexcv, futexn, futexdone;
+
+static void
+futexfn(void *arg)
+{
+  for(int j = 0; j < 1000; j++){
+    mutex_lock(&futexmu);
+    futexn++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  futexdone++;
+  cond_signal(&futexcv);
+  mutex_unlock(&futexmu);
 }
 
+// futex()-based mutexes and condition variables among threads.
 void
-linktest(void)
+futextest(void)
 {
-  enum { SZ = 5 };
-  int fd;
+  int i, tid[NCLONE], x = 5;
 
-  printf("linktest\n");
+  printf("futex test\n");
+  if(futex(&x, FUTEX_WAIT, 6) != -1){
+    printf("futex: waited with the wrong value\n");
+    exit(1);
+  }
+  if(futex(&x, FUTEX_WAKE, 1) != 0){
+    printf("futex: woke someone\n");
+    exit(1);
+  }
+  for(i = 0; i < NCLONE; i++){
+    tid[i] = thread_start(futexfn, 0, clonestack[i], PGSIZE);
+    if(tid[i] < 0){
+      printf("futex: thread_start failed\n");
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexdone < NCLONE)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  for(i = 0; i < NCLONE; i++)
+    join(tid[i], 0);
+  if(futexn != NCLONE * 1000){
+    printf("futex: count %d, not %d\n", futexn, NCLONE * 1000);
+    exit(1);
+  }
+  printf("futex ok\n");
+}
 
-  unlink("lf1");
-  unlink("lf2");
+// getrusage() counts a child's time, faults and sleeps
+// once wait() has reaped it.
+void
+rusagetest(void)
+{
+  struct rusage r0, r1;
+  int pid, t;
 
-  fd = open("lf1", O_CREATE|O_RDWR);
-  if(fd < 0){
-    printf("create lf1 failed\n");
+  printf("rusage test\n");
+  if(getrusage(5, &r0) != -1){
+    printf("rusage: bad who accepted\n");
     exit(1);
   }
-  if(write(fd, "hello", SZ) != SZ){
-    printf("write lf1 failed\n");
+  if(getrusage(RUSAGE_CHILDREN, &r0) < 0){
+    printf("rusage: getrusage failed\n");
     exit(1);
   }
-  close(fd);
-
-  if(link("lf1", "lf2") < 0){
-    printf("link lf1 lf2 failed\n");
+  pid = fork();
+  if(pid < 0){
+    printf("rusage: fork failed\n");
     exit(1);
   }
-  unlink("lf1");
-
-  if(open("lf1", 0) >= 0){
-    printf("unlinked lf1 but it is still there!\n");
+  if(pid == 0){
+    buf[0] = 1;  // a copy-on-write fault
+    sleep(1);
+    for(t = uptime(); uptime() < t + 2; )
+      ;
+    getrusage(RUSAGE_SELF, &r1);
+    exit(r1.utime > 0 && r1.nfault > 0 && r1.nvcsw > 0 ? 0 : 1);
+  }
+  wait(&t);
+  if(t != 0){
+    printf("rusage: child saw no usage of its own\n");
     exit(1);
   }
-
-  fd = open("lf2", 0);
-  if(fd < 0){
-    printf("open lf2 failed\n");
+  getrusage(RUSAGE_CHILDREN, &r1);
+  if(r1.utime <= r0.utime || r1.utime - r0.utime > 10000000 ||
+     r1.nfault <= r0.nfault || r1.nvcsw <= r0.nvcsw){
+    printf("rusage: child's usage not counted\n");
     exit(1);
   }
-  if(read(fd, buf, sizeof(buf)) != SZ){
-    printf("read lf2 failed\n");
+  printf("rusage ok\n");
+}
+
+// one process can have more files open than NOFILE, and
+// the system more than NFILE; fork() copies them all.
+void
+manyfdtest(void)
+{
+  enum { N = NFILE + 20 };
+  int i, fd, xstatus;
+  struct stat st;
+
+  printf("many fd test\n");
+  if((fd = open("manyfd", O_CREATE|O_RDWR)) < 0){
+    printf("manyfd: create failed\n");
     exit(1);
   }
   close(fd);
-
-  if(link("lf2", "lf2") >= 0){
-    printf("link lf2 lf2 succeeded! oops\n");
+  for(i = 0; i < N; i++){
+    if((fd = open("manyfd", O_RDONLY)) < 0){
+      printf("manyfd: open %d failed\n", i);
+      exit(1);
+    }
+  }
+  if(fd < N){
+    printf("manyfd: last fd %d\n", fd);
     exit(1);
   }
-
-  unlink("lf2");
-  if(link("lf2", "lf1") >= 0){
-    printf("link non-existant succeeded! oops\n");
+  if(fork() == 0)
+    exit(fstat(fd, &st) < 0 || close(fd) < 0 || close(fd) != -1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("manyfd: child didn't get fd %d\n", fd);
     exit(1);
   }
-
-  if(link(".", "lf1") >= 0){
-    printf("link . lf1 succeeded! oops\n");
+  for(i = 3; i <= fd; i++)
+    close(i);
+  if((fd = open("manyfd", O_RDONLY)) != 3){
+    printf("manyfd: reopened as fd %d\n", fd);
     exit(1);
   }
-
-  printf("linktest ok\n");
+  close(fd);
+  unlink("manyfd");
+  printf("many fd ok\n");
 }
 
-// test concurrent create/link/unlink of the same file
+// getdents() returns a directory's entries in batches, with
+// the same stat that stat() of each name gives.
 void
-concreate(void)
+getdentstest(void)
 {
   enum { N = 40 };
-  char file[3];
-  int i, pid, n, fd;
-  char fa[N];
-  struct {
-    ushort inum;
-    char name[DIRSIZ];
-  } de;
+  struct dent d[7];
+  struct stat st;
+  char path[32];
+  int fd, i, n, total, files;
 
-  printf("concreate test\n");
-  file[0] = 'C';
-  file[2] = '\0';
+  printf("getdents test\n");
+  if(mkdir("gd") < 0){
+    printf("getdents: mkdir failed\n");
+    exit(1);
+  }
+  strcpy(path, "gd/f00");
   for(i = 0; i < N; i++){
-    file[1] = '0' + i;
-    unlink(file);
-    pid = fork();
-    if(pid && (i % 3) == 1){
-      link("C0", file);
-    } else if(pid == 0 && (i % 5) == 1){
-      link("C0", file);
-    } else {
-      fd = open(file, O_CREATE | O_RDWR);
-      if(fd < 0){
-        printf("concreate create %s failed\n", file);
-        exit(1);
-      }
-      close(fd);
+    path[4] = '0' + i / 10;
+    path[5] = '0' + i % 10;
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("getdents: create %s failed\n", path);
+      exit(1);
     }
-    if(pid == 0)
-      exit(0);
-    else
-      wait(0);
+    write(fd, path, i);
+    close(fd);
   }
-
-  memset(fa, 0, sizeof(fa));
-  fd = open(".", 0);
-  n = 0;
-  while(read(fd, &de, sizeof(de)) > 0){
-    if(de.inum == 0)
-      continue;
-    if(de.name[0] == 'C' && de.name[2] == '\0'){
-      i = de.name[1] - '0';
-      if(i < 0 || i >= sizeof(fa)){
-        printf("concreate weird file %s\n", de.name);
-        exit(1);
-      }
-      if(fa[i]){
-        printf("concreate duplicate file %s\n", de.name);
+  unlink("gd/f07");  // leaves a free slot
+  if((fd = open("gd", O_RDONLY)) < 0){
+    printf("getdents: open gd failed\n");
+    exit(1);
+  }
+  total = files = 0;
+  while((n = getdents(fd, d, 7, GD_STAT)) > 0){
+    for(i = 0; i < n; i++, total++){
+      strcpy(path, "gd/");
+      strcpy(path + 3, d[i].name);
+      if(stat(path, &st) < 0 || st.ino != d[i].st.ino ||
+         st.type != d[i].st.type || st.size != d[i].st.size){
+        printf("getdents: wrong stat for %s\n", path);
         exit(1);
       }
-      fa[i] = 1;
-      n++;
+      if(d[i].name[0] == 'f')
+        files++;
     }
   }
+  if(n < 0 || total != N + 1 || files != N - 1){
+    printf("getdents: %d entries, %d files\n", total, files);
+    exit(1);
+  }
   close(fd);
-
-  if(n != N){
-    printf("concreate not enough files in directory listing\n");
+  if((fd = open("gd/f00", O_RDONLY)) < 0 || getdents(fd, d, 7, 0) != -1){
+    printf("getdents: read a file as a directory\n");
     exit(1);
   }
-
+  close(fd);
   for(i = 0; i < N; i++){
-    file[1] = '0' + i;
-    pid = fork();
-    if(pid < 0){
-      printf("fork failed\n");
-      exit(1);
-    }
-    if(((i % 3) == 0 && pid == 0) ||
-       ((i % 3) == 1 && pid != 0)){
-      close(open(file, 0));
-      close(open(file, 0));
-      close(open(file, 0));
-      close(open(file, 0));
-    } else {
-      unlink(file);
-      unlink(file);
-      unlink(file);
-      unlink(file);
-    }
-    if(pid == 0)
-      exit(0);
-    else
-      wait(0);
+    strcpy(path, "gd/f00");
+    path[4] = '0' + i / 10;
+    path[5] = '0' + i % 10;
+    unlink(path);
   }
-
-  printf("concreate ok\n");
-}
-
-// another concurrent link/unlink/create test,
-// to look for deadlocks.
-void
-linkunlink()
-{
-  int pid, i;
-
-  printf("linkunlink test\n");
-
-  unlink("x");
-  pid = fork();
-  if(pid < 0){
-    printf("fork failed\n");
+  if(unlink("gd") < 0){
+    printf("getdents: unlink gd failed\n");
     exit(1);
   }
-
-  unsigned int x = (pid ? 1 : 97);
-  for(i = 0; i < 100; i++){
-    x = x * 1103515245 + 12345;
-    if((x % 3) == 0){
-      close(open("x", O_RDWR | O_CREATE));
-    } else if((x % 3) == 1){
-      link("cat", "x");
-    } else {
-      unlink("x");
-    }
-  }
-
-  if(pid)
-    wait(0);
-  else
-    exit(0);
-
-  printf("linkunlink ok\n");
+  printf("getdents ok\n");
 }
 
 // directory that uses indirect blocks
@@ -1905,7 +3011,7 @@ fsfull()
 void argptest()
 {
   int fd;
-  fd = open("init", O_RDONLY);
+  fd = open("/init", O_RDONLY);
   if (fd < 0) {
     fprintf(2, "open failed\n");
     exit(1);
@@ -1949,9 +3055,157 @@ stacktest()
   printf("stack guard test ok\n");
 }
 
+// the tests, in the order a plain "usertests" runs them.
+// With -j, all but the exclusive ones run at once, each in a
+// child of its own in a directory of its own; the exclusive
+// ones need memory, processes, the disk, the clock or "/" to
+// themselves, and run one at a time afterwards.
+struct test {
+  void (*f)(void);
+  char *s;
+  int excl;
+} tests[] = {
+  { reparent, "reparent", 0 },
+  { twochildren, "twochildren", 0 },
+  { forkfork, "forkfork", 0 },
+  { forkforkfork, "forkforkfork", 1 },
+  { argptest, "argptest", 0 },
+  { createdelete, "createdelete", 0 },
+  { linkunlink, "linkunlink", 0 },
+  { concreate, "concreate", 0 },
+  { fourfiles, "fourfiles", 0 },
+  { sharedfd, "sharedfd", 0 },
+  { bigargtest, "bigargtest", 1 },
+  { bigwrite, "bigwrite", 1 },
+  { bigargtest, "bigargtest", 1 },
+  { bsstest, "bsstest", 0 },
+  { sbrktest, "sbrktest", 1 },
+  { validatetest, "validatetest", 0 },
+  { stacktest, "stacktest", 0 },
+  { opentest, "opentest", 0 },
+  { writetest, "writetest", 0 },
+  { writetest1, "writetest1", 1 },
+  { createtest, "createtest", 0 },
+  { openiputtest, "openiputtest", 0 },
+  { exitiputtest, "exitiputtest", 0 },
+  { iputtest, "iputtest", 0 },
+  { mem, "mem", 1 },
+  { pipe1, "pipe1", 0 },
+  { preempt, "preempt", 1 },
+  { exitwait, "exitwait", 0 },
+  { rmdot, "rmdot", 1 },
+  { fourteen, "fourteen", 0 },
+  { bigfile, "bigfile", 1 },
+  { subdir, "subdir", 1 },
+  { linktest, "linktest", 0 },
+  { unlinkread, "unlinkread", 0 },
+  { dirfile, "dirfile", 0 },
+  { iref, "iref", 1 },
+  { forktest, "forktest", 1 },
+  { inlinefile, "inlinefile", 0 },
+  { directtest, "directtest", 0 },
+  { preadtest, "preadtest", 0 },
+  { sendfiletest, "sendfiletest", 0 },
+  { tmptest, "tmptest", 0 },
+  { priotest, "priotest", 0 },
+  { clonetest, "clonetest", 0 },
+  { sleeptest, "sleeptest", 1 },
+  { manyproctest, "manyproctest", 1 },
+  { spawntest, "spawntest", 1 },
+  { execfetchtest, "execfetchtest", 0 },
+  { vdsotest, "vdsotest", 0 },
+  { pipebig, "pipebig", 0 },
+  { pipegift, "pipegift", 0 },
+  { shmtest, "shmtest", 0 },
+  { polltest, "polltest", 0 },
+  { futextest, "futextest", 0 },
+  { rusagetest, "rusagetest", 0 },
+  { manyfdtest, "manyfdtest", 0 },
+  { getdentstest, "getdentstest", 0 },
+  { bigdir, "bigdir", 1 },
+};
+#define NTESTS (sizeof(tests)/sizeof(tests[0]))
+
+// start test t in a child, in its own directory unless
+// it's exclusive.
+int
+starttest(struct test *t)
+{
+  char dir[32];
+  int pid;
+
+  if((pid = fork()) < 0){
+    printf("usertests: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(!t->excl){
+      strcpy(dir, "ut.");
+      strcpy(dir + 3, t->s);
+      if(mkdir(dir) < 0 || chdir(dir) < 0){
+        printf("%s: can't make %s\n", t->s, dir);
+        exit(1);
+      }
+    }
+    t->f();
+    exit(0);
+  }
+  return pid;
+}
+
+// run the tests whose excl is excl, up to jobs at a time,
+// and report how each did. returns the number that failed.
+int
+runtests(int excl, int jobs)
+{
+  int pids[NTESTS], start[NTESTS], pid, xstatus, i;
+  int next = 0, running = 0, failed = 0;
+  char dir[32];
+
+  for(;;){
+    for(; next < NTESTS && running < jobs; next++){
+      pids[next] = 0;
+      if(tests[next].excl == excl){
+        start[next] = uptime();
+        pids[next] = starttest(&tests[next]);
+        running++;
+      }
+    }
+    if(running == 0)
+      return failed;
+    if((pid = wait(&xstatus)) < 0){
+      printf("usertests: wait failed\n");
+      exit(1);
+    }
+    for(i = 0; i < next && pids[i] != pid; i++)
+      ;
+    if(i == next)
+      continue;
+    pids[i] = 0;
+    running--;
+    printf("%s: %s, %d ms\n", tests[i].s, xstatus == 0 ? "OK" : "FAILED",
+           (uptime() - start[i]) * 100);
+    if(xstatus != 0)
+      failed++;
+    if(!excl){
+      strcpy(dir, "ut.");
+      strcpy(dir + 3, tests[i].s);
+      unlink(dir);
+    }
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
+  int i, n, jobs = 0;
+
+  if(argc == 3 && strcmp(argv[1], "-j") == 0)
+    jobs = atoi(argv[2]);
+  if(argc != 1 && jobs < 1){
+    printf("usage: usertests [-j jobs]\n");
+    exit(1);
+  }
   printf("usertests starting\n");
 
   if(open("usertests.ran", 0) >= 0){
@@ -1960,50 +3214,15 @@ main(int argc, char *argv[])
   }
   close(open("usertests.ran", O_CREATE));
 
-  reparent();
-  twochildren();
-  forkfork();
-  forkforkfork();
-  
-  argptest();
-  createdelete();
-  linkunlink();
-  concreate();
-  fourfiles();
-  sharedfd();
-
-  bigargtest();
-  bigwrite();
-  bigargtest();
-  bsstest();
-  sbrktest();
-  validatetest();
-  stacktest();
-  
-  opentest();
-  writetest();
-  writetest1();
-  createtest();
-
-  openiputtest();
-  exitiputtest();
-  iputtest();
-
-  mem();
-  pipe1();
-  preempt();
-  exitwait();
-
-  rmdot();
-  fourteen();
-  bigfile();
-  subdir();
-  linktest();
-  unlinkread();
-  dirfile();
-  iref();
-  forktest();
-  bigdir(); // slow
+  if(jobs > 0){
+    if((n = runtests(0, jobs) + runtests(1, 1)) > 0){
+      printf("%d tests FAILED\n", n);
+      exit(1);
+    }
+  } else {
+    for(i = 0; i < NTESTS; i++)
+      tests[i].f();
+  }
 
   exectest();
 
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("x", "sym") names x's stub sym, for a system call
+# that ulib.c wraps.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "sysfork");
+entry("exit", "sysexit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "sysclose");
 entry("kill");
-entry("exec");
+entry("exec", "sysexec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -32,11 +35,36 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
+entry("getpid", "sysgetpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
+entry("uptime", "sysuptime");
 entry("ntas");
 entry("crash");
 entry("mount");
 entry("umount");
+entry("mmap");
+entry("munmap");
+entry("memstat");
+entry("bcachesize");
+entry("logstat");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("sendfile");
+entry("diskmode");
+entry("iostat");
+entry("setpriority");
+entry("clone");
+entry("join");
+entry("usleep");
+entry("spawn", "sysspawn");
+entry("lockstat");
+entry("prof");
+entry("shmget");
+entry("poll");
+entry("futex");
+entry("dmesg");
+entry("getrusage");
+entry("getdents");
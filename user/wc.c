@@ -2,27 +2,29 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[512];
+char buf[65536];
+
+// what each byte is, for counting.
+#define SPACE 1
+#define NL 2
+uchar class[256];
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
+  int i, n, k;
   int l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
   while((n = read(fd, buf, sizeof(buf))) > 0){
+    c += n;
     for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+      k = class[(uchar)buf[i]];
+      l += k >> 1;
+      // a word starts at each non-space after a space.
+      w += !k & !inword;
+      inword = !(k & SPACE);
     }
   }
   if(n < 0){
@@ -36,6 +38,12 @@ int
 main(int argc, char *argv[])
 {
   int fd, i;
+  char *s;
+
+  for(s = " \r\t\v"; *s; s++)
+    class[(uchar)*s] = SPACE;
+  class['\n'] = SPACE | NL;
+  class[0] = SPACE;  // as strchr() found it
 
   if(argc <= 1){
     wc(0, "");
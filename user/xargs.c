@@ -0,0 +1,118 @@
+// xargs: run a command with arguments read from the input.
+// usage: xargs [-P jobs] [-n max] command [args...]
+// runs command args... with the words of each input line
+// appended, or with -n, with up to max words at a time
+// regardless of lines. With -P, keeps up to jobs commands
+// running at once.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+char *args[MAXARG];  // the command's fixed arguments, then words
+int nfixed;
+int nargs;
+char words[4096];    // the words in args
+int nwords;
+int jobs = 1, running, failed;
+
+// wait for one command to finish.
+void
+reap(void)
+{
+  int xstatus;
+
+  if(wait(&xstatus) < 0)
+    return;
+  running--;
+  if(xstatus != 0)
+    failed = 1;
+}
+
+// start the command with the words collected so far.
+void
+run(void)
+{
+  if(nargs == nfixed)
+    return;
+  args[nargs] = 0;
+  while(running >= jobs)
+    reap();
+  if(spawn(args[0], args, 0) < 0){
+    fprintf(2, "xargs: exec %s failed\n", args[0]);
+    failed = 1;
+  } else {
+    running++;
+  }
+  nargs = nfixed;
+  nwords = 0;
+}
+
+// add the word w[0..n) to the arguments.
+void
+addword(char *w, int n, int max)
+{
+  if(nargs == nfixed + max || nargs == MAXARG - 1 ||
+     nwords + n + 1 > sizeof(words))
+    run();
+  if(n + 1 > sizeof(words)){
+    fprintf(2, "xargs: argument too long\n");
+    exit(1);
+  }
+  memmove(words + nwords, w, n);
+  words[nwords + n] = 0;
+  args[nargs++] = words + nwords;
+  nwords += n + 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char buf[512], w[512], c;
+  int i, n, wn = 0, max = MAXARG;
+  int perline = 1;
+
+  for(i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2){
+    if(strcmp(argv[i], "-P") == 0)
+      jobs = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-n") == 0){
+      max = atoi(argv[i+1]);
+      perline = 0;
+    } else
+      break;
+  }
+  if(i >= argc || jobs < 1 || max < 1){
+    fprintf(2, "usage: xargs [-P jobs] [-n max] command [args...]\n");
+    exit(1);
+  }
+  for(; i < argc; i++){
+    if(nfixed == MAXARG - 2){
+      fprintf(2, "xargs: too many arguments\n");
+      exit(1);
+    }
+    args[nfixed++] = argv[i];
+  }
+  nargs = nfixed;
+
+  while((n = read(0, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      c = buf[i];
+      if(c == ' ' || c == '\t' || c == '\n'){
+        if(wn > 0)
+          addword(w, wn, max);
+        wn = 0;
+        if(c == '\n' && perline)
+          run();
+      } else if(wn < sizeof(w)){
+        w[wn++] = c;
+      }
+    }
+  }
+  if(wn > 0)
+    addword(w, wn, max);
+  run();
+  while(running > 0)
+    reap();
+  exit(failed);
+}